@@ -0,0 +1,137 @@
+#ifndef __BENCH_H__
+#define __BENCH_H__
+
+#include <cstdio>
+#include <cstdint>
+#include <ctime>
+#include <vector>
+#include <string>
+
+#include "latency_hist.h"
+
+/* Minimal microbenchmark harness shared by the bench programs.
+ * Each case is a LatencyHistogram of per operation times plus a throughput,
+ * BenchReport prints all of them as one JSON document so that the output
+ * of two releases can be diffed or compared by a script.
+ */
+
+#define BENCH_BATCH 	64 		// Operations timed together by bench_run()
+#define BENCH_MIN_S 	0.5 	// Default duration of a case
+
+static inline uint64_t bench_now_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+// Keep the compiler from dropping the result of a benchmarked call
+template <typename T>
+static inline void bench_keep(const T &val) {
+	__asm__ __volatile__("" : : "g"(&val) : "memory");
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Run fn() in batches of BENCH_BATCH for at least min_s seconds
+ *
+ * The mean time per call of each batch goes to hist, so the timer overhead
+ * is spread over the batch. Returns the number of calls.
+ *--------------------------------------------------------------------------------------*/
+template <typename F>
+uint64_t bench_run(F fn, LatencyHistogram *hist, double min_s = BENCH_MIN_S) {
+
+	uint64_t ops = 0;
+	uint64_t end = bench_now_ns() + (uint64_t)(min_s * 1e9);
+	uint64_t t0 = bench_now_ns(), t1;
+	do {
+		for (int i = 0; i < BENCH_BATCH; i++) {
+			fn();
+		}
+		t1 = bench_now_ns();
+		hist->record((t1 - t0) / BENCH_BATCH);
+		ops += BENCH_BATCH;
+		t0 = t1;
+	} while (t1 < end);
+
+	return ops;
+}
+
+class BenchReport {
+
+public:
+
+	explicit BenchReport(const char *suite) : m_suite(suite) {}
+
+	// Add a case. ops/elapsed_ns give the throughput, 0 for pure latencies.
+	void add(const std::string &name, const LatencyHistogram &hist, uint64_t ops = 0, uint64_t elapsed_ns = 0,
+		int threads = 1) {
+		Case c;
+		c.name = name;
+		c.threads = threads;
+		c.samples = hist.count();
+		c.ops = ops;
+		c.ops_per_s = elapsed_ns > 0 ? ops * 1e9 / elapsed_ns : 0;
+		c.mean = hist.mean();
+		c.min = hist.min();
+		c.max = hist.max();
+		static const double q[4] = {0.5, 0.9, 0.99, 0.999};
+		hist.percentiles(q, c.p, 4);
+		m_cases.push_back(c);
+	}
+
+	// Add a case with a single value (e.g. a size or a one shot time)
+	void addValue(const std::string &name, double value, const char *unit) {
+		Value v;
+		v.name = name;
+		v.value = value;
+		v.unit = unit;
+		m_values.push_back(v);
+	}
+
+	void print(FILE *out) const {
+		time_t now = time(NULL);
+		struct tm utc;
+		char date[32];
+		gmtime_r(&now, &utc);
+		strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", &utc);
+
+		fprintf(out, "{\n  \"suite\": \"%s\",\n  \"date\": \"%s\",\n  \"unit\": \"ns\",\n  \"cases\": [", m_suite.c_str(), date);
+		for (size_t i = 0; i < m_cases.size(); i++) {
+			const Case &c = m_cases[i];
+			fprintf(out, "%s\n    {\"name\": \"%s\", \"threads\": %d, \"samples\": %llu, \"ops\": %llu, \"ops_per_s\": %.0f, "
+				"\"mean\": %llu, \"min\": %llu, \"p50\": %llu, \"p90\": %llu, \"p99\": %llu, \"p999\": %llu, \"max\": %llu}",
+				i ? "," : "", c.name.c_str(), c.threads, (unsigned long long)c.samples, (unsigned long long)c.ops, c.ops_per_s,
+				(unsigned long long)c.mean, (unsigned long long)c.min, (unsigned long long)c.p[0], (unsigned long long)c.p[1],
+				(unsigned long long)c.p[2], (unsigned long long)c.p[3], (unsigned long long)c.max);
+		}
+		fprintf(out, "\n  ],\n  \"values\": [");
+		for (size_t i = 0; i < m_values.size(); i++) {
+			const Value &v = m_values[i];
+			fprintf(out, "%s\n    {\"name\": \"%s\", \"value\": %.6g, \"unit\": \"%s\"}", i ? "," : "", v.name.c_str(), v.value, v.unit);
+		}
+		fprintf(out, "\n  ]\n}\n");
+	}
+
+private:
+
+	struct Case {
+		std::string name;
+		int threads;
+		uint64_t samples;
+		uint64_t ops;
+		double ops_per_s;
+		uint64_t mean, min, max;
+		uint64_t p[4];
+	};
+
+	struct Value {
+		std::string name;
+		double value;
+		const char *unit;
+	};
+
+	std::string m_suite;
+	std::vector<Case> m_cases;
+	std::vector<Value> m_values;
+};
+
+#endif /* __BENCH_H__ */
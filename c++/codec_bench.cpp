@@ -0,0 +1,91 @@
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+#include <time.h>
+
+#include "tstamp_codec.h"
+#include "bench.h"
+
+// Encode/decode throughput of the timestamp stream format, JSON on standard output.
+//
+//	codec_bench [events per second] [seconds]
+
+int main(int argc, char **argv) {
+
+	uint32_t rate = argc > 1 ? (uint32_t)atoi(argv[1]) : 100000;
+	uint32_t seconds = argc > 2 ? (uint32_t)atoi(argv[2]) : 100;
+	if (rate == 0 || rate > 1000000000U || seconds == 0) {
+		fprintf(stderr, "usage: %s [events per second] [seconds]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	// Events at a steady rate with +-50 ns of jitter, flags change every 30 s
+	size_t n = (size_t)rate * seconds;
+	std::vector<int64_t> secs(n);
+	std::vector<uint32_t> nsecs(n);
+	std::vector<uint8_t> flags(n);
+	uint32_t period = 1000000000U / rate;
+	srand(1);
+	for (size_t i = 0; i < n; i++) {
+		uint32_t k = (uint32_t)(i % rate);
+		int64_t ns = (int64_t)k * period + rand() % 101 - 50;
+		secs[i] = 1700000000 + (int64_t)(i / rate);
+		nsecs[i] = (uint32_t)(ns < 0 ? 0 : ns);
+		flags[i] = (i / rate) % 30 == 29 ? TimeStamp::TS_NOPPS : TimeStamp::TS_VALID;
+	}
+
+	BenchReport report("codec");
+	LatencyHistogram h_enc, h_dec, h_seek;
+
+	// Per event times are averaged over batches of BENCH_BATCH
+	TsEncoder enc;
+	uint64_t t0 = bench_now_ns(), t1, start = t0;
+	for (size_t i = 0; i < n; i++) {
+		enc.append(secs[i], nsecs[i], flags[i]);
+		if ((i + 1) % BENCH_BATCH == 0) {
+			t1 = bench_now_ns();
+			h_enc.record((t1 - t0) / BENCH_BATCH);
+			t0 = t1;
+		}
+	}
+	report.add("encode", h_enc, n, bench_now_ns() - start);
+
+	TsDecoder dec(enc.data(), enc.size(), enc.index().data(), enc.index().size());
+	int64_t sec;
+	uint32_t nsec;
+	uint8_t f;
+	size_t errors = 0;
+	t0 = start = bench_now_ns();
+	for (size_t i = 0; i < n; i++) {
+		if (!dec.next(&sec, &nsec, &f) || sec != secs[i] || nsec != nsecs[i] || f != flags[i]) {
+			errors++;
+		}
+		if ((i + 1) % BENCH_BATCH == 0) {
+			t1 = bench_now_ns();
+			h_dec.record((t1 - t0) / BENCH_BATCH);
+			t0 = t1;
+		}
+	}
+	report.add("decode", h_dec, n, bench_now_ns() - start);
+
+	// Random access by second
+	size_t seeks = 10000;
+	start = bench_now_ns();
+	for (size_t i = 0; i < seeks; i++) {
+		int64_t target = 1700000000 + rand() % seconds;
+		t0 = bench_now_ns();
+		if (dec.seek(target) < 0 || !dec.next(&sec, &nsec, &f) || sec != target) {
+			errors++;
+		}
+		h_seek.record(bench_now_ns() - t0);
+	}
+	report.add("seek+next", h_seek, seeks, bench_now_ns() - start);
+
+	report.addValue("events", (double)n, "count");
+	report.addValue("encoded_size", (double)enc.size() / n, "bytes/event");
+	report.addValue("absolute_time_size", (double)sizeof(TimeStamp::AbsoluteTime), "bytes/event");
+	report.addValue("errors", (double)errors, "count");
+	report.print(stdout);
+
+	return errors == 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
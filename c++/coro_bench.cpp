@@ -0,0 +1,158 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+
+#include "tstamp.h"
+#include "tstamp_coro.h"
+#include "gnss_sim.h"
+#include "bench.h"
+
+// Coroutine awaitables (tstamp_coro.h) on the simulated receiver.
+//
+//	coro_bench [-n seconds] [-o file]
+//
+// One task waits for every epoch, one for the OVTIME transitions and
+// CORO_BENCH_IDLE more for NOPPS ones that never come, while a thread
+// publishes OVTIME transitions as fast as it can, overlapping the epoch
+// dispatches of the GGA thread. Every published epoch must resume the epoch
+// task, a miss is reported and fails the run. Built with -std=c++20
+// -DTSTAMP_COROUTINES, see the Makefile.
+
+#define CORO_BENCH_IDLE 	64
+
+static std::atomic<bool> g_toggle(true);
+static std::atomic<uint32_t> g_published(0);
+
+static uint32_t g_resumed = 0; // Tasks run in the main thread only
+static uint32_t g_flag_events = 0;
+static LatencyHistogram g_resume;
+
+static void count_epoch(const TimeEvent *ev, void *arg) {
+	g_published.fetch_add(1, std::memory_order_relaxed);
+}
+
+static TimeTask epoch_task(TimeEventLoop &loop) {
+	for (;;) {
+		TimeEvent ev = co_await loop.nextEpoch();
+		struct timespec now;
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		g_resume.record((uint64_t)((now.tv_sec - ev.notify_ts.tv_sec) * 1000000000LL + now.tv_nsec - ev.notify_ts.tv_nsec));
+		g_resumed++;
+	}
+}
+
+static TimeTask flags_task(TimeEventLoop &loop) {
+	for (;;) {
+		co_await loop.flagsChanged(TimeStamp::TS_OVTIME);
+		g_flag_events++;
+	}
+}
+
+static TimeTask idle_task(TimeEventLoop &loop) {
+	co_await loop.flagsChanged(TimeStamp::TS_NOPPS);
+}
+
+static void *toggle_fcn(void *ptr) {
+	TimeStamp *ts = static_cast<TimeStamp*>(ptr);
+	TimeEvent ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.kind = TEV_FLAGS;
+	ev.old_flags = TimeStamp::TS_OVTIME;
+	while (g_toggle.load(std::memory_order_relaxed)) {
+		ts->notifier().publish(&ev);
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+
+	int seconds = 5;
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "n:o:")) != -1) {
+		switch (opt) {
+		case 'n': seconds = atoi(optarg); break;
+		case 'o': out_path = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-n seconds] [-o file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	GnssSim sim;
+	if (sim.start() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	TimeStamp ts;
+	TimeEventLoop loop(ts);
+	if (loop.fd() < 0) {
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+	int sub = ts.subscribe(TEV_EPOCH, count_epoch, NULL);
+
+	// Both tasks wait before the first event
+	epoch_task(loop);
+	flags_task(loop);
+	for (int i = 0; i < CORO_BENCH_IDLE; i++) {
+		idle_task(loop);
+	}
+
+	TimeStamp::Options opts;
+	opts.state_file = NULL;
+	opts.uart_device = sim.uartDevice();
+	opts.fpga_sim = true;
+	if (ts.init(opts) < 0) {
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	pthread_t toggler;
+	pthread_create(&toggler, NULL, toggle_fcn, &ts);
+
+	uint64_t end = bench_now_ns() + (uint64_t)seconds * 1000000000ULL;
+	while (bench_now_ns() < end) {
+		struct pollfd pfd = { loop.fd(), POLLIN, 0 };
+		if (poll(&pfd, 1, 100) > 0) {
+			loop.runReady();
+		}
+	}
+
+	g_toggle.store(false);
+	pthread_join(toggler, NULL);
+	ts.destroy();
+	loop.runReady();
+	ts.unsubscribe(sub);
+	sim.stop();
+
+	uint32_t published = g_published.load();
+	uint32_t missed = published > g_resumed ? published - g_resumed : 0;
+
+	BenchReport report("coro");
+	report.add("epoch_resume", g_resume);
+	report.addValue("epochs", (double)published, "count");
+	report.addValue("epochs_missed", (double)missed, "count");
+	report.addValue("flag_events", (double)g_flag_events, "count");
+
+	FILE *out = out_path ? fopen(out_path, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "coro_bench: Error: cannot open %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+	report.print(out);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	if (published == 0 || missed > 0) {
+		fprintf(stderr, "coro_bench: Error: %u of %u epochs not delivered to the waiting task\n", missed, published);
+		return EXIT_FAILURE;
+	}
+
+	return EXIT_SUCCESS;
+}
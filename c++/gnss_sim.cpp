@@ -0,0 +1,323 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <termios.h>
+
+#include "hk_fpga_sim.h"
+#include "gnss_sim.h"
+#include "ubx.h"
+#include "time_scale.h"
+
+void *gnssSimThreadFcn(void *ptr);
+
+GnssSim::GnssSim() : m_master_fd(-1), m_slave_fd(-1), m_gga_delay_ms(GNSS_SIM_GGA_DELAY_MS),
+	m_pulse_ms(GNSS_SIM_PULSE_MS), m_stop(false), m_edges(0), m_late_every(0), m_late_us(0), m_ubx(false), m_started(false),
+	m_loopback(false), m_saved_loop(0), m_saved_dir(0) {
+	m_slave_name[0] = '\0';
+}
+
+GnssSim::~GnssSim() {
+	stop();
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Start the simulated FPGA registers, the pseudo terminal and the PPS thread
+ *
+ * @param gga_delay_ms  Delay of the GGA sentence after the PPS edge (< 1000)
+ * @param pulse_ms      PPS pulse width (< gga_delay_ms)
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int GnssSim::start(uint32_t gga_delay_ms, uint32_t pulse_ms) {
+
+	if (m_started) {
+		return 0;
+	}
+	if (gga_delay_ms >= 1000 || pulse_ms >= gga_delay_ms) {
+		fprintf(stderr, "GnssSim::start: Error: invalid timing %u/%u ms\n", pulse_ms, gga_delay_ms);
+		return -1;
+	}
+	m_gga_delay_ms = gga_delay_ms;
+	m_pulse_ms = pulse_ms;
+
+	m_master_fd = posix_openpt(O_RDWR | O_NOCTTY);
+	if (m_master_fd < 0 || grantpt(m_master_fd) < 0 || unlockpt(m_master_fd) < 0
+		|| ptsname_r(m_master_fd, m_slave_name, sizeof(m_slave_name)) != 0) {
+		fprintf(stderr, "GnssSim::start: Error: cannot create the pseudo terminal\n");
+		stop();
+		return -1;
+	}
+
+	m_slave_fd = open(m_slave_name, O_RDWR | O_NOCTTY);
+	if (m_slave_fd < 0) {
+		fprintf(stderr, "GnssSim::start: Error: cannot open %s\n", m_slave_name);
+		stop();
+		return -1;
+	}
+
+	// No echo back to the master
+	struct termios settings;
+	tcgetattr(m_slave_fd, &settings);
+	settings.c_lflag &= ~(ECHO | ECHONL);
+	tcsetattr(m_slave_fd, TCSANOW, &settings);
+
+	if (hk_fpga_sim_init() < 0) {
+		stop();
+		return -1;
+	}
+
+	m_loopback = false;
+	m_stop.store(false);
+	m_edges.store(0);
+	if (pthread_create(&m_thread, NULL, gnssSimThreadFcn, this) != 0) {
+		fprintf(stderr, "GnssSim::start: Error: cannot start the PPS thread\n");
+		hk_fpga_sim_uninit();
+		stop();
+		return -1;
+	}
+	m_started = true;
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Drive the PPS input of the real FPGA through the digital loopback
+ *
+ * @param pulse_ms  PPS pulse width (< 1000)
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int GnssSim::startLoopback(uint32_t pulse_ms) {
+
+	if (m_started) {
+		return 0;
+	}
+	if (g_hk_fpga_reg_mem == NULL) {
+		fprintf(stderr, "GnssSim::startLoopback: Error: FPGA not mapped\n");
+		return -1;
+	}
+	if (pulse_ms == 0 || pulse_ms >= 1000) {
+		fprintf(stderr, "GnssSim::startLoopback: Error: invalid pulse %u ms\n", pulse_ms);
+		return -1;
+	}
+	m_pulse_ms = pulse_ms;
+
+	m_saved_loop = g_hk_fpga_reg_mem->digital_loop;
+	m_saved_dir = g_hk_fpga_reg_mem->dir_p;
+	g_hk_fpga_reg_mem->out_p &= ~HK_FPGA_GPIO_BIT7;
+	g_hk_fpga_reg_mem->dir_p &= ~HK_FPGA_GPIO_BIT7; // Output
+	g_hk_fpga_reg_mem->digital_loop = 1;
+
+	m_loopback = true;
+	m_stop.store(false);
+	m_edges.store(0);
+	if (pthread_create(&m_thread, NULL, gnssSimThreadFcn, this) != 0) {
+		fprintf(stderr, "GnssSim::startLoopback: Error: cannot start the PPS thread\n");
+		g_hk_fpga_reg_mem->digital_loop = m_saved_loop;
+		g_hk_fpga_reg_mem->dir_p = m_saved_dir;
+		m_loopback = false;
+		return -1;
+	}
+	m_started = true;
+
+	return 0;
+}
+
+void GnssSim::stop() {
+
+	if (m_started) {
+		m_stop.store(true);
+		pthread_join(m_thread, NULL);
+		if (m_loopback) {
+			if (g_hk_fpga_reg_mem != NULL) {
+				g_hk_fpga_reg_mem->digital_loop = m_saved_loop;
+				g_hk_fpga_reg_mem->dir_p = m_saved_dir;
+			}
+			m_loopback = false;
+		} else {
+			hk_fpga_sim_uninit();
+		}
+		m_started = false;
+	}
+	if (m_slave_fd >= 0) {
+		close(m_slave_fd);
+		m_slave_fd = -1;
+	}
+	if (m_master_fd >= 0) {
+		close(m_master_fd);
+		m_master_fd = -1;
+	}
+}
+
+int GnssSim::findEdge(int64_t sec, struct timespec *edge) const {
+
+	m_edge_ts[sec % GNSS_SIM_EDGES].load(edge);
+	return edge->tv_sec == sec ? 0 : -1;
+}
+
+// Sleep until ts (CLOCK_REALTIME) in steps short enough to honour stop().
+bool GnssSim::sleepUntil(const struct timespec *ts) {
+
+	while (!m_stop.load(std::memory_order_relaxed)) {
+		struct timespec now, step;
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (now.tv_sec > ts->tv_sec || (now.tv_sec == ts->tv_sec && now.tv_nsec >= ts->tv_nsec)) {
+			return true;
+		}
+		step = now;
+		step.tv_nsec += 100000000;
+		if (step.tv_nsec >= 1000000000) {
+			step.tv_sec++;
+			step.tv_nsec -= 1000000000;
+		}
+		if (step.tv_sec > ts->tv_sec || (step.tv_sec == ts->tv_sec && step.tv_nsec > ts->tv_nsec)) {
+			step = *ts;
+		}
+		clock_nanosleep(CLOCK_REALTIME, TIMER_ABSTIME, &step, NULL);
+	}
+	return false;
+}
+
+void GnssSim::setPps(int high) {
+
+	if (!m_loopback) {
+		hk_fpga_sim_set_input(HK_FPGA_GPIO_BIT7, high);
+	} else if (high) {
+		g_hk_fpga_reg_mem->out_p |= HK_FPGA_GPIO_BIT7;
+	} else {
+		g_hk_fpga_reg_mem->out_p &= ~HK_FPGA_GPIO_BIT7;
+	}
+}
+
+void GnssSim::sendGga(int64_t sec) {
+
+	time_t t = (time_t)sec;
+	struct tm utc;
+	gmtime_r(&t, &utc);
+
+	char body[96];
+	snprintf(body, sizeof(body), "GPGGA,%02d%02d%02d.00,4349.3540,N,01115.2380,E,1,08,0.9,51.0,M,46.9,M,,",
+		utc.tm_hour, utc.tm_min, utc.tm_sec);
+
+	uint8_t sum = 0;
+	for (const char *p = body; *p; p++) {
+		sum ^= (uint8_t)*p;
+	}
+
+	char line[112];
+	int n = snprintf(line, sizeof(line), "$%s*%02X\r\n", body, sum);
+	if (::write(m_master_fd, line, n) != n) {
+		fprintf(stderr, "GnssSim::sendGga: Error: short write\n");
+	}
+}
+
+// One UBX frame, payload of len bytes
+static int ubx_frame(uint8_t *frame, uint8_t id, const uint8_t *payload, uint16_t len) {
+	frame[0] = UBX_SYNC1;
+	frame[1] = UBX_SYNC2;
+	frame[2] = UBX_CLASS_NAV;
+	frame[3] = id;
+	frame[4] = (uint8_t)len;
+	frame[5] = (uint8_t)(len >> 8);
+	memcpy(&frame[6], payload, len);
+	uint8_t ck_a = 0, ck_b = 0;
+	for (int i = 2; i < 6 + len; i++) {
+		ck_a += frame[i];
+		ck_b += ck_a;
+	}
+	frame[6 + len] = ck_a;
+	frame[7 + len] = ck_b;
+	return 8 + len;
+}
+
+// Leap second data of the built-in table, no change announced, then the time
+void GnssSim::sendUbx(int64_t sec) {
+
+	time_t t = (time_t)sec;
+	struct tm utc;
+	gmtime_r(&t, &utc);
+
+	uint8_t ls[UBX_NAV_TIMELS_LEN];
+	memset(ls, 0, sizeof(ls));
+	ls[8] = 2; // GPS
+	ls[9] = (uint8_t)(time_scale_tai_utc(sec) - TAI_GPS_OFFSET);
+	ls[23] = 0x01; // validCurrLs
+
+	uint8_t tu[UBX_NAV_TIMEUTC_LEN];
+	memset(tu, 0, sizeof(tu));
+	tu[12] = (uint8_t)(utc.tm_year + 1900);
+	tu[13] = (uint8_t)((utc.tm_year + 1900) >> 8);
+	tu[14] = (uint8_t)(utc.tm_mon + 1);
+	tu[15] = (uint8_t)utc.tm_mday;
+	tu[16] = (uint8_t)utc.tm_hour;
+	tu[17] = (uint8_t)utc.tm_min;
+	tu[18] = (uint8_t)utc.tm_sec;
+	tu[19] = 0x07; // validTOW, validWKN, validUTC
+
+	uint8_t buf[2 * 8 + UBX_NAV_TIMELS_LEN + UBX_NAV_TIMEUTC_LEN];
+	int n = ubx_frame(buf, UBX_NAV_TIMELS, ls, sizeof(ls));
+	n += ubx_frame(buf + n, UBX_NAV_TIMEUTC, tu, sizeof(tu));
+	if (::write(m_master_fd, buf, n) != n) {
+		fprintf(stderr, "GnssSim::sendUbx: Error: short write\n");
+	}
+}
+
+void *gnssSimThreadFcn(void *ptr) {
+	GnssSim *sim = static_cast<GnssSim*>(ptr);
+
+	struct timespec now, at;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int64_t sec = now.tv_sec + 1;
+
+	while (!sim->m_stop.load(std::memory_order_relaxed)) {
+
+		at.tv_sec = sec;
+		at.tv_nsec = 0;
+		if (!sim->sleepUntil(&at)) {
+			break;
+		}
+
+		// Rising edge, the time of the store is the reference of the benchmarks
+		struct timespec edge;
+		uint32_t every = sim->m_late_every.load(std::memory_order_relaxed);
+		if (every > 0 && sim->m_edges.load(std::memory_order_relaxed) % every == every - 1) {
+			clock_gettime(CLOCK_REALTIME, &edge);
+			usleep(sim->m_late_us.load(std::memory_order_relaxed));
+			sim->setPps(1);
+		} else {
+			sim->setPps(1);
+			clock_gettime(CLOCK_REALTIME, &edge);
+		}
+		sim->m_edge_ts[sec % GNSS_SIM_EDGES].store(edge);
+		sim->m_edges.fetch_add(1, std::memory_order_relaxed);
+
+		at.tv_nsec = sim->m_pulse_ms * 1000000L;
+		if (!sim->sleepUntil(&at)) {
+			break;
+		}
+		sim->setPps(0);
+
+		if (!sim->m_loopback) {
+			at.tv_nsec = sim->m_gga_delay_ms * 1000000L;
+			if (!sim->sleepUntil(&at)) {
+				break;
+			}
+			if (sim->m_ubx.load(std::memory_order_relaxed)) {
+				sim->sendUbx(sec);
+			} else {
+				sim->sendGga(sec);
+			}
+		}
+
+		// Skip the seconds lost if the thread was delayed
+		clock_gettime(CLOCK_REALTIME, &now);
+		sec = now.tv_sec + 1;
+	}
+
+	sim->setPps(0);
+	return NULL;
+}
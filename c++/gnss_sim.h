@@ -0,0 +1,86 @@
+#ifndef __GNSS_SIM_H__
+#define __GNSS_SIM_H__
+
+#include <cstdint>
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+
+#include "seqlock.h"
+
+#define GNSS_SIM_PULSE_MS 		100 	// PPS pulse width
+#define GNSS_SIM_GGA_DELAY_MS 	300 	// GGA sentence after the PPS edge
+#define GNSS_SIM_EDGES 			16 		// Edges kept for findEdge()
+
+/* Simulated GNSS receiver for benchmarks and bench tests without hardware.
+ * A thread raises HK_FPGA_GPIO_BIT7 of the simulated registers (hk_fpga_sim)
+ * on each CLOCK_REALTIME second and writes the matching GGA sentence to a
+ * pseudo terminal. TimeStamp runs unchanged with Options::fpga_sim set and
+ * Options::uart_device = uartDevice(). With setUbx() the label is sent as
+ * UBX frames, for LabelUbx (tstamp_policy.h).
+ *
+ * startLoopback() drives the real PPS line instead: DIO7_P is turned into an
+ * output with the FPGA digital loopback on, so the edges go through the same
+ * input register as the receiver PPS. The GGA still comes from the receiver.
+ */
+class GnssSim {
+
+public:
+
+	GnssSim();
+	~GnssSim();
+
+	int start(uint32_t gga_delay_ms = GNSS_SIM_GGA_DELAY_MS, uint32_t pulse_ms = GNSS_SIM_PULSE_MS);
+	int startLoopback(uint32_t pulse_ms = GNSS_SIM_PULSE_MS); // FPGA already mapped by hk_fpga_init()
+	void stop();
+
+	// Slave side of the pseudo terminal, valid after start()
+	const char *uartDevice() const { return m_slave_name; }
+
+	// Time the input was raised for the edge of second sec, -1 if unknown
+	int findEdge(int64_t sec, struct timespec *edge) const;
+
+	uint32_t edges() const { return m_edges.load(std::memory_order_relaxed); }
+
+	// Raise one edge every `every` late_us after its reference time, as a late
+	// wakeup of the poll would see it. findEdge() keeps the on time reference.
+	// every = 0 disables.
+	void setLateEdges(uint32_t every, uint32_t late_us) {
+		m_late_us.store(late_us, std::memory_order_relaxed);
+		m_late_every.store(every, std::memory_order_relaxed);
+	}
+
+	// Send UBX NAV-TIMELS and NAV-TIMEUTC frames instead of the GGA sentence
+	void setUbx(bool on) { m_ubx.store(on, std::memory_order_relaxed); }
+
+	friend void *gnssSimThreadFcn(void *ptr);
+
+private:
+
+	int m_master_fd;
+	int m_slave_fd; // Kept open so the master never sees a hang up
+	char m_slave_name[64];
+
+	uint32_t m_gga_delay_ms;
+	uint32_t m_pulse_ms;
+
+	std::atomic<bool> m_stop;
+	std::atomic<uint32_t> m_edges;
+	std::atomic<uint32_t> m_late_every;
+	std::atomic<uint32_t> m_late_us;
+	std::atomic<bool> m_ubx;
+	bool m_started;
+	bool m_loopback;
+	uint32_t m_saved_loop; // Registers restored by stop() in loopback mode
+	uint32_t m_saved_dir;
+	pthread_t m_thread;
+
+	SeqLock<struct timespec> m_edge_ts[GNSS_SIM_EDGES];
+
+	bool sleepUntil(const struct timespec *ts);
+	void setPps(int high);
+	void sendGga(int64_t sec);
+	void sendUbx(int64_t sec);
+};
+
+#endif /* __GNSS_SIM_H__ */
@@ -1,8 +1,14 @@
 #include <cstdio>
 #include <cstdlib>
+#include <ctime>
 #include <unistd.h>
 #include <signal.h>
 #include "tstamp.h"
+#include "tstamp_log.h"
+#include "tstamp_trace.h"
+#include "metrics_exporter.h"
+#include "ntp_server.h"
+#include "ptp_master.h"
 
 // Flag per gestire il segnale di interruzione
 volatile bool running = true;
@@ -41,6 +47,29 @@ void print_status_flags(TimeStamp::StatusFlags flags) {
     printf("]\n");
 }
 
+void print_flag_counters(const TimeStamp::StatusSnapshot* snap) {
+    static const struct { TimeStamp::TimeSts flag; int bit; const char* name; } flags[] = {
+        { TimeStamp::TS_NOPPS, 7, "NOPPS" },
+        { TimeStamp::TS_NOUART, 6, "NOUART" },
+        { TimeStamp::TS_OVTIME, 5, "OVTIME" },
+        { TimeStamp::TS_NOTIME, 4, "NOTIME" },
+    };
+    for (size_t i = 0; i < sizeof(flags) / sizeof(flags[0]); i++) {
+        const TimeStamp::FlagCounters* c = &snap->counters[flags[i].bit];
+        printf("%-6s raised %u cleared %u, %.3f s raised\n", flags[i].name,
+               c->raised, c->cleared, c->raised_ns / 1e9);
+    }
+}
+
+void print_latency(const char* name, const LatencyHistogram& h) {
+    static const double q[] = { 0.5, 0.99, 0.999 };
+    uint64_t v[3];
+    h.percentiles(q, v, 3);
+    printf("%-12s n=%llu p50 %llu ns p99 %llu ns p99.9 %llu ns max %llu ns\n", name,
+           (unsigned long long)h.count(), (unsigned long long)v[0], (unsigned long long)v[1],
+           (unsigned long long)v[2], (unsigned long long)h.max());
+}
+
 void print_current_time(const TimeStamp::CurrentTime* currTime) {
     printf("Current Time: %02d:%02d:%02d.%06d (ts: %ld.%09ld)\n", 
            currTime->hh, currTime->mm, currTime->ss, currTime->us,
@@ -62,20 +91,71 @@ int main() {
     signal(SIGINT, signal_handler);
     signal(SIGTERM, signal_handler);
     
+    // Diagnostica asincrona dei thread di acquisizione: TSTAMP_LOG=/path/file (o - per stderr),
+    // livello con TSTAMP_LOG_LEVEL=0..3 (errori .. debug)
+    const char* log_path = getenv("TSTAMP_LOG");
+    if (log_path != NULL) {
+        const char* log_level = getenv("TSTAMP_LOG_LEVEL");
+        tstamp_log_start(log_path, log_level != NULL ? atoi(log_level) : TLOG_INFO);
+    }
+    
     // Crea l'oggetto TimeStamp
     TimeStamp tstamp;
     
     // Inizializza il sistema
     printf("Initializing GPS timestamp system...\n");
-    int res = tstamp.init();
+    TimeStamp::Options opts;
+    // Refclock SHM opzionale per chrony/ntpd: TSTAMP_SHM_UNIT=0 (unita' 0 e 1)
+    const char* shm_unit = getenv("TSTAMP_SHM_UNIT");
+    if (shm_unit != NULL) {
+        opts.shm_unit = atoi(shm_unit);
+    }
+    // PPS dal kernel al posto del polling FPGA: TSTAMP_PPS_DEVICE=/dev/pps0
+    opts.pps_device = getenv("TSTAMP_PPS_DEVICE");
+    // Etichette da gpsd al posto della UART: TSTAMP_GPSD=127.0.0.1
+    opts.gpsd_host = getenv("TSTAMP_GPSD");
+    int res = tstamp.init(opts);
     if (res < 0) {
         printf("Error: Failed to initialize GPS timestamp system\n");
         return EXIT_FAILURE;
     }
     printf("GPS timestamp system initialized successfully!\n\n");
+
+    // Tabella leap second aggiornata (formato IERS/NIST): TSTAMP_LEAP_FILE=/usr/share/zoneinfo/leap-seconds.list
+    const char* leap_file = getenv("TSTAMP_LEAP_FILE");
+    if (leap_file != NULL && time_scale_load(leap_file) == 0) {
+        printf("Leap second table %s, TAI-UTC %d s\n\n", leap_file,
+               time_scale_tai_utc(time(NULL)));
+    }
+
+    // Esportazione metriche opzionale: TSTAMP_METRICS=/path/socket
+    MetricsExporter exporter(tstamp);
+    const char* metrics_path = getenv("TSTAMP_METRICS");
+    if (metrics_path != NULL && exporter.start(metrics_path) == 0) {
+        printf("Metrics served on %s\n\n", metrics_path);
+    }
+
+    // Server NTP opzionale: TSTAMP_NTP_PORT=123
+    NtpServer ntp(tstamp);
+    const char* ntp_port = getenv("TSTAMP_NTP_PORT");
+    if (ntp_port != NULL && ntp.start((uint16_t)atoi(ntp_port)) == 0) {
+        printf("NTP served on UDP port %s\n\n", ntp_port);
+    }
+
+    // Grandmaster PTP opzionale sul gruppo multicast: TSTAMP_PTP_IFACE=eth0
+    PtpMaster ptp(tstamp);
+    PtpMaster::Config ptp_cfg;
+    ptp_cfg.iface = getenv("TSTAMP_PTP_IFACE");
+    if (ptp_cfg.iface != NULL && ptp.start(ptp_cfg) == 0) {
+        printf("PTP grandmaster on %s, domain %u\n\n", ptp_cfg.iface, ptp_cfg.domain);
+    }
     
+    // Ring dei tracepoint anche per le read() di questo thread (make DEBUG=1)
+    TSTAMP_TRACE_THREAD_START();
+
     // Loop principale
     int iteration = 0;
+    uint32_t last_seq = tstamp.notifier().lastSeq();
     while (running) {
         iteration++;
         
@@ -87,10 +167,14 @@ int main() {
         
         // Leggi il tempo corrente
         TimeStamp::CurrentTime currTime;
-        uint32_t status = tstamp.read(&currTime);
+        TimeStamp::TimeQuality quality;
+        uint32_t status = tstamp.read(&currTime, &quality);
         
         if (status == TimeStamp::TS_VALID) {
             print_current_time(&currTime);
+            // Qualita': classe 0..3, fix GGA, satelliti, HDOP, incertezza stimata
+            printf("Quality: class %u fix %u sats %u hdop %.1f uncertainty %u ns\n", quality.cls, quality.fix,
+                quality.sats, quality.hdop_x10 / 10.0, quality.uncertainty_ns);
             
             // Calcola il tempo assoluto
             struct timespec now;
@@ -105,13 +189,29 @@ int main() {
         
         printf("\n");
         
-        // Attendi 2 secondi
-        sleep(2);
+        // Attendi la prossima epoca PPS o un cambio di stato (max 2 secondi)
+        TimeEvent ev;
+        if (tstamp.waitEvent(TEV_ALL, last_seq, &ev, 2000) == 0) {
+            last_seq = ev.seq;
+        }
     }
     
+    TimeStamp::StatusSnapshot snap;
+    tstamp.getStatusSnapshot(&snap);
+    print_flag_counters(&snap);
+    
+    print_latency("pps_wait", tstamp.latency(TimeStamp::LAT_PPS_WAIT));
+    print_latency("gga_delay", tstamp.latency(TimeStamp::LAT_GGA_DELAY));
+    print_latency("read", tstamp.latency(TimeStamp::LAT_READ));
+    print_latency("pps_bracket", tstamp.latency(TimeStamp::LAT_PPS_BRACKET));
+    print_latency("notify_wake", tstamp.notifier().wakeHistogram());
+    
     // Cleanup
     printf("Shutting down GPS timestamp system...\n");
+    ptp.stop();
+    ntp.stop();
     tstamp.destroy();
+    tstamp_log_stop();
     printf("GPS timestamp system shut down successfully.\n");
     
     return EXIT_SUCCESS;
@@ -0,0 +1,337 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "gpsd.h"
+#include "tstamp_log.h"
+
+#define GPSD_WATCH "?WATCH={\"enable\":true,\"json\":true};\n"
+
+int g_gpsd_fd = -1;
+
+static char g_gpsd_host[64] = GPSD_HOST;
+static uint16_t g_gpsd_port = GPSD_PORT;
+static uint8_t g_gpsd_buff[1024];
+static int g_gpsd_pos = 0;
+static int g_gpsd_len = 0;
+static gpsd_parser_t g_gpsd_parser;
+
+static inline bool is_digit(char c) {
+	return c >= '0' && c <= '9';
+}
+
+// "2024-05-01T12:34:56.000Z", the date is not used
+static bool parse_time(const char *s, int len, nmea_gga_t *label) {
+
+	if (len < 20 || s[10] != 'T' || s[13] != ':' || s[16] != ':') {
+		return false;
+	}
+	static const int pos[] = { 11, 12, 14, 15, 17, 18 };
+	for (unsigned i = 0; i < sizeof(pos) / sizeof(pos[0]); i++) {
+		if (!is_digit(s[pos[i]])) {
+			return false;
+		}
+	}
+	label->talker = 'D';
+	label->hh = (s[11] - '0') * 10 + (s[12] - '0');
+	label->mm = (s[14] - '0') * 10 + (s[15] - '0');
+	label->ss = (s[17] - '0') * 10 + (s[18] - '0');
+	label->us = 0;
+	label->fix = NMEA_FIX_UNKNOWN; // From the TPV mode, see gpsd_parser_feed()
+	label->sats = NMEA_SATS_UNKNOWN;
+	label->hdop_x10 = NMEA_HDOP_UNKNOWN;
+	if (s[19] == '.') {
+		uint32_t scale = 100000;
+		for (int i = 20; i < len && scale > 0 && is_digit(s[i]); i++) {
+			label->us += (s[i] - '0') * scale;
+			scale /= 10;
+		}
+	}
+	return true;
+}
+
+// A top level member is complete
+static void parser_member(gpsd_parser_t *p) {
+
+	p->key[p->key_len] = '\0';
+	p->val[p->val_len] = '\0';
+	gpsd_msg_t *m = &p->msg;
+
+	if (strcmp(p->key, "class") == 0) {
+		m->cls = strcmp(p->val, "TPV") == 0 ? GPSD_TPV : strcmp(p->val, "SKY") == 0 ? GPSD_SKY : GPSD_OTHER;
+	} else if (strcmp(p->key, "mode") == 0) {
+		m->mode = atoi(p->val);
+	} else if (strcmp(p->key, "time") == 0) {
+		m->has_time = parse_time(p->val, p->val_len, &m->label);
+	} else if (strcmp(p->key, "uSat") == 0) {
+		long n = strtol(p->val, NULL, 10);
+		m->sats = (uint8_t)(n >= 0 && n < NMEA_SATS_UNKNOWN ? n : NMEA_SATS_UNKNOWN);
+	} else if (strcmp(p->key, "hdop") == 0) {
+		double h = strtod(p->val, NULL) * 10.0 + 0.5;
+		m->hdop_x10 = (uint16_t)(h >= 0 && h < NMEA_HDOP_UNKNOWN ? h : NMEA_HDOP_UNKNOWN);
+	}
+
+	p->in_value = false;
+	p->in_scalar = false;
+}
+
+static inline void parser_append(gpsd_parser_t *p, char c) {
+	if (p->in_key) {
+		if (p->key_len < (int)sizeof(p->key) - 1) {
+			p->key[p->key_len++] = c;
+		}
+	} else if (p->in_value && p->val_len < (int)sizeof(p->val) - 1) {
+		p->val[p->val_len++] = c;
+	}
+}
+
+void gpsd_parser_reset(gpsd_parser_t *p) {
+	memset(p, 0, sizeof(*p));
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Feed one byte of the gpsd stream
+ *
+ * @retval 1 A report is complete, msg is filled
+ * @retval 0 More bytes needed
+ *--------------------------------------------------------------------------------------*/
+int gpsd_parser_feed(gpsd_parser_t *p, uint8_t c, gpsd_msg_t *msg) {
+
+	if (p->in_string) {
+		if (p->escape) {
+			p->escape = false;
+			if (p->depth == 1) {
+				parser_append(p, (char)c);
+			}
+		} else if (c == '\\') {
+			p->escape = true;
+		} else if (c == '"') {
+			p->in_string = false;
+			if (p->depth == 1) {
+				if (p->in_key) {
+					p->in_key = false;
+				} else if (p->in_value) {
+					parser_member(p);
+				}
+			}
+		} else if (p->depth == 1) {
+			parser_append(p, (char)c);
+		}
+		return 0;
+	}
+
+	switch (c) {
+	case '{':
+		if (++p->depth == 1) {
+			memset(&p->msg, 0, sizeof(p->msg));
+			p->msg.sats = NMEA_SATS_UNKNOWN;
+			p->msg.hdop_x10 = NMEA_HDOP_UNKNOWN;
+			p->in_value = false;
+			p->in_key = false;
+			p->in_scalar = false;
+		}
+		break;
+	case '[':
+		p->depth++;
+		break;
+	case '}':
+	case ']':
+		if (p->depth == 1 && p->in_scalar) {
+			parser_member(p);
+		}
+		if (p->depth > 0) {
+			p->depth--;
+		}
+		if (p->depth == 1) {
+			p->in_value = false; // End of a nested value
+		} else if (p->depth == 0 && c == '}') {
+			*msg = p->msg;
+			if (msg->has_time) {
+				msg->label.fix = msg->mode >= 2 ? NMEA_FIX_GPS : NMEA_FIX_NONE;
+			}
+			return 1;
+		}
+		break;
+	case '"':
+		p->in_string = true;
+		if (p->depth == 1) {
+			if (p->in_value) {
+				p->val_len = 0;
+			} else {
+				p->in_key = true;
+				p->key_len = 0;
+			}
+		}
+		break;
+	case ':':
+		if (p->depth == 1) {
+			p->in_value = true;
+			p->val_len = 0;
+		}
+		break;
+	case ',':
+		if (p->depth == 1) {
+			if (p->in_scalar) {
+				parser_member(p);
+			}
+			p->in_value = false;
+		}
+		break;
+	case ' ':
+	case '\t':
+	case '\r':
+	case '\n':
+		if (p->depth == 1 && p->in_scalar) {
+			parser_member(p);
+		}
+		break;
+	default:
+		if (p->depth == 1 && p->in_value) {
+			p->in_scalar = true;
+			parser_append(p, (char)c);
+		}
+		break;
+	}
+
+	return 0;
+}
+
+// Connect to g_gpsd_host:g_gpsd_port and start the JSON watch. On failure
+// errno is set and *step names the failed step.
+static int gpsd_connect(const char **step) {
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(g_gpsd_port);
+	if (inet_pton(AF_INET, g_gpsd_host, &sa.sin_addr) != 1) {
+		*step = "invalid address";
+		errno = EINVAL;
+		return -1;
+	}
+
+	g_gpsd_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (g_gpsd_fd < 0 || connect(g_gpsd_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		*step = "cannot connect";
+		int err = errno;
+		gpsd_uninit();
+		errno = err;
+		return -1;
+	}
+
+	if (write(g_gpsd_fd, GPSD_WATCH, strlen(GPSD_WATCH)) != (ssize_t)strlen(GPSD_WATCH)) {
+		*step = "WATCH request failed";
+		int err = errno;
+		gpsd_uninit();
+		errno = err;
+		return -1;
+	}
+
+	g_gpsd_pos = 0;
+	g_gpsd_len = 0;
+	gpsd_parser_reset(&g_gpsd_parser);
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Connect to gpsd and start the JSON watch
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int gpsd_init(const char *host, uint16_t port) {
+
+	if (host != g_gpsd_host) {
+		snprintf(g_gpsd_host, sizeof(g_gpsd_host), "%s", host);
+	}
+	g_gpsd_port = port;
+
+	const char *step;
+	if (gpsd_connect(&step) < 0) {
+		fprintf(stderr, "gpsd_init: Error: %s %s:%u: %s\n", step, g_gpsd_host, port, strerror(errno));
+		return -1;
+	}
+
+	return 0;
+}
+
+int gpsd_uninit() {
+
+	if (g_gpsd_fd < 0) {
+		return -1;
+	}
+
+	close(g_gpsd_fd);
+	g_gpsd_fd = -1;
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Next report from gpsd, reconnects if the connection was lost
+ *
+ * Called by the acquisition thread: failures go to tstamp_log (TL_GPSD_LOST),
+ * rate limited, not to the console.
+ *
+ * @retval  1 Report in msg
+ * @retval  0 Woken up by wake_fd
+ * @retval -1 Timeout or connection lost
+ *--------------------------------------------------------------------------------------*/
+int gpsd_read(int wake_fd, gpsd_msg_t *msg) {
+
+	const char *step;
+	if (g_gpsd_fd < 0 && gpsd_connect(&step) < 0) {
+		tstamp_log(TL_GPSD_LOST, errno);
+		return -1;
+	}
+
+	for (;;) {
+		while (g_gpsd_pos < g_gpsd_len) {
+			if (gpsd_parser_feed(&g_gpsd_parser, g_gpsd_buff[g_gpsd_pos++], msg)) {
+				return 1;
+			}
+		}
+
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(g_gpsd_fd, &read_fds);
+		int max_fd = g_gpsd_fd;
+		if (wake_fd >= 0) {
+			FD_SET(wake_fd, &read_fds);
+			if (wake_fd > max_fd) {
+				max_fd = wake_fd;
+			}
+		}
+
+		struct timeval timeout;
+		timeout.tv_sec = 5;
+		timeout.tv_usec = 0;
+
+		int ret = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
+		if (ret < 0 && errno == EINTR) {
+			continue;
+		}
+		if (ret <= 0) {
+			return -1;
+		}
+		if (wake_fd >= 0 && FD_ISSET(wake_fd, &read_fds)) {
+			return 0;
+		}
+
+		int n = ::read(g_gpsd_fd, g_gpsd_buff, sizeof(g_gpsd_buff));
+		if (n <= 0) {
+			tstamp_log(TL_GPSD_LOST, n < 0 ? errno : 0);
+			gpsd_uninit();
+			return -1;
+		}
+		g_gpsd_pos = 0;
+		g_gpsd_len = n;
+	}
+}
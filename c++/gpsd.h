@@ -0,0 +1,60 @@
+#ifndef __GPSD_H__
+#define __GPSD_H__
+
+#include <cstdint>
+
+#include "nmea.h"
+
+// gpsd JSON socket, used when gpsd owns the receiver and the UART is busy
+#define GPSD_HOST 	"127.0.0.1"
+#define GPSD_PORT 	2947
+
+#define GPSD_FIELD_LEN 	40 	// Longest string value kept by the parser
+
+// Report classes handled
+enum GpsdClass {
+	GPSD_OTHER = 0,
+	GPSD_TPV, 	// Time-position-velocity: time label of the fix
+	GPSD_SKY, 	// Satellites: satellites in use and HDOP
+};
+
+// Decoded report
+typedef struct {
+	int cls; 				// GpsdClass
+	int mode; 				// TPV fix mode: 0/1 no fix, 2 2D, 3 3D
+	bool has_time; 			// TPV carried a parsable "time"
+	nmea_gga_t label; 		// TPV time of day (UTC), talker 'D'
+	uint8_t sats; 			// SKY: satellites in use ("uSat"), NMEA_SATS_UNKNOWN if missing
+	uint16_t hdop_x10; 		// SKY: HDOP * 10, NMEA_HDOP_UNKNOWN if missing
+} gpsd_msg_t;
+
+/* Incremental JSON parser for the gpsd reports, one byte at a time and
+ * without allocation. Only the top level members are decoded, nested
+ * objects and arrays (SKY satellites, DEVICES list) are skipped.
+ */
+typedef struct {
+	int depth; 					// Object/array nesting
+	bool in_string;
+	bool escape;
+	bool in_value; 				// After ':' at depth 1
+	bool in_key;
+	bool in_scalar;
+	int key_len;
+	int val_len;
+	char key[16];
+	char val[GPSD_FIELD_LEN];
+	gpsd_msg_t msg;
+} gpsd_parser_t;
+
+extern int g_gpsd_fd;
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+void gpsd_parser_reset(gpsd_parser_t *p);
+int gpsd_parser_feed(gpsd_parser_t *p, uint8_t c, gpsd_msg_t *msg);
+
+int gpsd_init(const char *host = GPSD_HOST, uint16_t port = GPSD_PORT);
+int gpsd_uninit();
+// Wait up to 5 s for a report. If wake_fd becomes readable, returns 0.
+int gpsd_read(int wake_fd, gpsd_msg_t *msg);
+
+#endif /* __GPSD_H__ */
@@ -0,0 +1,233 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <unistd.h>
+#include <pthread.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tstamp.h"
+#include "gnss_sim.h"
+#include "bench.h"
+
+// Scripted stand-in for gpsd, to run the gpsd label source without a receiver.
+//
+//	gpsd_fake [-p port] [-d delay_ms] [-n seconds] [-c] [-o file]
+//
+// The PPS comes from the simulated FPGA (gnss_sim.h). Each second, delay_ms
+// after the edge, every client gets a TPV report labelling that edge, a SKY
+// report to exercise the nested members and a PPS report, which the client
+// skips: the edges come from the FPGA or kernel PPS, not from gpsd.
+// With -c a TimeStamp client runs in the same process for the given number
+// of seconds and the labelled epochs are checked against the simulated
+// edges; the summary is printed as JSON. Without -c it serves until killed.
+
+#define GPSD_FAKE_CLIENTS 	8
+
+static std::atomic<bool> g_stop(false);
+
+typedef struct {
+	int listen_fd;
+	uint32_t delay_ms;
+	const GnssSim *sim;
+	uint32_t reports;
+} fake_ctx_t;
+
+static void send_all(int *clients, const char *buf, int len) {
+	for (int i = 0; i < GPSD_FAKE_CLIENTS; i++) {
+		if (clients[i] >= 0 && send(clients[i], buf, len, MSG_NOSIGNAL) != len) {
+			close(clients[i]);
+			clients[i] = -1;
+		}
+	}
+}
+
+static void *server_fcn(void *ptr) {
+	fake_ctx_t *ctx = static_cast<fake_ctx_t*>(ptr);
+	int clients[GPSD_FAKE_CLIENTS];
+	for (int i = 0; i < GPSD_FAKE_CLIENTS; i++) {
+		clients[i] = -1;
+	}
+
+	int64_t last_sec = 0;
+	while (!g_stop.load()) {
+		struct pollfd pfd = { ctx->listen_fd, POLLIN, 0 };
+		if (poll(&pfd, 1, 10) > 0) {
+			int fd = accept(ctx->listen_fd, NULL, NULL);
+			for (int i = 0; i < GPSD_FAKE_CLIENTS && fd >= 0; i++) {
+				if (clients[i] < 0) {
+					clients[i] = fd;
+					fd = -1;
+					const char *hello = "{\"class\":\"VERSION\",\"release\":\"3.25\",\"proto_major\":3,\"proto_minor\":15}\r\n";
+					send_all(clients, hello, strlen(hello));
+				}
+			}
+			if (fd >= 0) {
+				close(fd);
+			}
+		}
+		// The ?WATCH request and anything else from the clients is ignored
+		for (int i = 0; i < GPSD_FAKE_CLIENTS; i++) {
+			char drain[256];
+			if (clients[i] >= 0 && recv(clients[i], drain, sizeof(drain), MSG_DONTWAIT) == 0) {
+				close(clients[i]);
+				clients[i] = -1;
+			}
+		}
+
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		if (now.tv_sec == last_sec || now.tv_nsec < (long)ctx->delay_ms * 1000000L) {
+			continue;
+		}
+		last_sec = now.tv_sec;
+		struct timespec edge;
+		if (ctx->sim->findEdge(now.tv_sec, &edge) < 0) {
+			continue;
+		}
+
+		time_t t = (time_t)now.tv_sec;
+		struct tm utc;
+		gmtime_r(&t, &utc);
+		char buf[512];
+		int len = snprintf(buf, sizeof(buf),
+			"{\"class\":\"TPV\",\"device\":\"/dev/ttyPS1\",\"mode\":3,\"time\":\"%04d-%02d-%02dT%02d:%02d:%02d.000Z\","
+			"\"ept\":0.005,\"lat\":45.0,\"lon\":9.0,\"altHAE\":120.0}\r\n"
+			"{\"class\":\"SKY\",\"device\":\"/dev/ttyPS1\",\"satellites\":[{\"PRN\":5,\"used\":true},{\"PRN\":12,\"used\":false}],\"hdop\":0.9,\"uSat\":8}\r\n"
+			"{\"class\":\"PPS\",\"device\":\"/dev/ttyPS1\",\"real_sec\":%lld,\"real_nsec\":0,\"clock_sec\":%lld,\"clock_nsec\":%ld,\"precision\":-20}\r\n",
+			utc.tm_year + 1900, utc.tm_mon + 1, utc.tm_mday, utc.tm_hour, utc.tm_min, utc.tm_sec,
+			(long long)now.tv_sec, (long long)edge.tv_sec, edge.tv_nsec);
+		send_all(clients, buf, len);
+		ctx->reports++;
+	}
+
+	for (int i = 0; i < GPSD_FAKE_CLIENTS; i++) {
+		if (clients[i] >= 0) {
+			close(clients[i]);
+		}
+	}
+	return NULL;
+}
+
+int main(int argc, char **argv) {
+
+	uint16_t port = GPSD_PORT;
+	uint32_t delay_ms = 200;
+	int seconds = 0;
+	bool client = false;
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:d:n:co:")) != -1) {
+		switch (opt) {
+		case 'p': port = (uint16_t)atoi(optarg); break;
+		case 'd': delay_ms = (uint32_t)atoi(optarg); break;
+		case 'n': seconds = atoi(optarg); break;
+		case 'c': client = true; break;
+		case 'o': out_path = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-d delay_ms] [-n seconds] [-c] [-o file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (client && seconds < 3) {
+		seconds = 10;
+	}
+
+	int listen_fd = socket(AF_INET, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	int one = 1;
+	setsockopt(listen_fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	if (bind(listen_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0 || listen(listen_fd, 4) < 0) {
+		fprintf(stderr, "gpsd_fake: Error: cannot listen on port %u\n", port);
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+
+	GnssSim sim;
+	if (sim.start() < 0) {
+		close(listen_fd);
+		return EXIT_FAILURE;
+	}
+
+	fake_ctx_t ctx = { listen_fd, delay_ms, &sim, 0 };
+	pthread_t thread;
+	pthread_create(&thread, NULL, server_fcn, &ctx);
+
+	if (!client) {
+		fprintf(stderr, "gpsd_fake: serving on 127.0.0.1:%u\n", port);
+		for (int i = 0; seconds == 0 || i < seconds; i++) {
+			sleep(1);
+		}
+	} else {
+		TimeStamp ts;
+		TimeStamp::Options opts;
+		opts.state_file = NULL;
+		opts.fpga_sim = true;
+		opts.gpsd_host = GPSD_HOST;
+		opts.gpsd_port = port;
+		if (ts.init(opts) < 0) {
+			g_stop.store(true);
+			pthread_join(thread, NULL);
+			sim.stop();
+			close(listen_fd);
+			return EXIT_FAILURE;
+		}
+
+		// Each labelled epoch must be the simulated edge of the labelled second
+		uint32_t epochs = 0, valid = 0, mislabelled = 0;
+		LatencyHistogram delay;
+		uint32_t seq = ts.notifier().lastSeq();
+		uint64_t end = bench_now_ns() + (uint64_t)seconds * 1000000000ULL;
+		while (bench_now_ns() < end) {
+			TimeEvent ev;
+			if (ts.waitEvent(TEV_EPOCH, seq, &ev, 1500) < 0) {
+				continue;
+			}
+			seq = ev.seq;
+			epochs++;
+			struct timespec now;
+			clock_gettime(CLOCK_REALTIME, &now);
+			delay.record((uint64_t)((now.tv_sec - ev.edge.tv_sec) * 1000000000LL + now.tv_nsec - ev.edge.tv_nsec));
+			struct timespec utc = {0, 0};
+			if (ts.toUtc(&ev.edge, &utc) == TimeStamp::TS_VALID) {
+				valid++;
+			}
+			struct timespec edge;
+			// The FPGA poll sees the edge close to the time the simulator raised it
+			if (sim.findEdge(utc.tv_sec, &edge) < 0 ||
+				llabs((int64_t)(ev.edge.tv_sec - edge.tv_sec) * 1000000000LL + (ev.edge.tv_nsec - edge.tv_nsec)) > 10000000) {
+				mislabelled++;
+			}
+		}
+
+		BenchReport report("gpsd_fake");
+		report.add("edge_to_epoch", delay);
+		report.addValue("reports", (double)ctx.reports, "count");
+		report.addValue("epochs", (double)epochs, "count");
+		report.addValue("valid_epochs", (double)valid, "count");
+		report.addValue("mislabelled", (double)mislabelled, "count");
+		ts.destroy();
+
+		FILE *out = out_path ? fopen(out_path, "w") : stdout;
+		if (out != NULL) {
+			report.print(out);
+			if (out != stdout) {
+				fclose(out);
+			}
+		}
+	}
+
+	g_stop.store(true);
+	pthread_join(thread, NULL);
+	sim.stop();
+	close(listen_fd);
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,55 @@
+#include <stdio.h>
+#include <string.h>
+
+#include "hk_fpga_sim.h"
+
+/* @brief Register map used in place of the FPGA memory. */
+static hk_fpga_reg_mem_t s_hk_fpga_sim_mem;
+
+/*--------------------------------------------------------------------------------------*
+ * Point the FPGA registers to the simulated ones
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, the real FPGA memory is mapped
+ *--------------------------------------------------------------------------------------*/
+int hk_fpga_sim_init(void) {
+
+    if (g_hk_fpga_reg_mem != NULL && g_hk_fpga_reg_mem != &s_hk_fpga_sim_mem) {
+        fprintf(stderr, "hk_fpga_sim_init: FPGA memory already mapped\n");
+        return -1;
+    }
+
+    memset(&s_hk_fpga_sim_mem, 0, sizeof(s_hk_fpga_sim_mem));
+    g_hk_fpga_reg_mem = &s_hk_fpga_sim_mem;
+
+    return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Release the simulated registers
+ *
+ * @retval  0 Success
+ *--------------------------------------------------------------------------------------*/
+int hk_fpga_sim_uninit(void) {
+
+    if (g_hk_fpga_reg_mem == &s_hk_fpga_sim_mem) {
+        g_hk_fpga_reg_mem = NULL;
+    }
+
+    return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Drive the expansion connector P inputs
+ *
+ * @param mask  Input lines (hk_fpga_gpio_bit_t)
+ * @param high  New level of the lines
+ *--------------------------------------------------------------------------------------*/
+void hk_fpga_sim_set_input(uint32_t mask, int high) {
+
+    if (high) {
+        __atomic_fetch_or(&s_hk_fpga_sim_mem.in_p, mask, __ATOMIC_RELEASE);
+    } else {
+        __atomic_fetch_and(&s_hk_fpga_sim_mem.in_p, ~mask, __ATOMIC_RELEASE);
+    }
+}
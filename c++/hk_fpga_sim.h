@@ -0,0 +1,18 @@
+#ifndef __HK_FPGA_SIM_H__
+#define __HK_FPGA_SIM_H__
+
+#include <stdint.h>
+
+#include "hk_fpga.h"
+
+/* Simulated Housekeeping registers.
+ * g_hk_fpga_reg_mem points to a zeroed copy of the register map in memory,
+ * so the code polling the FPGA runs unchanged without /dev/mem.
+ */
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+int hk_fpga_sim_init(void);
+int hk_fpga_sim_uninit(void);
+void hk_fpga_sim_set_input(uint32_t mask, int high);
+
+#endif /* __HK_FPGA_SIM_H__ */
@@ -0,0 +1,244 @@
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "hw_counter.h"
+#include "pps_servo.h"
+
+/* @brief Counter read by hw_counter_read(). */
+hw_counter_src_t g_hw_counter_src = HW_COUNTER_NONE;
+
+/* @brief Global timer registers, mapped on the Zynq only. */
+volatile uint32_t *g_hw_counter_gt = NULL;
+
+static int g_hw_counter_mem_fd = -1;
+static void *g_hw_counter_page = NULL;
+static long g_hw_counter_page_size = 0;
+
+static uint64_t mono_raw_ns(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+#if defined(__arm__)
+static int hw_counter_map_gt(void) {
+
+	g_hw_counter_page_size = sysconf(_SC_PAGESIZE);
+	long page_addr = HW_COUNTER_GT_BASE_ADDR & (~(g_hw_counter_page_size - 1));
+	long page_off = HW_COUNTER_GT_BASE_ADDR - page_addr;
+
+	g_hw_counter_mem_fd = open("/dev/mem", O_RDONLY | O_SYNC);
+	if (g_hw_counter_mem_fd < 0) {
+		fprintf(stderr, "hw_counter_init: Error: open(/dev/mem) failed: %s\n", strerror(errno));
+		return -1;
+	}
+	g_hw_counter_page = mmap(NULL, g_hw_counter_page_size, PROT_READ, MAP_SHARED, g_hw_counter_mem_fd, page_addr);
+	if (g_hw_counter_page == MAP_FAILED) {
+		fprintf(stderr, "hw_counter_init: Error: mmap() failed: %s\n", strerror(errno));
+		g_hw_counter_page = NULL;
+		close(g_hw_counter_mem_fd);
+		g_hw_counter_mem_fd = -1;
+		return -1;
+	}
+	g_hw_counter_gt = (volatile uint32_t *)((uint8_t *)g_hw_counter_page + page_off);
+	return 0;
+}
+#endif
+
+/*--------------------------------------------------------------------------------------*
+ * Select the architectural counter: TSC on x86, CNTVCT_EL0 on ARMv8, the global
+ * timer on the Zynq Cortex-A9 (which has no generic timer). CLOCK_MONOTONIC_RAW
+ * is used if none of them is available.
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int hw_counter_init(void) {
+
+	hw_counter_uninit();
+
+#if defined(__x86_64__) || defined(__i386__)
+	g_hw_counter_src = HW_COUNTER_TSC;
+#elif defined(__aarch64__)
+	g_hw_counter_src = HW_COUNTER_CNTVCT;
+#elif defined(__arm__)
+	if (hw_counter_map_gt() == 0) {
+		g_hw_counter_src = HW_COUNTER_ZYNQ_GT;
+	} else {
+		g_hw_counter_src = HW_COUNTER_MONO_RAW;
+	}
+#else
+	g_hw_counter_src = HW_COUNTER_MONO_RAW;
+#endif
+
+	return 0;
+}
+
+int hw_counter_uninit(void) {
+
+	if (g_hw_counter_page != NULL) {
+		munmap(g_hw_counter_page, g_hw_counter_page_size);
+		g_hw_counter_page = NULL;
+		g_hw_counter_gt = NULL;
+	}
+	if (g_hw_counter_mem_fd >= 0) {
+		close(g_hw_counter_mem_fd);
+		g_hw_counter_mem_fd = -1;
+	}
+	g_hw_counter_src = HW_COUNTER_NONE;
+
+	return 0;
+}
+
+const char *hw_counter_name(void) {
+	switch (g_hw_counter_src) {
+	case HW_COUNTER_TSC: return "tsc";
+	case HW_COUNTER_CNTVCT: return "cntvct";
+	case HW_COUNTER_ZYNQ_GT: return "zynq_gt";
+	case HW_COUNTER_MONO_RAW: return "monotonic_raw";
+	default: return "none";
+	}
+}
+
+// Nominal frequency, 0 if the counter does not advertise it (TSC)
+double hw_counter_nominal_hz(void) {
+	switch (g_hw_counter_src) {
+#if defined(__aarch64__)
+	case HW_COUNTER_CNTVCT: {
+		uint64_t frq;
+		__asm__ __volatile__("mrs %0, cntfrq_el0" : "=r"(frq));
+		return (double)frq;
+	}
+#endif
+	case HW_COUNTER_ZYNQ_GT: return HW_COUNTER_GT_HZ;
+	case HW_COUNTER_MONO_RAW: return 1e9;
+	default: return 0;
+	}
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Check the counter against CLOCK_MONOTONIC_RAW: it must not go backwards and its
+ * frequency must match the nominal one, if known
+ *
+ * @retval  0 Success, measured frequency in hz
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int hw_counter_selftest(double *hz) {
+
+	if (g_hw_counter_src == HW_COUNTER_NONE) {
+		fprintf(stderr, "hw_counter_selftest: Error: counter not initialized\n");
+		return -1;
+	}
+
+	uint64_t prev = hw_counter_read();
+	for (int i = 0; i < 100000; i++) {
+		uint64_t c = hw_counter_read();
+		if (c < prev) {
+			fprintf(stderr, "hw_counter_selftest: Error: %s went backwards\n", hw_counter_name());
+			return -1;
+		}
+		prev = c;
+	}
+
+	uint64_t t0 = mono_raw_ns();
+	uint64_t c0 = hw_counter_read();
+	usleep(HW_COUNTER_TEST_MS * 1000);
+	uint64_t t1 = mono_raw_ns();
+	uint64_t c1 = hw_counter_read();
+
+	*hz = (double)(c1 - c0) * 1e9 / (double)(t1 - t0);
+
+	double nominal = hw_counter_nominal_hz();
+	if (nominal > 0 && fabs(*hz / nominal - 1.0) * 1e6 > HW_COUNTER_TEST_TOL_PPM) {
+		fprintf(stderr, "hw_counter_selftest: Error: %s runs at %.0f Hz, nominal %.0f Hz\n", hw_counter_name(), *hz, nominal);
+		return -1;
+	}
+	if (*hz < 1e6) {
+		fprintf(stderr, "hw_counter_selftest: Error: %s too slow (%.0f Hz)\n", hw_counter_name(), *hz);
+		return -1;
+	}
+
+	return 0;
+}
+
+HwTimebase::HwTimebase() {
+	reset(0);
+}
+
+void HwTimebase::reset(double hz) {
+	memset(&m_work, 0, sizeof(m_work));
+	m_work.hz = hz;
+	m_work.ns_per_count = hz > 0 ? 1e9 / hz : 0;
+	m_have_edge = false;
+	m_last_edge = 0;
+	m_model.store(m_work);
+}
+
+void HwTimebase::edge(uint64_t count) {
+
+	if (m_have_edge && m_work.hz > 0) {
+		double d = (double)(count - m_last_edge);
+		double n = floor(d / m_work.hz + 0.5); // PPS seconds elapsed
+		if (n >= 1 && n <= PPS_SERVO_MAX_GAP) {
+			double rate = d / n;
+			// A wrong edge (or a missed one) is not a frequency change
+			if (fabs(rate / m_work.hz - 1.0) < PPS_SERVO_MAX_STEP_PPB * 1e-9) {
+				m_work.hz += PPS_SERVO_GAIN * (rate - m_work.hz);
+				m_work.ns_per_count = 1e9 / m_work.hz;
+				m_model.store(m_work);
+			}
+		}
+	}
+	m_last_edge = count;
+	m_have_edge = true;
+}
+
+void HwTimebase::pair(uint64_t count, const struct timespec *realtime) {
+	m_work.count = count;
+	m_work.realtime = *realtime;
+	m_work.valid = m_work.hz > 0;
+	m_model.store(m_work);
+}
+
+bool HwTimebase::calibrated() const {
+	Model model;
+	m_model.load(&model);
+	return model.valid;
+}
+
+double HwTimebase::hz() const {
+	Model model;
+	m_model.load(&model);
+	return model.hz;
+}
+
+int HwTimebase::toRealtime(uint64_t count, struct timespec *ts) const {
+
+	Model model;
+	m_model.load(&model);
+	if (!model.valid) {
+		return -1;
+	}
+
+	int64_t ns = model.realtime.tv_nsec + (int64_t)llround((double)(int64_t)(count - model.count) * model.ns_per_count);
+	int64_t sec = ns / 1000000000LL;
+	ns -= sec * 1000000000LL;
+	if (ns < 0) {
+		ns += 1000000000LL;
+		sec--;
+	}
+	ts->tv_sec = model.realtime.tv_sec + sec;
+	ts->tv_nsec = ns;
+	return 0;
+}
+
+int64_t HwTimebase::toNs(int64_t counts) const {
+	Model model;
+	m_model.load(&model);
+	return (int64_t)llround((double)counts * model.ns_per_count);
+}
@@ -0,0 +1,116 @@
+#ifndef __HW_COUNTER_H__
+#define __HW_COUNTER_H__
+
+#include <stdint.h>
+#include <time.h>
+
+#include "seqlock.h"
+
+// Zynq-7000 global timer (Cortex-A9 MPCore private peripherals). 64 bits,
+// clocked at CPU_3x2x (half the CPU clock, 333 MHz on the Red Pitaya).
+#define HW_COUNTER_GT_BASE_ADDR 	0xF8F00200UL
+#define HW_COUNTER_GT_HZ 			333333333.0
+
+// Self-test: measurement time and tolerated error of the nominal frequency
+#define HW_COUNTER_TEST_MS 			100
+#define HW_COUNTER_TEST_TOL_PPM 	2000.0
+
+// Counter read by hw_counter_read()
+typedef enum {
+	HW_COUNTER_NONE = 0,
+	HW_COUNTER_TSC, 		// x86 time stamp counter
+	HW_COUNTER_CNTVCT, 		// ARMv8 generic timer, virtual count
+	HW_COUNTER_ZYNQ_GT, 	// Cortex-A9 global timer, mapped through /dev/mem
+	HW_COUNTER_MONO_RAW, 	// CLOCK_MONOTONIC_RAW in ns, when nothing else is available
+} hw_counter_src_t;
+
+extern hw_counter_src_t g_hw_counter_src;
+extern volatile uint32_t *g_hw_counter_gt;
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+int hw_counter_init(void);
+int hw_counter_uninit(void);
+const char *hw_counter_name(void);
+double hw_counter_nominal_hz(void);
+int hw_counter_selftest(double *hz);
+
+// Raw counter, no system call and no kernel seqlock on the counter sources
+static inline uint64_t hw_counter_read(void) {
+	switch (g_hw_counter_src) {
+#if defined(__x86_64__) || defined(__i386__)
+	case HW_COUNTER_TSC: {
+		uint32_t lo, hi;
+		__asm__ __volatile__("rdtsc" : "=a"(lo), "=d"(hi));
+		return ((uint64_t)hi << 32) | lo;
+	}
+#endif
+#if defined(__aarch64__)
+	case HW_COUNTER_CNTVCT: {
+		uint64_t v;
+		__asm__ __volatile__("isb; mrs %0, cntvct_el0" : "=r"(v) :: "memory");
+		return v;
+	}
+#endif
+	case HW_COUNTER_ZYNQ_GT: {
+		// Upper word read twice to catch the carry
+		uint32_t hi, lo;
+		do {
+			hi = g_hw_counter_gt[1];
+			lo = g_hw_counter_gt[0];
+		} while (hi != g_hw_counter_gt[1]);
+		return ((uint64_t)hi << 32) | lo;
+	}
+	default: {
+		struct timespec ts;
+		clock_gettime(CLOCK_MONOTONIC_RAW, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+	}
+}
+
+/* Counter to time model. The rate comes from the PPS edges stamped with the
+ * counter (counts per PPS second), the offset from a counter/CLOCK_REALTIME
+ * pair taken once per edge, so the OS clock is read once per second and not
+ * on every stamp. edge() and pair() are called by one writer (the PPS
+ * thread), the conversions by any thread.
+ */
+class HwTimebase {
+
+public:
+
+	HwTimebase();
+
+	void reset(double hz);
+
+	// PPS edge stamped with the counter
+	void edge(uint64_t count);
+
+	// Counter value read around a CLOCK_REALTIME reading
+	void pair(uint64_t count, const struct timespec *realtime);
+
+	bool calibrated() const;
+	double hz() const;
+
+	// CLOCK_REALTIME of a count. Returns 0 on success, -1 if not calibrated.
+	int toRealtime(uint64_t count, struct timespec *ts) const;
+
+	// Counts to ns at the PPS calibrated rate
+	int64_t toNs(int64_t counts) const;
+
+private:
+
+	typedef struct {
+		bool valid; 			// Anchor pair available
+		uint64_t count; 		// Anchor
+		struct timespec realtime;
+		double hz;
+		double ns_per_count;
+	} Model;
+
+	SeqLock<Model> m_model;
+	Model m_work; // Writer copy
+	bool m_have_edge;
+	uint64_t m_last_edge;
+};
+
+#endif /* __HW_COUNTER_H__ */
@@ -0,0 +1,141 @@
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+
+#include "tstamp.h"
+#include "hw_counter.h"
+#include "gnss_sim.h"
+#include "bench.h"
+
+// Cost per stamp of the CPU counter time base (hw_counter.h) against the OS
+// clock, and agreement of hwNow() with toUtc() once calibrated on the
+// simulated PPS. Results on standard output as JSON.
+//
+//	hwclock_bench [-e seconds] [-t seconds per case] [-o file]
+
+static double g_case_s = BENCH_MIN_S;
+
+static int64_t utc_delta_ns(const struct timespec *a, const struct timespec *b) {
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+static void bench_stamps(BenchReport *report, TimeStamp *ts) {
+
+	LatencyHistogram h_counter, h_realtime, h_raw, h_hwnow, h_toutc;
+	struct timespec now, utc;
+	uint64_t t0, ops;
+
+	t0 = bench_now_ns();
+	ops = bench_run([&]() {
+		bench_keep(hw_counter_read());
+	}, &h_counter, g_case_s);
+	report->add("hw_counter_read", h_counter, ops, bench_now_ns() - t0);
+
+	t0 = bench_now_ns();
+	ops = bench_run([&]() {
+		clock_gettime(CLOCK_REALTIME, &now);
+		bench_keep(now);
+	}, &h_realtime, g_case_s);
+	report->add("clock_gettime_realtime", h_realtime, ops, bench_now_ns() - t0);
+
+	t0 = bench_now_ns();
+	ops = bench_run([&]() {
+		clock_gettime(CLOCK_MONOTONIC_RAW, &now);
+		bench_keep(now);
+	}, &h_raw, g_case_s);
+	report->add("clock_gettime_monotonic_raw", h_raw, ops, bench_now_ns() - t0);
+
+	t0 = bench_now_ns();
+	ops = bench_run([&]() {
+		ts->hwNow(&utc);
+		bench_keep(utc);
+	}, &h_hwnow, g_case_s);
+	report->add("hwNow", h_hwnow, ops, bench_now_ns() - t0);
+
+	t0 = bench_now_ns();
+	ops = bench_run([&]() {
+		clock_gettime(CLOCK_REALTIME, &now);
+		ts->toUtc(&now, &utc);
+		bench_keep(utc);
+	}, &h_toutc, g_case_s);
+	report->add("clock_gettime+toUtc", h_toutc, ops, bench_now_ns() - t0);
+}
+
+int main(int argc, char **argv) {
+
+	int seconds = 10;
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "e:t:o:")) != -1) {
+		switch (opt) {
+		case 'e': seconds = atoi(optarg); break;
+		case 't': g_case_s = atof(optarg); break;
+		case 'o': out_path = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-e seconds] [-t seconds per case] [-o file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	BenchReport report("hwclock");
+
+	GnssSim sim;
+	if (sim.start() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	TimeStamp::Options opts;
+	opts.state_file = NULL;
+	opts.uart_device = sim.uartDevice();
+	opts.fpga_sim = true;
+	opts.hw_counter = true;
+
+	TimeStamp ts;
+	if (ts.init(opts) < 0) {
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+	double selftest_hz = ts.timebase().hz();
+	fprintf(stderr, "hwclock_bench: %s at %.0f Hz\n", hw_counter_name(), selftest_hz);
+
+	// Calibration on the PPS, then hwNow() against the OS clock path
+	LatencyHistogram h_diff;
+	struct timespec utc_os, utc_hw, now;
+	for (int i = 0; i < seconds * 10; i++) {
+		usleep(100000);
+		clock_gettime(CLOCK_REALTIME, &now);
+		int f_hw = ts.hwNow(&utc_hw);
+		int f_os = ts.toUtc(&now, &utc_os);
+		if (i >= 30 && f_hw == TimeStamp::TS_VALID && f_os == TimeStamp::TS_VALID) { // Skip the first 3 s
+			int64_t d = utc_delta_ns(&utc_hw, &utc_os);
+			h_diff.record(d > 0 ? d : -d);
+		}
+	}
+	if (h_diff.count() == 0) {
+		fprintf(stderr, "hwclock_bench: Error: no valid epoch from the simulator (flags 0x%02X)\n", ts.getFlags());
+		ts.destroy();
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+	report.add("hwNow_vs_toUtc", h_diff);
+	report.addValue("selftest_hz", selftest_hz, "Hz");
+	report.addValue("pps_calibrated_hz", ts.timebase().hz(), "Hz");
+	report.addValue("calibration_shift", (ts.timebase().hz() / selftest_hz - 1.0) * 1e6, "ppm");
+
+	bench_stamps(&report, &ts);
+
+	ts.destroy();
+	sim.stop();
+
+	FILE *out = out_path ? fopen(out_path, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "hwclock_bench: Error: cannot open %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+	report.print(out);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,59 @@
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "pps_journal.h"
+
+// Print the records of a PPS journal, also while TimeStamp is writing it.
+//
+//	journal_dump <journal>
+
+int main(int argc, char **argv) {
+
+	if (argc != 2) {
+		fprintf(stderr, "usage: %s <journal>\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	int fd = open(argv[1], O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: cannot open\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(pps_journal_hdr_t)) {
+		fprintf(stderr, "%s: not a PPS journal\n", argv[1]);
+		close(fd);
+		return EXIT_FAILURE;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return EXIT_FAILURE;
+	}
+
+	const pps_journal_hdr_t *hdr = (const pps_journal_hdr_t *)p;
+	if (__atomic_load_n(&hdr->magic, __ATOMIC_ACQUIRE) != PPS_JOURNAL_MAGIC || hdr->version != PPS_JOURNAL_VERSION
+		|| hdr->rec_size != sizeof(pps_journal_rec_t)
+		|| sizeof(*hdr) + (size_t)hdr->capacity * sizeof(pps_journal_rec_t) > (size_t)st.st_size) {
+		fprintf(stderr, "%s: not a PPS journal\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+
+	const pps_journal_rec_t *recs = (const pps_journal_rec_t *)(hdr + 1);
+	uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	for (uint64_t i = 0; i < head && i < hdr->capacity; i++) {
+		const pps_journal_rec_t *r = &recs[i];
+		if (__atomic_load_n(&r->seq, __ATOMIC_ACQUIRE) != (uint32_t)i + 1) {
+			continue;
+		}
+		uint32_t ms = r->label_ms;
+		printf("%u.%09u %02u:%02u:%02u.%03u delay %u ns flags 0x%02X\n", r->edge_sec, r->edge_nsec,
+			ms / 3600000, ms / 60000 % 60, ms / 1000 % 60, ms % 1000, r->delay_ns, r->flags);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,97 @@
+#include "latency_hist.h"
+
+LatencyHistogram::LatencyHistogram() {
+	reset();
+}
+
+void LatencyHistogram::reset() {
+	for (int i = 0; i < LHIST_BUCKETS; i++) {
+		m_buckets[i].store(0, std::memory_order_relaxed);
+	}
+	m_count.store(0, std::memory_order_relaxed);
+	m_sum.store(0, std::memory_order_relaxed);
+	m_min.store(UINT64_MAX, std::memory_order_relaxed);
+	m_max.store(0, std::memory_order_relaxed);
+}
+
+int LatencyHistogram::bucketIndex(uint64_t ns) {
+	if (ns < LHIST_SUB_COUNT) {
+		return (int)ns;
+	}
+	int msb = 63 - __builtin_clzll(ns);
+	if (msb > LHIST_MAX_EXP) {
+		return LHIST_BUCKETS - 1;
+	}
+	int shift = msb - LHIST_SUB_BITS;
+	int sub = (int)((ns >> shift) & (LHIST_SUB_COUNT - 1));
+	return (shift + 1) * LHIST_SUB_COUNT + sub;
+}
+
+uint64_t LatencyHistogram::bucketUpper(int idx) {
+	if (idx < LHIST_SUB_COUNT) {
+		return (uint64_t)idx;
+	}
+	int shift = idx / LHIST_SUB_COUNT - 1;
+	uint64_t sub = (uint64_t)(idx % LHIST_SUB_COUNT);
+	return (((uint64_t)LHIST_SUB_COUNT + sub + 1) << shift) - 1;
+}
+
+void LatencyHistogram::record(uint64_t ns) {
+	m_buckets[bucketIndex(ns)].fetch_add(1, std::memory_order_relaxed);
+	m_count.fetch_add(1, std::memory_order_relaxed);
+	m_sum.fetch_add(ns, std::memory_order_relaxed);
+
+	uint64_t cur = m_min.load(std::memory_order_relaxed);
+	while (ns < cur && !m_min.compare_exchange_weak(cur, ns, std::memory_order_relaxed)) {}
+	cur = m_max.load(std::memory_order_relaxed);
+	while (ns > cur && !m_max.compare_exchange_weak(cur, ns, std::memory_order_relaxed)) {}
+}
+
+uint64_t LatencyHistogram::min() const {
+	uint64_t v = m_min.load(std::memory_order_relaxed);
+	return v == UINT64_MAX ? 0 : v;
+}
+
+uint64_t LatencyHistogram::mean() const {
+	uint64_t n = count();
+	return n > 0 ? m_sum.load(std::memory_order_relaxed) / n : 0;
+}
+
+uint64_t LatencyHistogram::percentile(double q) const {
+	uint64_t v;
+	percentiles(&q, &v, 1);
+	return v;
+}
+
+void LatencyHistogram::percentiles(const double *q, uint64_t *out, int n) const {
+
+	// Snapshot the buckets, the total may be ahead of m_count while recording
+	uint64_t total = 0;
+	static thread_local uint64_t counts[LHIST_BUCKETS];
+	for (int i = 0; i < LHIST_BUCKETS; i++) {
+		counts[i] = m_buckets[i].load(std::memory_order_relaxed);
+		total += counts[i];
+	}
+
+	for (int k = 0; k < n; k++) {
+		out[k] = 0;
+		if (total == 0) {
+			continue;
+		}
+		double qk = q[k] < 0.0 ? 0.0 : (q[k] > 1.0 ? 1.0 : q[k]);
+		uint64_t rank = (uint64_t)(qk * (double)total + 0.5);
+		if (rank < 1) {
+			rank = 1;
+		}
+		uint64_t acc = 0;
+		for (int i = 0; i < LHIST_BUCKETS; i++) {
+			acc += counts[i];
+			if (acc >= rank) {
+				uint64_t upper = bucketUpper(i);
+				uint64_t mx = max();
+				out[k] = upper < mx ? upper : mx;
+				break;
+			}
+		}
+	}
+}
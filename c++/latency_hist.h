@@ -0,0 +1,51 @@
+#ifndef __LATENCY_HIST_H__
+#define __LATENCY_HIST_H__
+
+#include <cstdint>
+#include <atomic>
+
+// Log-linear buckets: values below 2^LHIST_SUB_BITS ns are exact, above each
+// power of two is split in 2^LHIST_SUB_BITS buckets (about 3% resolution).
+#define LHIST_SUB_BITS 	5
+#define LHIST_SUB_COUNT (1 << LHIST_SUB_BITS)
+#define LHIST_MAX_EXP 	40 	// Values are clamped to ~2^40 ns (18 minutes)
+#define LHIST_BUCKETS 	((LHIST_MAX_EXP - LHIST_SUB_BITS + 2) * LHIST_SUB_COUNT)
+
+/* HDR style latency histogram.
+ * record() is wait-free (relaxed atomic increments) and can be called from
+ * the acquisition threads, the queries can run concurrently from any thread.
+ */
+class LatencyHistogram {
+
+public:
+
+	LatencyHistogram();
+
+	void record(uint64_t ns);
+	void reset();
+
+	uint64_t count() const { return m_count.load(std::memory_order_relaxed); }
+	uint64_t min() const;
+	uint64_t max() const { return m_max.load(std::memory_order_relaxed); }
+	uint64_t mean() const;
+	uint64_t sum() const { return m_sum.load(std::memory_order_relaxed); }
+
+	// Value at quantile q (0.0-1.0), upper bound of the bucket. 0 if empty.
+	uint64_t percentile(double q) const;
+
+	// Several quantiles with a single pass over the buckets.
+	void percentiles(const double *q, uint64_t *out, int n) const;
+
+private:
+
+	static int bucketIndex(uint64_t ns);
+	static uint64_t bucketUpper(int idx);
+
+	std::atomic<uint64_t> m_buckets[LHIST_BUCKETS];
+	std::atomic<uint64_t> m_count;
+	std::atomic<uint64_t> m_sum;
+	std::atomic<uint64_t> m_min;
+	std::atomic<uint64_t> m_max;
+};
+
+#endif /* __LATENCY_HIST_H__ */
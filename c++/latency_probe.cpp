@@ -0,0 +1,96 @@
+#include <cstdio>
+#include <unistd.h>
+
+#include "latency_probe.h"
+
+void *latencyProbeThreadFcn(void *ptr);
+
+static int64_t delta_ns(const struct timespec *a, const struct timespec *b) {
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+LatencyProbe::LatencyProbe(TimeStamp &ts) : m_ts(ts), m_lookup(NULL), m_lookup_arg(NULL),
+	m_poll_us(LATENCY_PROBE_POLL_US), m_stop(false), m_started(false), m_epochs(0), m_unmatched(0) {
+}
+
+LatencyProbe::~LatencyProbe() {
+	stop();
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Start the consumer thread
+ *
+ * @param lookup   Time of the physical PPS edges
+ * @param arg      Passed to lookup
+ * @param poll_us  Period of the read() calls, resolution of the measure
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int LatencyProbe::start(PpsEdgeLookup lookup, void *arg, uint32_t poll_us) {
+
+	if (m_started) {
+		return 0;
+	}
+	if (lookup == NULL || poll_us == 0) {
+		fprintf(stderr, "LatencyProbe::start: Error: invalid arguments\n");
+		return -1;
+	}
+	m_lookup = lookup;
+	m_lookup_arg = arg;
+	m_poll_us = poll_us;
+
+	m_stop.store(false);
+	if (pthread_create(&m_thread, NULL, latencyProbeThreadFcn, this) != 0) {
+		fprintf(stderr, "LatencyProbe::start: Error: cannot start the consumer thread\n");
+		return -1;
+	}
+	m_started = true;
+
+	return 0;
+}
+
+void LatencyProbe::stop() {
+
+	if (m_started) {
+		m_stop.store(true);
+		pthread_join(m_thread, NULL);
+		m_started = false;
+	}
+}
+
+void *latencyProbeThreadFcn(void *ptr) {
+	LatencyProbe *probe = static_cast<LatencyProbe*>(ptr);
+
+	TimeStamp::CurrentTime curr = {};
+	struct timespec last, edge, ts, now;
+
+	// The epoch already present at start has an unknown age
+	probe->m_ts.read(&curr);
+	last = curr.ts;
+
+	while (!probe->m_stop.load(std::memory_order_relaxed)) {
+
+		uint32_t flags = probe->m_ts.read(&curr);
+		clock_gettime(CLOCK_REALTIME, &now);
+		ts = curr.ts;
+
+		if (flags == TimeStamp::TS_VALID && (ts.tv_sec != last.tv_sec || ts.tv_nsec != last.tv_nsec)) {
+			last = ts;
+			probe->m_epochs.fetch_add(1, std::memory_order_relaxed);
+			// The bracketed edge can fall just before the second boundary
+			int64_t sec = ts.tv_sec + (ts.tv_nsec >= 500000000 ? 1 : 0);
+			if (probe->m_lookup(probe->m_lookup_arg, sec, &edge) == 0) {
+				int64_t dcap = delta_ns(&ts, &edge);
+				probe->m_e2e.record(delta_ns(&now, &edge));
+				probe->m_capture.record(dcap > 0 ? dcap : -dcap);
+			} else {
+				probe->m_unmatched.fetch_add(1, std::memory_order_relaxed);
+			}
+		}
+
+		usleep(probe->m_poll_us);
+	}
+
+	return NULL;
+}
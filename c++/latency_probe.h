@@ -0,0 +1,61 @@
+#ifndef __LATENCY_PROBE_H__
+#define __LATENCY_PROBE_H__
+
+#include <cstdint>
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+
+#include "tstamp.h"
+#include "latency_hist.h"
+
+#define LATENCY_PROBE_POLL_US 	100 	// read() period of the consumer thread
+
+// Time of the physical edge of second sec (CLOCK_REALTIME), -1 if unknown
+typedef int (*PpsEdgeLookup)(void *arg, int64_t sec, struct timespec *edge);
+
+/* End to end latency of the time stamp pipeline as seen by a consumer.
+ * A thread calls read() every poll_us like an application would and, when a
+ * new epoch shows up with the flags valid, records the time since the
+ * physical PPS edge reported by the lookup (GnssSim::findEdge for the
+ * simulated or loopback PPS). The histograms can be read at any time.
+ */
+class LatencyProbe {
+
+public:
+
+	explicit LatencyProbe(TimeStamp &ts);
+	~LatencyProbe();
+
+	int start(PpsEdgeLookup lookup, void *arg, uint32_t poll_us = LATENCY_PROBE_POLL_US);
+	void stop();
+
+	// Physical edge to the new second returned by read()
+	const LatencyHistogram &endToEnd() const { return m_e2e; }
+	// Physical edge to the OS time captured by the PPS source
+	const LatencyHistogram &capture() const { return m_capture; }
+
+	uint32_t epochs() const { return m_epochs.load(std::memory_order_relaxed); }
+	// Epochs seen by read() without a matching physical edge
+	uint32_t unmatched() const { return m_unmatched.load(std::memory_order_relaxed); }
+
+	friend void *latencyProbeThreadFcn(void *ptr);
+
+private:
+
+	TimeStamp &m_ts;
+	PpsEdgeLookup m_lookup;
+	void *m_lookup_arg;
+	uint32_t m_poll_us;
+
+	std::atomic<bool> m_stop;
+	bool m_started;
+	pthread_t m_thread;
+
+	LatencyHistogram m_e2e;
+	LatencyHistogram m_capture;
+	std::atomic<uint32_t> m_epochs;
+	std::atomic<uint32_t> m_unmatched;
+};
+
+#endif /* __LATENCY_PROBE_H__ */
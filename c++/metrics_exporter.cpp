@@ -0,0 +1,309 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdarg>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/stat.h>
+#include <sys/un.h>
+#include <sys/eventfd.h>
+
+#include "metrics_exporter.h"
+
+#define METRICS_BUF_SIZE 		8192
+#define METRICS_REQ_TIMEOUT_MS 	100
+
+static const struct {
+	TimeStamp::TimeSts flag;
+	int bit;
+	const char *name;
+} metrics_flags[] = {
+	{ TimeStamp::TS_NOPPS, 7, "NOPPS" },
+	{ TimeStamp::TS_NOUART, 6, "NOUART" },
+	{ TimeStamp::TS_OVTIME, 5, "OVTIME" },
+	{ TimeStamp::TS_NOTIME, 4, "NOTIME" },
+};
+
+static const struct {
+	TimeStamp::LatencyId id;
+	const char *name;
+	const char *help;
+} metrics_latencies[] = {
+	{ TimeStamp::LAT_PPS_WAIT, "tstamp_pps_wait_ns", "Time the PPS source polled before the edge" },
+	{ TimeStamp::LAT_GGA_DELAY, "tstamp_gga_delay_ns", "Arrival of the GGA sentence after the PPS edge" },
+	{ TimeStamp::LAT_READ, "tstamp_read_ns", "Duration of TimeStamp::read()" },
+	{ TimeStamp::LAT_PPS_BRACKET, "tstamp_pps_bracket_ns", "Poll interval bracketing the PPS edge" },
+};
+
+// Append to a fixed buffer, silently truncating
+struct MetricsBuf {
+	char *buf;
+	size_t size;
+	size_t len;
+
+	void printf(const char *fmt, ...) __attribute__((format(printf, 2, 3))) {
+		if (len + 1 >= size) {
+			return;
+		}
+		va_list ap;
+		va_start(ap, fmt);
+		int n = vsnprintf(buf + len, size - len, fmt, ap);
+		va_end(ap);
+		if (n > 0) {
+			len += (size_t)n < size - len ? (size_t)n : size - len - 1;
+		}
+	}
+};
+
+static void format_summary(MetricsBuf *out, const char *name, const char *help, const LatencyHistogram &h) {
+	static const double q[] = { 0.5, 0.9, 0.99, 0.999 };
+	uint64_t v[4];
+	h.percentiles(q, v, 4);
+
+	out->printf("# HELP %s %s\n# TYPE %s summary\n", name, help, name);
+	for (int i = 0; i < 4; i++) {
+		out->printf("%s{quantile=\"%g\"} %llu\n", name, q[i], (unsigned long long)v[i]);
+	}
+	out->printf("%s_sum %llu\n%s_count %llu\n", name, (unsigned long long)h.sum(), name, (unsigned long long)h.count());
+}
+
+MetricsExporter::MetricsExporter(TimeStamp &tstamp) : m_tstamp(tstamp) {
+	m_started = false;
+	m_listen_fd = -1;
+	m_stop_fd = -1;
+	m_path[0] = '\0';
+}
+
+MetricsExporter::~MetricsExporter() {
+	stop();
+}
+
+size_t MetricsExporter::format(char *buf, size_t size) {
+
+	MetricsBuf out = { buf, size, 0 };
+	if (size > 0) {
+		buf[0] = '\0';
+	}
+
+	TimeStamp::StatusSnapshot snap;
+	m_tstamp.getStatusSnapshot(&snap);
+
+	out.printf("# HELP tstamp_status_flags Status flags word (0 = valid)\n# TYPE tstamp_status_flags gauge\n");
+	out.printf("tstamp_status_flags %u\n", snap.flags);
+
+	out.printf("# HELP tstamp_flag_raised Status flag currently raised\n# TYPE tstamp_flag_raised gauge\n");
+	for (size_t i = 0; i < sizeof(metrics_flags) / sizeof(metrics_flags[0]); i++) {
+		out.printf("tstamp_flag_raised{flag=\"%s\"} %d\n", metrics_flags[i].name, (snap.flags & metrics_flags[i].flag) ? 1 : 0);
+	}
+	out.printf("# HELP tstamp_flag_raises_total Status flag 0 -> 1 transitions\n# TYPE tstamp_flag_raises_total counter\n");
+	for (size_t i = 0; i < sizeof(metrics_flags) / sizeof(metrics_flags[0]); i++) {
+		out.printf("tstamp_flag_raises_total{flag=\"%s\"} %u\n", metrics_flags[i].name, snap.counters[metrics_flags[i].bit].raised);
+	}
+	out.printf("# HELP tstamp_flag_clears_total Status flag 1 -> 0 transitions\n# TYPE tstamp_flag_clears_total counter\n");
+	for (size_t i = 0; i < sizeof(metrics_flags) / sizeof(metrics_flags[0]); i++) {
+		out.printf("tstamp_flag_clears_total{flag=\"%s\"} %u\n", metrics_flags[i].name, snap.counters[metrics_flags[i].bit].cleared);
+	}
+	out.printf("# HELP tstamp_flag_raised_seconds_total Time spent with the flag raised\n# TYPE tstamp_flag_raised_seconds_total counter\n");
+	for (size_t i = 0; i < sizeof(metrics_flags) / sizeof(metrics_flags[0]); i++) {
+		out.printf("tstamp_flag_raised_seconds_total{flag=\"%s\"} %.6f\n", metrics_flags[i].name, snap.counters[metrics_flags[i].bit].raised_ns / 1e9);
+	}
+
+	TimeStamp::ClockState clk;
+	m_tstamp.getClockState(&clk);
+
+	out.printf("# HELP tstamp_servo_locked Servo has a frequency estimate\n# TYPE tstamp_servo_locked gauge\n");
+	out.printf("tstamp_servo_locked %d\n", clk.locked ? 1 : 0);
+	out.printf("# HELP tstamp_servo_samples PPS edges used by the servo\n# TYPE tstamp_servo_samples counter\n");
+	out.printf("tstamp_servo_samples %u\n", clk.samples);
+	out.printf("# HELP tstamp_servo_freq_ppb OS clock frequency error against the PPS\n# TYPE tstamp_servo_freq_ppb gauge\n");
+	out.printf("tstamp_servo_freq_ppb %.3f\n", clk.freq_ppb);
+	out.printf("# HELP tstamp_servo_offset_ns Error of the last PPS edge against the prediction\n# TYPE tstamp_servo_offset_ns gauge\n");
+	out.printf("tstamp_servo_offset_ns %.1f\n", clk.offset_ns);
+	out.printf("# HELP tstamp_pps_jitter_ns Mean absolute PPS edge error\n# TYPE tstamp_pps_jitter_ns gauge\n");
+	out.printf("tstamp_pps_jitter_ns %.1f\n", clk.jitter_ns);
+	out.printf("# HELP tstamp_pps_edge_uncertainty_ns Bound of the last PPS edge timestamp\n# TYPE tstamp_pps_edge_uncertainty_ns gauge\n");
+	out.printf("tstamp_pps_edge_uncertainty_ns %.0f\n", clk.edge_unc_ns);
+	out.printf("# HELP tstamp_pps_rejected_total PPS edges rejected as outliers\n# TYPE tstamp_pps_rejected_total counter\n");
+	out.printf("tstamp_pps_rejected_total %u\n", clk.rejected);
+	out.printf("# HELP tstamp_holdover Servo locked while the PPS is missing\n# TYPE tstamp_holdover gauge\n");
+	out.printf("tstamp_holdover %d\n", clk.holdover ? 1 : 0);
+	out.printf("# HELP tstamp_holdover_seconds Time since the last PPS edge while in holdover\n# TYPE tstamp_holdover_seconds gauge\n");
+	out.printf("tstamp_holdover_seconds %.3f\n", clk.holdover_s);
+
+	TimeStamp::TimeQuality quality;
+	m_tstamp.getQuality(&quality);
+	out.printf("# HELP tstamp_quality_class Time quality class (0 unusable, 1 degraded, 2 good, 3 excellent)\n# TYPE tstamp_quality_class gauge\n");
+	out.printf("tstamp_quality_class %u\n", quality.cls);
+	out.printf("# HELP tstamp_uncertainty_ns Estimated error of the time label\n# TYPE tstamp_uncertainty_ns gauge\n");
+	out.printf("tstamp_uncertainty_ns %u\n", quality.uncertainty_ns);
+	out.printf("# HELP tstamp_gnss_fix GGA fix quality of the label\n# TYPE tstamp_gnss_fix gauge\n");
+	out.printf("tstamp_gnss_fix %u\n", quality.fix);
+	if (quality.sats != NMEA_SATS_UNKNOWN) {
+		out.printf("# HELP tstamp_gnss_satellites Satellites in use\n# TYPE tstamp_gnss_satellites gauge\n");
+		out.printf("tstamp_gnss_satellites %u\n", quality.sats);
+	}
+	if (quality.hdop_x10 != NMEA_HDOP_UNKNOWN) {
+		out.printf("# HELP tstamp_gnss_hdop Horizontal dilution of precision\n# TYPE tstamp_gnss_hdop gauge\n");
+		out.printf("tstamp_gnss_hdop %.1f\n", quality.hdop_x10 / 10.0);
+	}
+
+	for (size_t i = 0; i < sizeof(metrics_latencies) / sizeof(metrics_latencies[0]); i++) {
+		format_summary(&out, metrics_latencies[i].name, metrics_latencies[i].help, m_tstamp.latency(metrics_latencies[i].id));
+	}
+	format_summary(&out, "tstamp_notify_wake_ns", "Notify to wake latency of waitEvent()", m_tstamp.notifier().wakeHistogram());
+
+	return out.len;
+}
+
+// Remove a socket left by an exporter that is gone. Anything else at the
+// path, or a socket another exporter is still listening on, is kept.
+static int remove_stale_socket(const struct sockaddr_un *addr) {
+
+	struct stat st;
+	if (lstat(addr->sun_path, &st) < 0) {
+		return errno == ENOENT ? 0 : -1;
+	}
+	if (!S_ISSOCK(st.st_mode)) {
+		fprintf(stderr, "MetricsExporter::start: Error: %s exists and is not a socket\n", addr->sun_path);
+		return -1;
+	}
+
+	int fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+	int res = connect(fd, (const struct sockaddr *)addr, sizeof(*addr));
+	int err = errno;
+	close(fd);
+	if (res == 0 || err != ECONNREFUSED) {
+		fprintf(stderr, "MetricsExporter::start: Error: %s is in use\n", addr->sun_path);
+		return -1;
+	}
+
+	return unlink(addr->sun_path);
+}
+
+int MetricsExporter::start(const char *path) {
+
+	if (m_started) {
+		return 0;
+	}
+
+	struct sockaddr_un addr;
+	memset(&addr, 0, sizeof(addr));
+	addr.sun_family = AF_UNIX;
+	if (strlen(path) >= sizeof(addr.sun_path)) {
+		fprintf(stderr, "MetricsExporter::start: Error: socket path too long\n");
+		return -1;
+	}
+	strcpy(addr.sun_path, path);
+	strcpy(m_path, path);
+
+	if (remove_stale_socket(&addr) < 0) {
+		return -1;
+	}
+
+	m_listen_fd = socket(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0);
+	if (m_listen_fd < 0) {
+		fprintf(stderr, "MetricsExporter::start: Error: socket() failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	if (bind(m_listen_fd, (struct sockaddr *)&addr, sizeof(addr)) < 0 || listen(m_listen_fd, 4) < 0) {
+		fprintf(stderr, "MetricsExporter::start: Error: bind(%s) failed: %s\n", path, strerror(errno));
+		close(m_listen_fd);
+		m_listen_fd = -1;
+		return -1;
+	}
+
+	m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_stop_fd < 0 || pthread_create(&m_thread, NULL, threadFcn, this) != 0) {
+		fprintf(stderr, "MetricsExporter::start: Error: exporter thread creation failed\n");
+		if (m_stop_fd >= 0) {
+			close(m_stop_fd);
+			m_stop_fd = -1;
+		}
+		close(m_listen_fd);
+		m_listen_fd = -1;
+		unlink(path);
+		return -1;
+	}
+
+	m_started = true;
+	return 0;
+}
+
+void MetricsExporter::stop() {
+
+	if (!m_started) {
+		return;
+	}
+
+	uint64_t one = 1;
+	if (write(m_stop_fd, &one, sizeof(one)) < 0) {
+		fprintf(stderr, "MetricsExporter::stop: Error: eventfd write failed\n");
+	}
+	pthread_join(m_thread, NULL);
+
+	close(m_stop_fd);
+	close(m_listen_fd);
+	unlink(m_path);
+	m_stop_fd = -1;
+	m_listen_fd = -1;
+	m_started = false;
+}
+
+void MetricsExporter::serve(int fd) {
+
+	// Consume the request, if any, the response is the same for every path
+	char req[512];
+	struct pollfd pfd = { fd, POLLIN, 0 };
+	if (poll(&pfd, 1, METRICS_REQ_TIMEOUT_MS) > 0) {
+		if (recv(fd, req, sizeof(req), MSG_DONTWAIT) < 0) {
+			return;
+		}
+	}
+
+	char body[METRICS_BUF_SIZE]; // Per call, exporters on other sockets serve concurrently
+	size_t len = format(body, sizeof(body));
+
+	char header[128];
+	int hlen = snprintf(header, sizeof(header),
+		"HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nContent-Length: %zu\r\n\r\n", len);
+
+	if (send(fd, header, hlen, MSG_NOSIGNAL) < 0 || send(fd, body, len, MSG_NOSIGNAL) < 0) {
+		// Client went away
+	}
+}
+
+void *MetricsExporter::threadFcn(void *ptr) {
+	MetricsExporter *exporter = static_cast<MetricsExporter *>(ptr);
+
+	for (;;) {
+		struct pollfd pfd[2];
+		pfd[0].fd = exporter->m_stop_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = exporter->m_listen_fd;
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (pfd[0].revents) {
+			break;
+		}
+		if (pfd[1].revents & POLLIN) {
+			int fd = accept4(exporter->m_listen_fd, NULL, NULL, SOCK_CLOEXEC);
+			if (fd >= 0) {
+				exporter->serve(fd);
+				close(fd);
+			}
+		}
+	}
+
+	return NULL;
+}
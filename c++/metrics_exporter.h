@@ -0,0 +1,52 @@
+#ifndef __METRICS_EXPORTER_H__
+#define __METRICS_EXPORTER_H__
+
+#include <cstddef>
+#include <pthread.h>
+
+#include "tstamp.h"
+
+// Default path of the metrics socket
+#ifndef METRICS_SOCKET_PATH
+	#define METRICS_SOCKET_PATH "/run/tstamp.metrics"
+#endif
+
+/* Serves the TimeStamp health in the Prometheus text exposition format
+ * over a Unix domain socket, e.g.
+ *
+ *	curl --unix-socket /run/tstamp.metrics http://localhost/metrics
+ *
+ * Each connection gets one HTTP/1.0 response. The metrics are read through
+ * the lock-free snapshots of TimeStamp, a scrape never blocks the
+ * acquisition threads.
+ */
+class MetricsExporter {
+
+public:
+
+	explicit MetricsExporter(TimeStamp &tstamp);
+	~MetricsExporter();
+
+	// Bind the socket and start the exporter thread. A stale socket at path
+	// is replaced, a live one or a file that is not a socket is an error.
+	int start(const char *path = METRICS_SOCKET_PATH);
+	void stop();
+
+	// Format the current metrics into buf, returns the length (truncated to size - 1).
+	size_t format(char *buf, size_t size);
+
+private:
+
+	static void *threadFcn(void *ptr);
+	void serve(int fd);
+
+	TimeStamp &m_tstamp;
+
+	bool m_started;
+	int m_listen_fd;
+	int m_stop_fd;
+	char m_path[108];
+	pthread_t m_thread;
+};
+
+#endif /* __METRICS_EXPORTER_H__ */
@@ -0,0 +1,100 @@
+#include "nmea.h"
+
+static inline bool is_digit(uint8_t c) {
+	return c >= '0' && c <= '9';
+}
+
+static inline uint32_t digit(uint8_t c) {
+	return (uint32_t)(c - '0');
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Parse the time and the fix fields of a $GPGGA, $GLGGA or $GNGGA sentence
+ *
+ * The sentence starts with $G?GGA,hhmmss at the beginning of buf, followed
+ * by up to 3 decimals of second (receivers send .sss, .ss or none).
+ * Fix quality, satellites in use and HDOP are set to unknown if missing,
+ * only the time is required.
+ *
+ * @retval  0 GGA sentence, gga is filled
+ * @retval -1 Other sentence or malformed time field
+ *--------------------------------------------------------------------------------------*/
+int nmea_gga_parse(const uint8_t *buf, int nbytes, nmea_gga_t *gga) {
+
+	if (nbytes < 13) {
+		return -1;
+	}
+
+	if (buf[0] != '$' || buf[1] != 'G' || (buf[2] != 'P' && buf[2] != 'L' && buf[2] != 'N')
+		|| buf[3] != 'G' || buf[4] != 'G' || buf[5] != 'A') {
+		return -1;
+	}
+
+	for (int i = 7; i <= 12; i++) {
+		if (!is_digit(buf[i])) {
+			return -1;
+		}
+	}
+
+	gga->talker = (char)buf[2];
+	gga->hh = digit(buf[7]) * 10 + digit(buf[8]);
+	gga->mm = digit(buf[9]) * 10 + digit(buf[10]);
+	gga->ss = digit(buf[11]) * 10 + digit(buf[12]);
+	gga->us = 0;
+
+	if (nbytes > 13 && buf[13] == '.') {
+		uint32_t scale = 100000;
+		for (int i = 14; i < nbytes && i < 17 && is_digit(buf[i]); i++) {
+			gga->us += digit(buf[i]) * scale;
+			scale /= 10;
+		}
+	}
+
+	gga->fix = NMEA_FIX_UNKNOWN;
+	gga->sats = NMEA_SATS_UNKNOWN;
+	gga->hdop_x10 = NMEA_HDOP_UNKNOWN;
+
+	// Fields 6 (quality), 7 (satellites) and 8 (HDOP), after the time field
+	int field = 1;
+	int i = 13;
+	while (i < nbytes && field < 6) {
+		if (buf[i] == '*' || buf[i] == '\r') {
+			return 0;
+		}
+		if (buf[i++] == ',') {
+			field++;
+		}
+	}
+	if (i < nbytes && is_digit(buf[i])) {
+		gga->fix = (uint8_t)digit(buf[i++]);
+	}
+	if (i >= nbytes || buf[i++] != ',') {
+		return 0;
+	}
+	if (i < nbytes && is_digit(buf[i])) {
+		uint32_t sats = 0;
+		while (i < nbytes && is_digit(buf[i]) && sats < 100) {
+			sats = sats * 10 + digit(buf[i++]);
+		}
+		gga->sats = (uint8_t)(sats < NMEA_SATS_UNKNOWN ? sats : NMEA_SATS_UNKNOWN - 1);
+	}
+	while (i < nbytes && buf[i] != ',' && buf[i] != '*') {
+		i++;
+	}
+	if (i >= nbytes || buf[i++] != ',') {
+		return 0;
+	}
+	if (i < nbytes && is_digit(buf[i])) {
+		uint32_t hdop = 0;
+		while (i < nbytes && is_digit(buf[i]) && hdop < 10000) {
+			hdop = hdop * 10 + digit(buf[i++]);
+		}
+		hdop *= 10;
+		if (i + 1 < nbytes && buf[i] == '.' && is_digit(buf[i + 1])) {
+			hdop += digit(buf[i + 1]);
+		}
+		gga->hdop_x10 = (uint16_t)(hdop < NMEA_HDOP_UNKNOWN ? hdop : NMEA_HDOP_UNKNOWN - 1);
+	}
+
+	return 0;
+}
@@ -0,0 +1,38 @@
+#ifndef __NMEA_H__
+#define __NMEA_H__
+
+#include <cstdint>
+
+// GGA fix quality (field 6)
+enum NmeaFix {
+	NMEA_FIX_NONE = 0, 			// No fix, the time may come from the receiver RTC
+	NMEA_FIX_GPS = 1,
+	NMEA_FIX_DGPS = 2,
+	NMEA_FIX_PPS = 3,
+	NMEA_FIX_RTK = 4,
+	NMEA_FIX_RTK_FLOAT = 5,
+	NMEA_FIX_ESTIMATED = 6, 	// Dead reckoning
+	NMEA_FIX_MANUAL = 7,
+	NMEA_FIX_SIMULATED = 8,
+	NMEA_FIX_UNKNOWN = 0xFF, 	// Field missing or not a number
+};
+
+#define NMEA_SATS_UNKNOWN 	0xFF
+#define NMEA_HDOP_UNKNOWN 	0xFFFF
+
+// Fields of a GGA sentence
+typedef struct {
+	char talker; 	// 'P' (GPS), 'L' (GLONASS) or 'N' (multi GNSS)
+	uint32_t hh; 	// UTC time of the fix
+	uint32_t mm;
+	uint32_t ss;
+	uint32_t us;
+	uint8_t fix; 		// NmeaFix
+	uint8_t sats; 		// Satellites in use, NMEA_SATS_UNKNOWN if missing
+	uint16_t hdop_x10; 	// HDOP * 10, NMEA_HDOP_UNKNOWN if missing
+} nmea_gga_t;
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+int nmea_gga_parse(const uint8_t *buf, int nbytes, nmea_gga_t *gga);
+
+#endif /* __NMEA_H__ */
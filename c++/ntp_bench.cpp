@@ -0,0 +1,192 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tstamp.h"
+#include "gnss_sim.h"
+#include "ntp_server.h"
+#include "bench.h"
+
+// Loopback benchmark of NtpServer against the simulated GNSS receiver,
+// results on standard output as JSON.
+//
+//	ntp_bench [-p port] [-t seconds per case] [-o file]
+//
+// The simulated edges are on the OS seconds, so the offset measured by the
+// client is the error of the served time (edge capture included).
+
+static double g_case_s = 2.0;
+static uint16_t g_port = 12123;
+
+typedef struct {
+	LatencyHistogram *rtt;
+	LatencyHistogram *offset;
+	uint64_t ops;
+	uint64_t errors;
+} client_arg_t;
+
+static int64_t ntp_to_ns(const uint8_t *p) {
+	uint32_t sec = ((uint32_t)p[0] << 24) | ((uint32_t)p[1] << 16) | ((uint32_t)p[2] << 8) | p[3];
+	uint32_t frac = ((uint32_t)p[4] << 24) | ((uint32_t)p[5] << 16) | ((uint32_t)p[6] << 8) | p[7];
+	return ((int64_t)sec - (int64_t)NTP_UNIX_EPOCH) * 1000000000LL + (int64_t)(((uint64_t)frac * 1000000000ULL) >> 32);
+}
+
+static void ns_to_ntp(int64_t ns, uint8_t *p) {
+	uint32_t sec = (uint32_t)(ns / 1000000000LL + NTP_UNIX_EPOCH);
+	uint32_t frac = (uint32_t)(((uint64_t)(ns % 1000000000LL) << 32) / 1000000000ULL);
+	for (int i = 0; i < 4; i++) {
+		p[i] = (uint8_t)(sec >> (24 - 8 * i));
+		p[4 + i] = (uint8_t)(frac >> (24 - 8 * i));
+	}
+}
+
+static int64_t realtime_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+static void *client_fcn(void *ptr) {
+	client_arg_t *arg = static_cast<client_arg_t*>(ptr);
+
+	int fd = socket(AF_INET, SOCK_DGRAM, 0);
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(g_port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	struct timeval tv = { 0, 100000 };
+	setsockopt(fd, SOL_SOCKET, SO_RCVTIMEO, &tv, sizeof(tv));
+	if (fd < 0 || connect(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		arg->errors++;
+		return NULL;
+	}
+
+	uint8_t req[NTP_PACKET_SIZE], resp[NTP_PACKET_SIZE];
+	uint64_t end = bench_now_ns() + (uint64_t)(g_case_s * 1e9);
+	while (bench_now_ns() < end) {
+		memset(req, 0, sizeof(req));
+		req[0] = (4 << 3) | 3; // v4, client
+		int64_t t1 = realtime_ns();
+		ns_to_ntp(t1, req + 40);
+		if (send(fd, req, sizeof(req), 0) != sizeof(req)
+			|| recv(fd, resp, sizeof(resp), 0) != sizeof(resp)) {
+			arg->errors++;
+			continue;
+		}
+		int64_t t4 = realtime_ns();
+		if (memcmp(resp + 24, req + 40, 8) != 0 || resp[1] != 1) {
+			arg->errors++;
+			continue;
+		}
+		int64_t t2 = ntp_to_ns(resp + 32);
+		int64_t t3 = ntp_to_ns(resp + 40);
+		int64_t offset = ((t2 - t1) + (t3 - t4)) / 2;
+		arg->rtt->record((uint64_t)((t4 - t1) - (t3 - t2)));
+		arg->offset->record((uint64_t)(offset < 0 ? -offset : offset));
+		arg->ops++;
+	}
+
+	close(fd);
+	return NULL;
+}
+
+static uint64_t bench_clients(BenchReport *report, int n) {
+
+	LatencyHistogram rtt, offset;
+	pthread_t threads[16];
+	client_arg_t args[16];
+	uint64_t t0 = bench_now_ns();
+	for (int i = 0; i < n; i++) {
+		args[i].rtt = &rtt;
+		args[i].offset = &offset;
+		args[i].ops = 0;
+		args[i].errors = 0;
+		pthread_create(&threads[i], NULL, client_fcn, &args[i]);
+	}
+	uint64_t ops = 0, errors = 0;
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+		ops += args[i].ops;
+		errors += args[i].errors;
+	}
+	uint64_t elapsed = bench_now_ns() - t0;
+	std::string suffix = "/clients:" + std::to_string(n);
+	report->add("ntp_round_trip" + suffix, rtt, ops, elapsed, n);
+	report->add("ntp_abs_offset" + suffix, offset, 0, 0, n);
+	return errors;
+}
+
+int main(int argc, char **argv) {
+
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "p:t:o:")) != -1) {
+		switch (opt) {
+		case 'p': g_port = (uint16_t)atoi(optarg); break;
+		case 't': g_case_s = atof(optarg); break;
+		case 'o': out_path = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-p port] [-t seconds per case] [-o file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	GnssSim sim;
+	if (sim.start() < 0) {
+		return EXIT_FAILURE;
+	}
+	TimeStamp::Options opts;
+	opts.state_file = NULL;
+	opts.uart_device = sim.uartDevice();
+	opts.fpga_sim = true;
+	TimeStamp ts;
+	if (ts.init(opts) < 0) {
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	// Serve only once the first epoch is labelled
+	TimeEvent ev;
+	if (ts.waitEvent(TEV_EPOCH, 0, &ev, 3000) != 0) {
+		fprintf(stderr, "ntp_bench: Error: no epoch from the simulator\n");
+		ts.destroy();
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	NtpServer server(ts);
+	if (server.start(g_port, "127.0.0.1") < 0) {
+		ts.destroy();
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	BenchReport report("ntp");
+	uint64_t errors = bench_clients(&report, 1);
+	errors += bench_clients(&report, 4);
+	report.add("ntp_service_time", server.serviceTime());
+	report.addValue("errors", (double)errors, "count");
+
+	server.stop();
+	ts.destroy();
+	sim.stop();
+
+	FILE *out = out_path ? fopen(out_path, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "ntp_bench: Error: cannot open %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+	report.print(out);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	return EXIT_SUCCESS;
+}
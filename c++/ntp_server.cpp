@@ -0,0 +1,262 @@
+#include <cstdio>
+#include <cstring>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "ntp_server.h"
+
+#define NTP_MODE_CLIENT 	3
+#define NTP_MODE_SERVER 	4
+#define NTP_LI_INSERT 		1
+#define NTP_LI_DELETE 		2
+#define NTP_LI_ALARM 		3
+#define NTP_STRATUM_UNSYNC 	16
+#define NTP_STRATUM_MAX 	15
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+	p[0] = (uint8_t)(v >> 24);
+	p[1] = (uint8_t)(v >> 16);
+	p[2] = (uint8_t)(v >> 8);
+	p[3] = (uint8_t)v;
+}
+
+// NTP 64 bit timestamp, the era wraps in 2036 as the protocol does
+static inline void put_timestamp(uint8_t *p, const struct timespec *utc) {
+	put_u32(p, (uint32_t)((uint64_t)utc->tv_sec + NTP_UNIX_EPOCH));
+	put_u32(p + 4, (uint32_t)(((uint64_t)utc->tv_nsec << 32) / 1000000000ULL));
+}
+
+// NTP short format (16.16 s)
+static inline uint32_t short_format(double ns) {
+	double v = ns / 1e9 * 65536.0;
+	return v >= 4294967295.0 ? 0xFFFFFFFFU : (uint32_t)v;
+}
+
+static inline int64_t delta_ns(const struct timespec *a, const struct timespec *b) {
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+NtpServer::NtpServer(TimeStamp &tstamp) : m_tstamp(tstamp), m_requests(0), m_dropped(0) {
+	m_started = false;
+	m_fd = -1;
+	m_stop_fd = -1;
+}
+
+NtpServer::~NtpServer() {
+	stop();
+}
+
+int NtpServer::respond(const uint8_t *req, int len, const struct timespec *rx, uint8_t *resp) {
+
+	if (len < NTP_PACKET_SIZE) {
+		return -1;
+	}
+	int version = (req[0] >> 3) & 0x07;
+	int mode = req[0] & 0x07;
+	if (mode != NTP_MODE_CLIENT || version < 1 || version > 4) {
+		return -1;
+	}
+
+	TimeStamp::ClockState clk;
+	m_tstamp.getClockState(&clk);
+
+	struct timespec rx_utc, ref_utc;
+	int flags = m_tstamp.toUtc(rx, &rx_utc);
+
+	int li = 0;
+	int stratum = 1;
+	double disp_ns = clk.jitter_ns + clk.edge_unc_ns;
+	if (flags < 0 || (flags != TimeStamp::TS_VALID && !clk.holdover)) {
+		li = NTP_LI_ALARM;
+		stratum = NTP_STRATUM_UNSYNC;
+	} else if (clk.holdover) {
+		stratum = 2 + (int)(clk.holdover_s / NTP_HOLDOVER_STEP_S);
+		if (stratum > NTP_STRATUM_MAX) {
+			stratum = NTP_STRATUM_MAX;
+		}
+		disp_ns += clk.holdover_s * NTP_HOLDOVER_DRIFT_PPB;
+	}
+	if (li == 0) {
+		// Leap second at the end of the day: LI 1 inserted, 2 deleted
+		int leap = time_scale_leap_pending(rx_utc.tv_sec);
+		li = leap > 0 ? NTP_LI_INSERT : leap < 0 ? NTP_LI_DELETE : 0;
+	}
+
+	memset(resp, 0, NTP_PACKET_SIZE);
+	resp[0] = (uint8_t)((li << 6) | (version << 3) | NTP_MODE_SERVER);
+	resp[1] = (uint8_t)stratum;
+	resp[2] = req[2]; // Poll interval of the client
+	resp[3] = (uint8_t)(int8_t)NTP_PRECISION;
+	put_u32(resp + 4, 0); // Root delay, the reference is local
+	put_u32(resp + 8, short_format(disp_ns));
+	memcpy(resp + 12, "GPS", 4);
+	if (flags >= 0 && m_tstamp.toUtc(&clk.last_edge, &ref_utc) >= 0) {
+		put_timestamp(resp + 16, &ref_utc);
+	}
+	memcpy(resp + 24, req + 40, 8); // Origin = client transmit
+	if (flags >= 0) {
+		put_timestamp(resp + 32, &rx_utc);
+	}
+
+	// Transmit timestamp as late as possible
+	struct timespec tx, tx_utc;
+	clock_gettime(CLOCK_REALTIME, &tx);
+	if (m_tstamp.toUtc(&tx, &tx_utc) >= 0) {
+		put_timestamp(resp + 40, &tx_utc);
+	}
+
+	return NTP_PACKET_SIZE;
+}
+
+int NtpServer::start(uint16_t port, const char *addr) {
+
+	if (m_started) {
+		return 0;
+	}
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (addr != NULL && inet_pton(AF_INET, addr, &sa.sin_addr) != 1) {
+		fprintf(stderr, "NtpServer::start: Error: invalid address %s\n", addr);
+		return -1;
+	}
+
+	m_fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (m_fd < 0) {
+		fprintf(stderr, "NtpServer::start: Error: socket() failed: %s\n", strerror(errno));
+		return -1;
+	}
+
+	int on = 1;
+	if (setsockopt(m_fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on)) < 0) {
+		fprintf(stderr, "NtpServer::start: Error: SO_TIMESTAMPNS not available, using user space receive time\n");
+	}
+
+	if (bind(m_fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		fprintf(stderr, "NtpServer::start: Error: bind(%u) failed: %s\n", port, strerror(errno));
+		close(m_fd);
+		m_fd = -1;
+		return -1;
+	}
+
+	m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_stop_fd < 0 || pthread_create(&m_thread, NULL, threadFcn, this) != 0) {
+		fprintf(stderr, "NtpServer::start: Error: server thread creation failed\n");
+		if (m_stop_fd >= 0) {
+			close(m_stop_fd);
+			m_stop_fd = -1;
+		}
+		close(m_fd);
+		m_fd = -1;
+		return -1;
+	}
+
+	m_started = true;
+	return 0;
+}
+
+void NtpServer::stop() {
+
+	if (!m_started) {
+		return;
+	}
+
+	uint64_t one = 1;
+	if (write(m_stop_fd, &one, sizeof(one)) < 0) {
+		fprintf(stderr, "NtpServer::stop: Error: eventfd write failed\n");
+	}
+	pthread_join(m_thread, NULL);
+
+	close(m_stop_fd);
+	close(m_fd);
+	m_stop_fd = -1;
+	m_fd = -1;
+	m_started = false;
+}
+
+// Answer all the pending requests
+void NtpServer::serve() {
+
+	uint8_t req[128], resp[NTP_PACKET_SIZE];
+	char ctrl[CMSG_SPACE(sizeof(struct timespec))];
+	struct sockaddr_in from;
+
+	for (;;) {
+		struct iovec iov = { req, sizeof(req) };
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &from;
+		msg.msg_namelen = sizeof(from);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+
+		int len = recvmsg(m_fd, &msg, 0);
+		if (len < 0) {
+			return;
+		}
+
+		struct timespec rx;
+		bool have_rx = false;
+		for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+				memcpy(&rx, CMSG_DATA(c), sizeof(rx));
+				have_rx = true;
+			}
+		}
+		if (!have_rx) {
+			clock_gettime(CLOCK_REALTIME, &rx);
+		}
+
+		if (respond(req, len, &rx, resp) < 0) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		if (sendto(m_fd, resp, NTP_PACKET_SIZE, 0, (struct sockaddr *)&from, msg.msg_namelen) < 0) {
+			m_dropped.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+
+		struct timespec tx;
+		clock_gettime(CLOCK_REALTIME, &tx);
+		int64_t d = delta_ns(&tx, &rx);
+		m_service.record(d > 0 ? d : 0);
+		m_requests.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+void *NtpServer::threadFcn(void *ptr) {
+	NtpServer *server = static_cast<NtpServer *>(ptr);
+
+	for (;;) {
+		struct pollfd pfd[2];
+		pfd[0].fd = server->m_stop_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = server->m_fd;
+		pfd[1].events = POLLIN;
+
+		if (poll(pfd, 2, -1) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (pfd[0].revents) {
+			break;
+		}
+		if (pfd[1].revents & POLLIN) {
+			server->serve();
+		}
+	}
+
+	return NULL;
+}
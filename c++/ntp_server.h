@@ -0,0 +1,64 @@
+#ifndef __NTP_SERVER_H__
+#define __NTP_SERVER_H__
+
+#include <cstdint>
+#include <atomic>
+#include <pthread.h>
+
+#include "tstamp.h"
+#include "time_scale.h"
+#include "latency_hist.h"
+
+#define NTP_PORT 				123
+#define NTP_PACKET_SIZE 		48
+#define NTP_UNIX_EPOCH 			2208988800UL 	// 1900-01-01 to 1970-01-01 in s
+#define NTP_PRECISION 			-20 			// ~1 us, log2 s
+#define NTP_HOLDOVER_STEP_S 	3600 			// Stratum + 1 every hour of holdover
+#define NTP_HOLDOVER_DRIFT_PPB 	1000.0 			// Dispersion growth in holdover
+
+/* NTPv4 server (RFC 5905, server mode only) answering from the PPS/GGA model.
+ * Receive timestamps come from the kernel (SO_TIMESTAMPNS) and all the
+ * timestamps are converted with TimeStamp::toUtc(), so the OS clock does not
+ * need to be synchronized. Stratum 1 when the status is valid, one more per
+ * NTP_HOLDOVER_STEP_S of holdover, unsynchronized (LI 3, stratum 16)
+ * otherwise.
+ */
+class NtpServer {
+
+public:
+
+	explicit NtpServer(TimeStamp &tstamp);
+	~NtpServer();
+
+	// Bind the UDP socket (addr NULL for any) and start the server thread.
+	int start(uint16_t port = NTP_PORT, const char *addr = NULL);
+	void stop();
+
+	uint64_t requests() const { return m_requests.load(std::memory_order_relaxed); }
+	uint64_t dropped() const { return m_dropped.load(std::memory_order_relaxed); }
+
+	// Receive to transmit time of the responses
+	const LatencyHistogram &serviceTime() const { return m_service; }
+
+	// Fill the response to req, rx is the kernel receive time (CLOCK_REALTIME).
+	// Returns -1 if req is not a valid client request.
+	int respond(const uint8_t *req, int len, const struct timespec *rx, uint8_t *resp);
+
+private:
+
+	static void *threadFcn(void *ptr);
+	void serve();
+
+	TimeStamp &m_tstamp;
+
+	bool m_started;
+	int m_fd;
+	int m_stop_fd;
+	pthread_t m_thread;
+
+	std::atomic<uint64_t> m_requests;
+	std::atomic<uint64_t> m_dropped;
+	LatencyHistogram m_service;
+};
+
+#endif /* __NTP_SERVER_H__ */
@@ -0,0 +1,106 @@
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <sys/ipc.h>
+#include <sys/shm.h>
+
+#include "ntp_shm.h"
+#include "time_scale.h"
+
+static ntp_shm_time_t *shm_attach(int unit) {
+
+	// Units 0 and 1 are private to root, the others are world writable
+	int perm = unit < 2 ? 0600 : 0666;
+	int id = shmget(NTP_SHM_KEY + unit, sizeof(ntp_shm_time_t), IPC_CREAT | perm);
+	if (id < 0) {
+		fprintf(stderr, "NtpShm::open: Error: shmget(unit %d) failed: %s\n", unit, strerror(errno));
+		return NULL;
+	}
+	void *p = shmat(id, NULL, 0);
+	if (p == (void *)-1) {
+		fprintf(stderr, "NtpShm::open: Error: shmat(unit %d) failed: %s\n", unit, strerror(errno));
+		return NULL;
+	}
+	return static_cast<ntp_shm_time_t *>(p);
+}
+
+static void shm_write(ntp_shm_time_t *seg, const struct timespec *clock, const struct timespec *rx, int leap, int precision) {
+
+	seg->valid = 0;
+	seg->count++;
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+
+	seg->mode = 1;
+	seg->clockTimeStampSec = clock->tv_sec;
+	seg->clockTimeStampUSec = (int)(clock->tv_nsec / 1000);
+	seg->clockTimeStampNSec = (unsigned)clock->tv_nsec;
+	seg->receiveTimeStampSec = rx->tv_sec;
+	seg->receiveTimeStampUSec = (int)(rx->tv_nsec / 1000);
+	seg->receiveTimeStampNSec = (unsigned)rx->tv_nsec;
+	seg->leap = leap;
+	seg->precision = precision;
+	seg->nsamples = 3;
+
+	__atomic_thread_fence(__ATOMIC_SEQ_CST);
+	seg->count++;
+	seg->valid = 1;
+}
+
+NtpShm::NtpShm() {
+	m_seg[0] = NULL;
+	m_seg[1] = NULL;
+}
+
+NtpShm::~NtpShm() {
+	close();
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Attach the segments of units unit and unit + 1, created if missing
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int NtpShm::open(int unit) {
+
+	if (isOpen()) {
+		return 0;
+	}
+	if (unit < 0) {
+		fprintf(stderr, "NtpShm::open: Error: invalid unit %d\n", unit);
+		return -1;
+	}
+
+	m_seg[0] = shm_attach(unit);
+	m_seg[1] = m_seg[0] != NULL ? shm_attach(unit + 1) : NULL;
+	if (m_seg[1] == NULL) {
+		close();
+		return -1;
+	}
+
+	return 0;
+}
+
+void NtpShm::close() {
+
+	// The segments are left in place for the daemon
+	for (int i = 0; i < 2; i++) {
+		if (m_seg[i] != NULL) {
+			m_seg[i]->valid = 0;
+			shmdt(m_seg[i]);
+			m_seg[i] = NULL;
+		}
+	}
+}
+
+void NtpShm::publish(const struct timespec *label, const struct timespec *edge, const struct timespec *gga_rx) {
+
+	if (!isOpen()) {
+		return;
+	}
+	// NTP leap indicator: 1 a second is inserted at the end of the day, 2 deleted
+	int pending = time_scale_leap_pending(label->tv_sec);
+	int leap = pending > 0 ? 1 : pending < 0 ? 2 : 0;
+	shm_write(m_seg[0], label, gga_rx, leap, NTP_SHM_PRECISION_GGA);
+	shm_write(m_seg[1], label, edge, leap, NTP_SHM_PRECISION_PPS);
+}
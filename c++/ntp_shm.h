@@ -0,0 +1,55 @@
+#ifndef __NTP_SHM_H__
+#define __NTP_SHM_H__
+
+#include <cstdint>
+#include <time.h>
+
+#define NTP_SHM_KEY 			0x4e545030 	// "NTP0", key of unit 0
+#define NTP_SHM_PRECISION_GGA 	-1 			// Time label, ~0.5 s
+#define NTP_SHM_PRECISION_PPS 	-20 		// PPS edge, ~1 us
+
+// Layout of the ntpd/chrony/gpsd SHM refclock segment
+typedef struct {
+	int mode; 						// 1: count checked around the read
+	volatile int count;
+	time_t clockTimeStampSec; 		// Reference (UTC) time
+	int clockTimeStampUSec;
+	time_t receiveTimeStampSec; 	// Local clock when it was taken
+	int receiveTimeStampUSec;
+	int leap;
+	int precision;
+	int nsamples;
+	volatile int valid;
+	unsigned clockTimeStampNSec;
+	unsigned receiveTimeStampNSec;
+	int dummy[8];
+} ntp_shm_time_t;
+
+/* Feeds the system time daemon through two SHM refclock segments:
+ * unit N gets the GGA time label of each epoch against its arrival time
+ * (coarse, to number the seconds), unit N + 1 gets the UTC second of the PPS
+ * edge against the OS time captured by the PPS source (precise), as gpsd does.
+ *
+ *	chrony: refclock SHM 0 refid GPS precision 1e-1 offset 0.3 noselect
+ *	        refclock SHM 1 refid PPS precision 1e-7 lock GPS
+ */
+class NtpShm {
+
+public:
+
+	NtpShm();
+	~NtpShm();
+
+	int open(int unit);
+	void close();
+	bool isOpen() const { return m_seg[0] != NULL; }
+
+	// Single writer. label is the UTC time of the edge (integer second).
+	void publish(const struct timespec *label, const struct timespec *edge, const struct timespec *gga_rx);
+
+private:
+
+	ntp_shm_time_t *m_seg[2];
+};
+
+#endif /* __NTP_SHM_H__ */
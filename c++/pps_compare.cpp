@@ -0,0 +1,190 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cmath>
+#include <vector>
+#include <atomic>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tstamp.h"
+#include "gnss_sim.h"
+#include "bench.h"
+
+// Side by side jitter of the FPGA polling path and of a kernel PPS source.
+//
+//	pps_compare -d /dev/pps0 [-c] [-s] [-n seconds] [-o file]
+//
+// -c captures the clear edge, -s polls the simulated FPGA (gnss_sim.h)
+// instead of the real one. Each series is fitted with a line (the OS clock
+// frequency error) and the residuals are the jitter; the edges of the two
+// series less than 0.5 s apart are paired and their difference reported.
+// Without the pps-gpio wiring, pps-ktimer gives a kernel source to test
+// with: its edges are not the FPGA ones, only the jitter is comparable.
+
+static std::atomic<bool> g_stop(false);
+
+static void *kernel_fcn(void *ptr) {
+	std::vector<struct timespec> *edges = static_cast<std::vector<struct timespec>*>(ptr);
+	uint32_t seq = 0;
+	struct timespec ts;
+	pps_dev_fetch(0, &ts, &seq);
+	while (!g_stop.load()) {
+		if (pps_dev_fetch(200, &ts, &seq) > 0) {
+			edges->push_back(ts);
+		}
+	}
+	return NULL;
+}
+
+static double ns_of(const struct timespec *ts, const struct timespec *t0) {
+	return (double)(ts->tv_sec - t0->tv_sec) * 1e9 + (double)(ts->tv_nsec - t0->tv_nsec);
+}
+
+// Residuals of the edges against the best line through them
+static void fit_residuals(const std::vector<struct timespec> &edges, LatencyHistogram *hist, double *rms) {
+	*rms = 0;
+	size_t n = edges.size();
+	if (n < 3) {
+		return;
+	}
+	std::vector<double> x(n), y(n);
+	double sx = 0, sy = 0, sxx = 0, sxy = 0;
+	for (size_t i = 0; i < n; i++) {
+		y[i] = ns_of(&edges[i], &edges[0]);
+		x[i] = floor(y[i] / 1e9 + 0.5); // Second number, gaps allowed
+		sx += x[i];
+		sy += y[i];
+		sxx += x[i] * x[i];
+		sxy += x[i] * y[i];
+	}
+	double slope = (n * sxy - sx * sy) / (n * sxx - sx * sx);
+	double icpt = (sy - slope * sx) / n;
+	double ss = 0;
+	for (size_t i = 0; i < n; i++) {
+		double r = y[i] - (icpt + slope * x[i]);
+		hist->record((uint64_t)fabs(r));
+		ss += r * r;
+	}
+	*rms = sqrt(ss / n);
+}
+
+int main(int argc, char **argv) {
+
+	const char *device = NULL;
+	int edge = PPS_DEV_ASSERT;
+	bool sim_fpga = false;
+	int seconds = 60;
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "d:csn:o:")) != -1) {
+		switch (opt) {
+		case 'd': device = optarg; break;
+		case 'c': edge = PPS_DEV_CLEAR; break;
+		case 's': sim_fpga = true; break;
+		case 'n': seconds = atoi(optarg); break;
+		case 'o': out_path = optarg; break;
+		default:
+			device = NULL;
+			break;
+		}
+	}
+	if (device == NULL || seconds < 3) {
+		fprintf(stderr, "usage: %s -d /dev/ppsN [-c] [-s] [-n seconds] [-o file]\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	if (pps_dev_init(device, edge) < 0) {
+		return EXIT_FAILURE;
+	}
+
+	GnssSim sim;
+	TimeStamp ts;
+	TimeStamp::Options opts;
+	opts.state_file = NULL;
+	if (sim_fpga) {
+		if (sim.start() < 0) {
+			pps_dev_uninit();
+			return EXIT_FAILURE;
+		}
+		opts.uart_device = sim.uartDevice();
+		opts.fpga_sim = true;
+	}
+	if (ts.init(opts) < 0) {
+		sim.stop();
+		pps_dev_uninit();
+		return EXIT_FAILURE;
+	}
+
+	std::vector<struct timespec> kernel, fpga;
+	pthread_t thread;
+	pthread_create(&thread, NULL, kernel_fcn, &kernel);
+
+	// The FPGA edges are taken from the servo state, with or without GGA
+	struct timespec last = {0, 0};
+	for (int i = 0; i < seconds * 100; i++) {
+		usleep(10000);
+		TimeStamp::ClockState clk;
+		ts.getClockState(&clk);
+		if (clk.last_edge.tv_sec != last.tv_sec || clk.last_edge.tv_nsec != last.tv_nsec) {
+			last = clk.last_edge;
+			fpga.push_back(last);
+		}
+		if (i % 1000 == 999) {
+			fprintf(stderr, "%d s: %zu kernel edges, %zu FPGA edges\n", (i + 1) / 100, kernel.size(), fpga.size());
+		}
+	}
+
+	g_stop.store(true);
+	pthread_join(thread, NULL);
+	ts.destroy();
+	sim.stop();
+	pps_dev_uninit();
+
+	BenchReport report("pps_compare");
+	LatencyHistogram h_kernel, h_fpga, h_pair;
+	double rms_kernel, rms_fpga;
+	fit_residuals(kernel, &h_kernel, &rms_kernel);
+	fit_residuals(fpga, &h_fpga, &rms_fpga);
+	report.add("kernel_jitter", h_kernel);
+	report.add("fpga_poll_jitter", h_fpga);
+	report.addValue("kernel_jitter_rms", rms_kernel, "ns");
+	report.addValue("fpga_poll_jitter_rms", rms_fpga, "ns");
+
+	// FPGA minus kernel for the edges of the same second
+	std::vector<double> diffs;
+	size_t j = 0;
+	for (size_t i = 0; i < kernel.size(); i++) {
+		while (j < fpga.size() && ns_of(&fpga[j], &kernel[i]) < -5e8) {
+			j++;
+		}
+		if (j < fpga.size() && fabs(ns_of(&fpga[j], &kernel[i])) < 5e8) {
+			diffs.push_back(ns_of(&fpga[j], &kernel[i]));
+		}
+	}
+	double mean = 0, sd = 0;
+	for (size_t i = 0; i < diffs.size(); i++) {
+		mean += diffs[i];
+	}
+	mean = diffs.empty() ? 0 : mean / diffs.size();
+	for (size_t i = 0; i < diffs.size(); i++) {
+		sd += (diffs[i] - mean) * (diffs[i] - mean);
+		h_pair.record((uint64_t)fabs(diffs[i] - mean));
+	}
+	sd = diffs.empty() ? 0 : sqrt(sd / diffs.size());
+	report.add("fpga_minus_kernel_dev", h_pair);
+	report.addValue("pairs", (double)diffs.size(), "count");
+	report.addValue("fpga_minus_kernel_mean", mean, "ns");
+	report.addValue("fpga_minus_kernel_sd", sd, "ns");
+
+	FILE *out = out_path ? fopen(out_path, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "pps_compare: Error: cannot open %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+	report.print(out);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	return EXIT_SUCCESS;
+}
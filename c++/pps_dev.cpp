@@ -0,0 +1,115 @@
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+#include <sys/ioctl.h>
+
+#include "pps_dev.h"
+#include "tstamp_log.h"
+
+int g_pps_dev_fd = -1;
+int g_pps_dev_edge = PPS_DEV_ASSERT;
+
+/*--------------------------------------------------------------------------------------*
+ * Open the kernel PPS source and select the captured edge
+ *
+ * @param device  PPS device, e.g. /dev/pps0
+ * @param edge    PPS_DEV_ASSERT or PPS_DEV_CLEAR
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int pps_dev_init(const char *device, int edge) {
+
+	if (edge != PPS_DEV_ASSERT && edge != PPS_DEV_CLEAR) {
+		fprintf(stderr, "pps_dev_init: Error: invalid edge %d\n", edge);
+		return -1;
+	}
+
+	g_pps_dev_fd = open(device, O_RDWR | O_CLOEXEC);
+	if (g_pps_dev_fd < 0) {
+		fprintf(stderr, "pps_dev_init: Error: cannot open %s: %s\n", device, strerror(errno));
+		return -1;
+	}
+
+	int caps = 0;
+	if (ioctl(g_pps_dev_fd, PPS_GETCAP, &caps) < 0 || !(caps & edge) || !(caps & PPS_TSFMT_TSPEC)) {
+		fprintf(stderr, "pps_dev_init: Error: %s cannot capture the %s edge\n", device, edge == PPS_DEV_ASSERT ? "assert" : "clear");
+		pps_dev_uninit();
+		return -1;
+	}
+
+	struct pps_kparams params;
+	memset(&params, 0, sizeof(params));
+	if (ioctl(g_pps_dev_fd, PPS_GETPARAMS, &params) < 0) {
+		fprintf(stderr, "pps_dev_init: Error: PPS_GETPARAMS failed: %s\n", strerror(errno));
+		pps_dev_uninit();
+		return -1;
+	}
+	if (!(params.mode & edge)) {
+		params.mode |= edge | PPS_TSFMT_TSPEC;
+		if (ioctl(g_pps_dev_fd, PPS_SETPARAMS, &params) < 0) {
+			fprintf(stderr, "pps_dev_init: Error: PPS_SETPARAMS failed: %s\n", strerror(errno));
+			pps_dev_uninit();
+			return -1;
+		}
+	}
+	g_pps_dev_edge = edge;
+
+	return 0;
+}
+
+int pps_dev_uninit() {
+
+	if (g_pps_dev_fd < 0) {
+		return -1;
+	}
+
+	close(g_pps_dev_fd);
+	g_pps_dev_fd = -1;
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Wait for an edge with a sequence number other than *seq
+ *
+ * @param timeout_ms  0 returns at once with the last edge
+ * @param ts          Kernel timestamp of the edge (CLOCK_REALTIME)
+ * @param seq         In: last edge seen, out: sequence number of the edge
+ *
+ * @retval  1 New edge
+ * @retval  0 No new edge within the timeout
+ * @retval -1 Failure
+ *--------------------------------------------------------------------------------------*/
+int pps_dev_fetch(int timeout_ms, struct timespec *ts, uint32_t *seq) {
+
+	if (g_pps_dev_fd < 0) {
+		return -1;
+	}
+
+	struct pps_fdata fdata;
+	memset(&fdata, 0, sizeof(fdata));
+	fdata.timeout.sec = timeout_ms / 1000;
+	fdata.timeout.nsec = (timeout_ms % 1000) * 1000000;
+
+	if (ioctl(g_pps_dev_fd, PPS_FETCH, &fdata) < 0) {
+		if (errno == ETIMEDOUT || errno == EINTR) {
+			return 0;
+		}
+		tstamp_log(TL_PPS_FETCH, errno);
+		return -1;
+	}
+
+	const struct pps_ktime *kt = g_pps_dev_edge == PPS_DEV_ASSERT ? &fdata.info.assert_tu : &fdata.info.clear_tu;
+	uint32_t s = g_pps_dev_edge == PPS_DEV_ASSERT ? fdata.info.assert_sequence : fdata.info.clear_sequence;
+	if (s == *seq) {
+		return 0;
+	}
+	*seq = s;
+	ts->tv_sec = (time_t)kt->sec;
+	ts->tv_nsec = kt->nsec;
+
+	return 1;
+}
@@ -0,0 +1,22 @@
+#ifndef __PPS_DEV_H__
+#define __PPS_DEV_H__
+
+#include <cstdint>
+#include <time.h>
+#include <linux/pps.h>
+
+// Kernel PPS source (RFC 2783 /dev/ppsN), e.g. pps-gpio on the carrier.
+// On a development box pps-ktimer (modprobe pps-ktimer) or pps-ldisc on a
+// serial port (ldattach PPS /dev/ttyS0) give a /dev/ppsN to test with.
+#define PPS_DEV_ASSERT 	PPS_CAPTUREASSERT
+#define PPS_DEV_CLEAR 	PPS_CAPTURECLEAR
+
+extern int g_pps_dev_fd;
+extern int g_pps_dev_edge;
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+int pps_dev_init(const char *device, int edge = PPS_DEV_ASSERT);
+int pps_dev_uninit();
+int pps_dev_fetch(int timeout_ms, struct timespec *ts, uint32_t *seq);
+
+#endif /* __PPS_DEV_H__ */
@@ -0,0 +1,65 @@
+#include <cmath>
+#include <algorithm>
+
+#include "pps_filter.h"
+
+PpsFilter::PpsFilter() {
+	m_accepted = 0;
+	m_rejected = 0;
+	reset();
+}
+
+void PpsFilter::reset() {
+	m_count = 0;
+	m_next = 0;
+	m_consecutive = 0;
+	m_gate_ns = 0.0;
+}
+
+void PpsFilter::push(double resid_ns) {
+	m_resid[m_next] = resid_ns;
+	m_next = (m_next + 1) % PPS_FILTER_WINDOW;
+	if (m_count < PPS_FILTER_WINDOW) {
+		m_count++;
+	}
+}
+
+static double median(double *v, uint32_t n) {
+	std::nth_element(v, v + n / 2, v + n);
+	return v[n / 2];
+}
+
+bool PpsFilter::check(double resid_ns) {
+
+	// Not enough history: accept and learn
+	if (m_count < 5) {
+		push(resid_ns);
+		m_accepted++;
+		return true;
+	}
+
+	double tmp[PPS_FILTER_WINDOW];
+	std::copy(m_resid, m_resid + m_count, tmp);
+	double med = median(tmp, m_count);
+	for (uint32_t i = 0; i < m_count; i++) {
+		tmp[i] = fabs(m_resid[i] - med);
+	}
+	double sigma = 1.4826 * median(tmp, m_count);
+	m_gate_ns = std::max(PPS_FILTER_K * sigma, PPS_FILTER_MIN_NS);
+
+	if (fabs(resid_ns - med) <= m_gate_ns) {
+		push(resid_ns);
+		m_consecutive = 0;
+		m_accepted++;
+		return true;
+	}
+
+	if (++m_consecutive >= PPS_FILTER_MAX_REJECT) {
+		reset();
+		push(resid_ns);
+		m_accepted++;
+		return true;
+	}
+	m_rejected++;
+	return false;
+}
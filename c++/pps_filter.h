@@ -0,0 +1,52 @@
+#ifndef __PPS_FILTER_H__
+#define __PPS_FILTER_H__
+
+#include <cstdint>
+
+// Residuals of the accepted edges kept for the median/MAD gate
+#define PPS_FILTER_WINDOW 		15
+
+// Gate: |residual - median| > PPS_FILTER_K * sigma, sigma = 1.4826 * MAD.
+// The gate is never narrower than PPS_FILTER_MIN_NS, so a very quiet PPS
+// does not reject its own normal jitter.
+#define PPS_FILTER_K 			5.0
+#define PPS_FILTER_MIN_NS 		5000.0
+
+// After this many rejections in a row the edge is accepted anyway and the
+// window restarts: the PPS (or the OS clock) really moved.
+#define PPS_FILTER_MAX_REJECT 	3
+
+/* Outlier gate on the PPS edge residuals (edge minus the servo prediction).
+ * A late wakeup of the poll gives a residual far outside the recent
+ * distribution; such edges are rejected and replaced by the prediction
+ * before being published. Owned by the PPS thread.
+ */
+class PpsFilter {
+
+public:
+
+	PpsFilter();
+
+	void reset();
+
+	// Returns true if the edge with this residual is accepted.
+	bool check(double resid_ns);
+
+	uint32_t accepted() const { return m_accepted; }
+	uint32_t rejected() const { return m_rejected; }
+	double gateNs() const { return m_gate_ns; } // Current half width of the gate
+
+private:
+
+	double m_resid[PPS_FILTER_WINDOW];
+	uint32_t m_count; 			// Residuals in the window
+	uint32_t m_next;
+	uint32_t m_consecutive; 	// Rejections in a row
+	uint32_t m_accepted;
+	uint32_t m_rejected;
+	double m_gate_ns;
+
+	void push(double resid_ns);
+};
+
+#endif /* __PPS_FILTER_H__ */
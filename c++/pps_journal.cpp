@@ -0,0 +1,131 @@
+#include <cstdio>
+#include <cstring>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+
+#include "pps_journal.h"
+#include "tstamp_log.h"
+
+#define JOURNAL_FILE_SIZE(cap) (sizeof(pps_journal_hdr_t) + (size_t)(cap) * sizeof(pps_journal_rec_t))
+
+PpsJournal::PpsJournal() {
+	m_path[0] = '\0';
+	m_capacity = 0;
+	m_hdr = NULL;
+	m_recs = NULL;
+}
+
+PpsJournal::~PpsJournal() {
+	close();
+}
+
+int PpsJournal::open(const char *path, uint32_t capacity) {
+	close();
+	if (capacity == 0 || strlen(path) + 3 > sizeof(m_path)) {
+		return -1;
+	}
+	snprintf(m_path, sizeof(m_path), "%s", path);
+	m_capacity = capacity;
+	return map();
+}
+
+void PpsJournal::close() {
+	if (m_hdr != NULL) {
+		munmap(m_hdr, JOURNAL_FILE_SIZE(m_capacity));
+		m_hdr = NULL;
+		m_recs = NULL;
+	}
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Map the journal file, continuing an existing compatible one
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error is logged with tstamp_log()
+ *--------------------------------------------------------------------------------------*/
+int PpsJournal::map() {
+
+	int fd = ::open(m_path, O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		tstamp_log(TL_JOURNAL_OPEN, errno);
+		return -1;
+	}
+
+	pps_journal_hdr_t old;
+	bool resume = pread(fd, &old, sizeof(old), 0) == (ssize_t)sizeof(old)
+		&& old.magic == PPS_JOURNAL_MAGIC && old.version == PPS_JOURNAL_VERSION
+		&& old.rec_size == sizeof(pps_journal_rec_t) && old.capacity == m_capacity
+		&& old.head <= m_capacity;
+
+	if (!resume && ftruncate(fd, 0) < 0) {
+		tstamp_log(TL_JOURNAL_TRUNCATE, errno);
+		::close(fd);
+		return -1;
+	}
+	if (ftruncate(fd, JOURNAL_FILE_SIZE(m_capacity)) < 0) {
+		tstamp_log(TL_JOURNAL_TRUNCATE, errno);
+		::close(fd);
+		return -1;
+	}
+
+	void *p = mmap(NULL, JOURNAL_FILE_SIZE(m_capacity), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	::close(fd);
+	if (p == MAP_FAILED) {
+		tstamp_log(TL_JOURNAL_MAP, errno);
+		return -1;
+	}
+
+	m_hdr = (pps_journal_hdr_t *)p;
+	m_recs = (pps_journal_rec_t *)(m_hdr + 1);
+
+	if (!resume) {
+		m_hdr->version = PPS_JOURNAL_VERSION;
+		m_hdr->rec_size = sizeof(pps_journal_rec_t);
+		m_hdr->capacity = m_capacity;
+		m_hdr->head = 0;
+		__atomic_store_n(&m_hdr->magic, PPS_JOURNAL_MAGIC, __ATOMIC_RELEASE);
+	}
+
+	return 0;
+}
+
+int PpsJournal::rotate() {
+
+	close();
+
+	char old_path[sizeof(m_path) + 2];
+	snprintf(old_path, sizeof(old_path), "%s.1", m_path);
+	if (rename(m_path, old_path) < 0) {
+		tstamp_log(TL_JOURNAL_ROTATE, errno);
+	}
+
+	return map();
+}
+
+void PpsJournal::append(const struct timespec *edge, uint32_t hh, uint32_t mm, uint32_t ss, uint32_t us, uint32_t delay_ns, uint8_t flags) {
+
+	if (m_hdr == NULL) {
+		return;
+	}
+
+	uint64_t head = m_hdr->head;
+	if (head >= m_capacity) {
+		if (rotate() < 0) {
+			return;
+		}
+		head = 0;
+	}
+
+	pps_journal_rec_t *rec = &m_recs[head];
+	__atomic_store_n(&rec->seq, 0, __ATOMIC_RELAXED);
+	rec->edge_sec = (uint32_t)edge->tv_sec;
+	rec->edge_nsec = (uint32_t)edge->tv_nsec;
+	rec->label_ms = ((hh * 60 + mm) * 60 + ss) * 1000 + us / 1000;
+	rec->delay_ns = delay_ns;
+	rec->flags = flags;
+	rec->reserved[0] = rec->reserved[1] = rec->reserved[2] = 0;
+	__atomic_store_n(&rec->seq, (uint32_t)head + 1, __ATOMIC_RELEASE);
+	__atomic_store_n(&m_hdr->head, head + 1, __ATOMIC_RELEASE);
+}
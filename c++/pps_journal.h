@@ -0,0 +1,71 @@
+#ifndef __PPS_JOURNAL_H__
+#define __PPS_JOURNAL_H__
+
+#include <cstdint>
+#include <time.h>
+
+#define PPS_JOURNAL_MAGIC 		0x504a524e // "PJRN"
+#define PPS_JOURNAL_VERSION 	1
+
+// Default records per file, about 18 h at one epoch per second (1.5 MB)
+#define PPS_JOURNAL_RECORDS 	65536
+
+// One record per PPS epoch
+typedef struct {
+	uint32_t seq; 			// Record number + 1, written last (0 = empty)
+	uint32_t edge_sec; 		// PPS edge, OS time
+	uint32_t edge_nsec;
+	uint32_t label_ms; 		// GGA time label, ms of the day
+	uint32_t delay_ns; 		// GGA delay after the PPS edge
+	uint8_t flags; 			// Status flags after the epoch
+	uint8_t reserved[3];
+} pps_journal_rec_t;
+
+// File header, followed by the records
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint32_t capacity;
+	uint32_t reserved0;
+	uint64_t head; 			// Records written, updated after each record
+	uint8_t reserved[40];
+} pps_journal_hdr_t;
+
+/* Append-only journal of the PPS epochs in a memory-mapped file.
+ * append() is a few stores, no system call: the kernel writes the pages
+ * back. When the file is full it is renamed to <path>.1 and a new one is
+ * started. Readers map the file read-only and use only the records below
+ * head whose seq matches their position.
+ *
+ * Records are fixed size, 24 bytes per epoch, so that a reader can index
+ * them while the file is written and a crash loses at most the record in
+ * progress. The varint stream of tstamp_codec.h is about 3 bytes per epoch
+ * but has to be decoded from a block start, it is meant for exports.
+ */
+class PpsJournal {
+
+public:
+
+	PpsJournal();
+	~PpsJournal();
+
+	int open(const char *path, uint32_t capacity = PPS_JOURNAL_RECORDS);
+	void close();
+	bool isOpen() const { return m_hdr != NULL; }
+
+	// Single writer.
+	void append(const struct timespec *edge, uint32_t hh, uint32_t mm, uint32_t ss, uint32_t us, uint32_t delay_ns, uint8_t flags);
+
+private:
+
+	int map();
+	int rotate();
+
+	char m_path[256];
+	uint32_t m_capacity;
+	pps_journal_hdr_t *m_hdr;
+	pps_journal_rec_t *m_recs;
+};
+
+#endif /* __PPS_JOURNAL_H__ */
@@ -0,0 +1,63 @@
+#include <cmath>
+
+#include "pps_servo.h"
+
+PpsServo::PpsServo() {
+	reset();
+}
+
+void PpsServo::reset() {
+	m_have_edge = false;
+	m_seeded = false;
+	m_samples = 0;
+	m_last_edge.tv_sec = 0;
+	m_last_edge.tv_nsec = 0;
+	m_freq_ppb = 0.0;
+	m_offset_ns = 0.0;
+	m_jitter_ns = 0.0;
+}
+
+void PpsServo::seed(double freq_ppb) {
+	m_freq_ppb = freq_ppb;
+	m_seeded = true;
+}
+
+void PpsServo::update(const struct timespec *edge, double unc_ns) {
+
+	if (m_have_edge) {
+		int64_t d = (int64_t)(edge->tv_sec - m_last_edge.tv_sec) * 1000000000LL + (edge->tv_nsec - m_last_edge.tv_nsec);
+		int64_t n = (d + 500000000LL) / 1000000000LL; // PPS seconds elapsed
+		
+		if (n >= 1 && n <= PPS_SERVO_MAX_GAP) {
+			double err_ppb = (double)(d - n * 1000000000LL) / (double)n;
+			
+			if (!locked()) {
+				m_freq_ppb = err_ppb;
+				m_offset_ns = 0.0;
+				m_samples++;
+			} else {
+				double resid = err_ppb - m_freq_ppb;
+				m_offset_ns = resid * (double)n;
+				if (fabs(resid) < PPS_SERVO_MAX_STEP_PPB) {
+					double r = unc_ns / PPS_SERVO_UNC_REF_NS;
+					m_freq_ppb += PPS_SERVO_GAIN * resid / (1.0 + r * r);
+					m_jitter_ns += PPS_SERVO_GAIN * (fabs(m_offset_ns) - m_jitter_ns);
+					m_samples++;
+				}
+			}
+		}
+	}
+
+	m_last_edge = *edge;
+	m_have_edge = true;
+}
+
+void PpsServo::predict(int64_t n, struct timespec *edge) const {
+	int64_t ns = (int64_t)m_last_edge.tv_nsec + n * 1000000000LL + (int64_t)llround(m_freq_ppb * (double)n);
+	edge->tv_sec = m_last_edge.tv_sec + ns / 1000000000LL;
+	edge->tv_nsec = ns % 1000000000LL;
+	if (edge->tv_nsec < 0) {
+		edge->tv_sec -= 1;
+		edge->tv_nsec += 1000000000LL;
+	}
+}
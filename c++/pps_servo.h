@@ -0,0 +1,62 @@
+#ifndef __PPS_SERVO_H__
+#define __PPS_SERVO_H__
+
+#include <cstdint>
+#include <time.h>
+
+// Filter gain of the frequency and jitter estimates (1/8 per PPS edge).
+#define PPS_SERVO_GAIN 		0.125
+
+// Edges further apart than this are not used to estimate the frequency.
+#define PPS_SERVO_MAX_GAP 	3600
+
+// A frequency step larger than this (1 ms/s) is handled as a phase jump
+// of the OS clock, not as a frequency change.
+#define PPS_SERVO_MAX_STEP_PPB 	1000000.0
+
+// Edge uncertainty at which the frequency gain is halved. Edges captured
+// with a wider bracket (late wakeup of the poll) count less.
+#define PPS_SERVO_UNC_REF_NS 	10000.0
+
+/* Tracks the OS clock (CLOCK_REALTIME) against the PPS edges.
+ * The frequency error is the OS time elapsed in one PPS second minus 1 s,
+ * in ns per second (ppb). The offset is the error of the last edge with
+ * respect to the edge predicted from the previous one.
+ */
+class PpsServo {
+
+public:
+
+	PpsServo();
+
+	void reset();
+
+	// Start from a known frequency error, e.g. restored from a state file.
+	void seed(double freq_ppb);
+
+	// Feed a new PPS edge timestamp, unc_ns is its +- bound (0 if unknown).
+	void update(const struct timespec *edge, double unc_ns = 0.0);
+
+	// Predict the OS timestamp of the edge n seconds after the last one.
+	void predict(int64_t n, struct timespec *edge) const;
+
+	double freqPpb() const { return m_freq_ppb; }
+	double offsetNs() const { return m_offset_ns; }
+	double jitterNs() const { return m_jitter_ns; }
+	uint32_t samples() const { return m_samples; }
+	bool locked() const { return m_seeded || m_samples > 0; }
+	bool hasEdge() const { return m_have_edge; }
+	const struct timespec &lastEdge() const { return m_last_edge; }
+
+private:
+
+	bool m_have_edge;
+	bool m_seeded;
+	uint32_t m_samples;
+	struct timespec m_last_edge;
+	double m_freq_ppb;
+	double m_offset_ns;
+	double m_jitter_ns;
+};
+
+#endif /* __PPS_SERVO_H__ */
@@ -0,0 +1,286 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <arpa/inet.h>
+
+#include "tstamp.h"
+#include "gnss_sim.h"
+#include "ptp_master.h"
+#include "bench.h"
+
+// Loopback benchmark of PtpMaster against a minimal two-step E2E client,
+// results on standard output as JSON.
+//
+//	ptp_bench [-s log sync interval] [-t seconds] [-o file]
+//
+// The client clock is the OS clock and the simulated edges are on the OS
+// seconds, so the offset computed by the client is the error of the
+// served time. Delay_Req are sent back to back to measure the message rate.
+// The time scale conversions behind the PTP timestamps are checked first
+// around the 2016-12-31 leap second, a mismatch fails the run.
+
+#define MASTER_EVENT 	12319
+#define MASTER_GENERAL 	12320
+#define CLIENT_EVENT 	12419
+#define CLIENT_GENERAL 	12420
+
+static int open_client(uint16_t port) {
+	int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK, 0);
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_TIMESTAMPNS, &on, sizeof(on));
+	if (fd < 0 || bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		return -1;
+	}
+	return fd;
+}
+
+static int64_t get_timestamp(const uint8_t *p) {
+	uint64_t sec = ((uint64_t)p[0] << 40) | ((uint64_t)p[1] << 32) | ((uint64_t)p[2] << 24) | ((uint64_t)p[3] << 16)
+		| ((uint64_t)p[4] << 8) | p[5];
+	uint32_t nsec = ((uint32_t)p[6] << 24) | ((uint32_t)p[7] << 16) | ((uint32_t)p[8] << 8) | p[9];
+	return (int64_t)sec * 1000000000LL + nsec;
+}
+
+// OS time, as TAI
+static int64_t tai_ns(const struct timespec *ts) {
+	return ((int64_t)ts->tv_sec + time_scale_tai_utc(ts->tv_sec)) * 1000000000LL + ts->tv_nsec;
+}
+
+// UTC, TAI and GPS seconds and GPS week around the 2017-01-01 leap second
+static int check_time_scale() {
+
+	static const struct {
+		int64_t utc;
+		int64_t tai;
+		int64_t gps;
+		uint32_t week;
+		uint32_t tow;
+		int leap;
+	} cases[] = {
+		{ 1483225200, 1483225236, 1167260417, 1929, 601217, 1 }, 	// 2016-12-31T23:00:00Z
+		{ 1483228799, 1483228835, 1167264016, 1930, 16, 1 }, 		// 2016-12-31T23:59:59Z
+		{ 1483228800, 1483228837, 1167264018, 1930, 18, 0 }, 		// 2017-01-01T00:00:00Z
+	};
+
+	int errors = 0;
+	for (size_t i = 0; i < sizeof(cases) / sizeof(cases[0]); i++) {
+		struct timespec utc = { (time_t)cases[i].utc, 500000000 };
+		struct timespec tai, gps, back;
+		uint32_t week;
+		uint64_t tow_ns;
+		time_scale_convert(&utc, TSCALE_UTC, TSCALE_TAI, &tai);
+		time_scale_convert(&utc, TSCALE_UTC, TSCALE_GPS, &gps);
+		time_scale_convert(&gps, TSCALE_GPS, TSCALE_UTC, &back);
+		time_scale_gps_week(&gps, &week, &tow_ns);
+		if (tai.tv_sec != cases[i].tai || gps.tv_sec != cases[i].gps || back.tv_sec != cases[i].utc
+			|| week != cases[i].week || tow_ns != cases[i].tow * 1000000000ULL + 500000000ULL
+			|| time_scale_leap_pending(cases[i].utc) != cases[i].leap) {
+			fprintf(stderr, "ptp_bench: Error: UTC %lld: TAI %lld GPS %lld back %lld week %u tow %llu ns leap %d\n",
+				(long long)cases[i].utc, (long long)tai.tv_sec, (long long)gps.tv_sec, (long long)back.tv_sec,
+				week, (unsigned long long)tow_ns, time_scale_leap_pending(cases[i].utc));
+			errors++;
+		}
+	}
+	return errors == 0 ? 0 : -1;
+}
+
+static int recv_ts(int fd, uint8_t *buf, int size, int64_t *rx) {
+	char ctrl[64];
+	struct iovec iov = { buf, (size_t)size };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+	int len = recvmsg(fd, &msg, 0);
+	if (len < 0) {
+		return -1;
+	}
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPNS) {
+			memcpy(&ts, CMSG_DATA(c), sizeof(ts));
+		}
+	}
+	*rx = tai_ns(&ts);
+	return len;
+}
+
+int main(int argc, char **argv) {
+
+	int log_sync = -4;
+	double seconds = 5.0;
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "s:t:o:")) != -1) {
+		switch (opt) {
+		case 's': log_sync = atoi(optarg); break;
+		case 't': seconds = atof(optarg); break;
+		case 'o': out_path = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-s log sync interval] [-t seconds] [-o file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	if (check_time_scale() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	GnssSim sim;
+	if (sim.start() < 0) {
+		return EXIT_FAILURE;
+	}
+	TimeStamp::Options opts;
+	opts.state_file = NULL;
+	opts.uart_device = sim.uartDevice();
+	opts.fpga_sim = true;
+	TimeStamp ts;
+	if (ts.init(opts) < 0) {
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+	TimeEvent ev;
+	if (ts.waitEvent(TEV_EPOCH, 0, &ev, 3000) != 0) {
+		fprintf(stderr, "ptp_bench: Error: no epoch from the simulator\n");
+		ts.destroy();
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	int ev_fd = open_client(CLIENT_EVENT);
+	int gen_fd = open_client(CLIENT_GENERAL);
+	if (ev_fd < 0 || gen_fd < 0) {
+		fprintf(stderr, "ptp_bench: Error: cannot bind the client ports\n");
+		ts.destroy();
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	PtpMaster master(ts);
+	PtpMaster::Config cfg;
+	cfg.bind_addr = "127.0.0.1";
+	cfg.dest_addr = "127.0.0.1";
+	cfg.event_port = MASTER_EVENT;
+	cfg.general_port = MASTER_GENERAL;
+	cfg.dest_event_port = CLIENT_EVENT;
+	cfg.dest_general_port = CLIENT_GENERAL;
+	cfg.log_sync_interval = (int8_t)log_sync;
+	cfg.iface = "lo";
+	if (master.start(cfg) < 0) {
+		ts.destroy();
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	struct sockaddr_in to;
+	memset(&to, 0, sizeof(to));
+	to.sin_family = AF_INET;
+	to.sin_port = htons(MASTER_EVENT);
+	to.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+
+	LatencyHistogram offset_hist, delay_hist, sync_hist;
+	int64_t sync_sum = 0;
+	uint8_t buf[128], req[44];
+	uint16_t sync_seq = 0, req_seq = 0;
+	int64_t t1 = 0, t2 = 0, t2_pending = 0, t3 = 0;
+	bool have_sync = false, req_pending = false;
+	uint64_t reqs = 0, announces = 0, class6 = 0;
+
+	uint64_t start = bench_now_ns(), end = start + (uint64_t)(seconds * 1e9);
+	while (bench_now_ns() < end) {
+
+		if (!req_pending && have_sync) {
+			memset(req, 0, sizeof(req));
+			req[0] = 0x1;
+			req[1] = 2;
+			req[3] = sizeof(req);
+			memset(req + 20, 0xAA, 8);
+			req[29] = 1;
+			req[30] = (uint8_t)(++req_seq >> 8);
+			req[31] = (uint8_t)req_seq;
+			req[32] = 1;
+			struct timespec now;
+			clock_gettime(CLOCK_REALTIME, &now);
+			t3 = tai_ns(&now);
+			if (sendto(ev_fd, req, sizeof(req), 0, (struct sockaddr *)&to, sizeof(to)) == sizeof(req)) {
+				req_pending = true;
+			}
+		}
+
+		struct pollfd pfd[2] = { { ev_fd, POLLIN, 0 }, { gen_fd, POLLIN, 0 } };
+		if (poll(pfd, 2, 100) <= 0) {
+			req_pending = false; // Lost, send another one
+			continue;
+		}
+
+		int64_t rx;
+		if ((pfd[0].revents & POLLIN) && recv_ts(ev_fd, buf, sizeof(buf), &rx) >= 44 && (buf[0] & 0x0F) == 0x0) {
+			sync_seq = (uint16_t)((buf[30] << 8) | buf[31]);
+			t2_pending = rx;
+		}
+		while ((pfd[1].revents & POLLIN) && recv_ts(gen_fd, buf, sizeof(buf), &rx) >= 34) {
+			int type = buf[0] & 0x0F;
+			uint16_t seq = (uint16_t)((buf[30] << 8) | buf[31]);
+			if (type == 0x8 && seq == sync_seq && t2_pending != 0) {
+				t1 = get_timestamp(buf + 34);
+				t2 = t2_pending;
+				t2_pending = 0;
+				have_sync = true;
+				int64_t ms = t2 - t1; // Signed, the histogram gets |ms|
+				sync_hist.record(ms < 0 ? -ms : ms);
+				sync_sum += ms;
+			} else if (type == 0x9 && seq == req_seq && req_pending) {
+				int64_t t4 = get_timestamp(buf + 34);
+				int64_t offset = ((t2 - t1) - (t4 - t3)) / 2;
+				int64_t delay = ((t2 - t1) + (t4 - t3)) / 2;
+				offset_hist.record(offset < 0 ? -offset : offset);
+				delay_hist.record(delay > 0 ? delay : 0);
+				req_pending = false;
+				reqs++;
+			} else if (type == 0xB) {
+				announces++;
+				class6 += buf[48] == 6;
+			}
+		}
+	}
+	uint64_t elapsed = bench_now_ns() - start;
+
+	master.stop();
+	ts.destroy();
+	sim.stop();
+	close(ev_fd);
+	close(gen_fd);
+
+	BenchReport report("ptp");
+	report.add("ptp_delay_req_round_trip", delay_hist, reqs, elapsed);
+	report.add("ptp_abs_offset", offset_hist);
+	report.add("ptp_sync_abs_master_to_slave", sync_hist, master.syncs(), elapsed);
+	report.addValue("ptp_sync_master_to_slave_mean", sync_hist.count() ? (double)sync_sum / sync_hist.count() : 0, "ns");
+	report.add("ptp_sync_tx_delay", master.syncTxDelay());
+	report.addValue("announce_class6", announces ? (double)class6 / announces : 0, "ratio");
+	report.addValue("tx_timestamp_fallbacks", (double)master.txFallbacks(), "count");
+
+	FILE *out = out_path ? fopen(out_path, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "ptp_bench: Error: cannot open %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+	report.print(out);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	return reqs > 0 ? EXIT_SUCCESS : EXIT_FAILURE;
+}
@@ -0,0 +1,546 @@
+#include <cstdio>
+#include <cstring>
+#include <cstdlib>
+#include <unistd.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/socket.h>
+#include <sys/eventfd.h>
+#include <arpa/inet.h>
+#include <linux/net_tstamp.h>
+#include <linux/errqueue.h>
+
+#include "ptp_master.h"
+
+#define PTP_MSG_SYNC 		0x0
+#define PTP_MSG_DELAY_REQ 	0x1
+#define PTP_MSG_FOLLOW_UP 	0x8
+#define PTP_MSG_DELAY_RESP 	0x9
+#define PTP_MSG_ANNOUNCE 	0xB
+
+#define PTP_HDR_LEN 		34
+#define PTP_SYNC_LEN 		44
+#define PTP_DELAY_RESP_LEN 	54
+#define PTP_ANNOUNCE_LEN 	64
+
+#define PTP_FLAG_TWO_STEP 		0x0200
+#define PTP_FLAG_LEAP61 		0x0001
+#define PTP_FLAG_LEAP59 		0x0002
+#define PTP_FLAG_UTC_VALID 		0x0004
+#define PTP_FLAG_PTP_TIMESCALE 	0x0008
+#define PTP_FLAG_TIME_TRACE 	0x0010
+#define PTP_FLAG_FREQ_TRACE 	0x0020
+
+#define PTP_CLASS_LOCKED 	6
+#define PTP_CLASS_HOLDOVER 	7
+#define PTP_CLASS_DEFAULT 	248
+#define PTP_ACCURACY_1US 	0x23
+#define PTP_ACCURACY_UNKNOWN 0xFE
+#define PTP_SOURCE_GPS 		0x20
+
+#define PTP_TX_TS_TIMEOUT_MS 	10
+
+static inline void put_u16(uint8_t *p, uint16_t v) {
+	p[0] = (uint8_t)(v >> 8);
+	p[1] = (uint8_t)v;
+}
+
+static inline void put_u32(uint8_t *p, uint32_t v) {
+	put_u16(p, (uint16_t)(v >> 16));
+	put_u16(p + 2, (uint16_t)v);
+}
+
+static inline uint16_t get_u16(const uint8_t *p) {
+	return (uint16_t)((p[0] << 8) | p[1]);
+}
+
+// 48 bit seconds and 32 bit ns
+static inline void put_timestamp(uint8_t *p, const struct timespec *ts) {
+	uint64_t sec = (uint64_t)ts->tv_sec;
+	put_u16(p, (uint16_t)(sec >> 32));
+	put_u32(p + 2, (uint32_t)sec);
+	put_u32(p + 6, (uint32_t)ts->tv_nsec);
+}
+
+static inline int64_t delta_ns(const struct timespec *a, const struct timespec *b) {
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+// EUI-64 from the MAC address of iface, from the host id if not available
+static void clock_identity(const char *iface, uint8_t *id) {
+
+	unsigned mac[6];
+	char path[128];
+	snprintf(path, sizeof(path), "/sys/class/net/%s/address", iface);
+	FILE *f = fopen(path, "r");
+	int n = 0;
+	if (f != NULL) {
+		n = fscanf(f, "%x:%x:%x:%x:%x:%x", &mac[0], &mac[1], &mac[2], &mac[3], &mac[4], &mac[5]);
+		fclose(f);
+	}
+	if (n != 6) {
+		uint32_t h = (uint32_t)gethostid();
+		mac[0] = 0x02; // Locally administered
+		mac[1] = 0x00;
+		mac[2] = (h >> 24) & 0xFF;
+		mac[3] = (h >> 16) & 0xFF;
+		mac[4] = (h >> 8) & 0xFF;
+		mac[5] = h & 0xFF;
+	}
+	id[0] = (uint8_t)mac[0];
+	id[1] = (uint8_t)mac[1];
+	id[2] = (uint8_t)mac[2];
+	id[3] = 0xFF;
+	id[4] = 0xFE;
+	id[5] = (uint8_t)mac[3];
+	id[6] = (uint8_t)mac[4];
+	id[7] = (uint8_t)mac[5];
+}
+
+static int open_socket(const char *bind_addr, uint16_t port) {
+
+	int fd = socket(AF_INET, SOCK_DGRAM | SOCK_NONBLOCK | SOCK_CLOEXEC, 0);
+	if (fd < 0) {
+		return -1;
+	}
+
+	int on = 1;
+	setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &on, sizeof(on));
+
+	struct sockaddr_in sa;
+	memset(&sa, 0, sizeof(sa));
+	sa.sin_family = AF_INET;
+	sa.sin_port = htons(port);
+	sa.sin_addr.s_addr = htonl(INADDR_ANY);
+	if (bind_addr != NULL) {
+		inet_pton(AF_INET, bind_addr, &sa.sin_addr);
+	}
+	if (bind(fd, (struct sockaddr *)&sa, sizeof(sa)) < 0) {
+		close(fd);
+		return -1;
+	}
+
+	return fd;
+}
+
+PtpMaster::PtpMaster(TimeStamp &tstamp) : m_tstamp(tstamp), m_syncs(0), m_delay_resps(0), m_tx_fallbacks(0) {
+	m_started = false;
+	m_event_fd = -1;
+	m_general_fd = -1;
+	m_stop_fd = -1;
+	m_sync_seq = 0;
+	m_announce_seq = 0;
+	m_tx_id = 0;
+	memset(m_clock_id, 0, sizeof(m_clock_id));
+	memset(&m_dest_event, 0, sizeof(m_dest_event));
+	memset(&m_dest_general, 0, sizeof(m_dest_general));
+}
+
+PtpMaster::~PtpMaster() {
+	stop();
+}
+
+int PtpMaster::toPtpTime(const struct timespec *os_ts, struct timespec *tai) {
+
+	struct timespec utc;
+	int res = m_tstamp.toUtc(os_ts, &utc);
+	time_scale_convert(&utc, TSCALE_UTC, TSCALE_TAI, tai);
+	return res;
+}
+
+int PtpMaster::start(const Config &cfg) {
+
+	if (m_started) {
+		return 0;
+	}
+	m_cfg = cfg;
+
+	struct in_addr dest;
+	if (inet_pton(AF_INET, cfg.dest_addr, &dest) != 1) {
+		fprintf(stderr, "PtpMaster::start: Error: invalid destination %s\n", cfg.dest_addr);
+		return -1;
+	}
+	m_dest_event.sin_family = AF_INET;
+	m_dest_event.sin_addr = dest;
+	m_dest_event.sin_port = htons(cfg.dest_event_port);
+	m_dest_general = m_dest_event;
+	m_dest_general.sin_port = htons(cfg.dest_general_port);
+
+	clock_identity(cfg.iface, m_clock_id);
+
+	m_event_fd = open_socket(cfg.bind_addr, cfg.event_port);
+	m_general_fd = open_socket(cfg.bind_addr, cfg.general_port);
+	if (m_event_fd < 0 || m_general_fd < 0) {
+		fprintf(stderr, "PtpMaster::start: Error: cannot bind ports %u/%u: %s\n", cfg.event_port, cfg.general_port, strerror(errno));
+		stop();
+		return -1;
+	}
+
+	if (IN_MULTICAST(ntohl(dest.s_addr))) {
+		struct ip_mreq mreq;
+		mreq.imr_multiaddr = dest;
+		mreq.imr_interface.s_addr = htonl(INADDR_ANY);
+		setsockopt(m_event_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+		setsockopt(m_general_fd, IPPROTO_IP, IP_ADD_MEMBERSHIP, &mreq, sizeof(mreq));
+	}
+
+	// OPT_ID numbers the transmit timestamps, so that each one is matched
+	// to its Sync. Counted from 0 by the sends that follow.
+	int flags = SOF_TIMESTAMPING_TX_SOFTWARE | SOF_TIMESTAMPING_RX_SOFTWARE | SOF_TIMESTAMPING_SOFTWARE |
+		SOF_TIMESTAMPING_OPT_ID;
+#ifdef SOF_TIMESTAMPING_OPT_TSONLY
+	flags |= SOF_TIMESTAMPING_OPT_TSONLY;
+#endif
+	m_tx_id = 0;
+	if (setsockopt(m_event_fd, SOL_SOCKET, SO_TIMESTAMPING, &flags, sizeof(flags)) < 0) {
+		fprintf(stderr, "PtpMaster::start: Error: SO_TIMESTAMPING not available, using user space timestamps\n");
+	}
+
+	m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_stop_fd < 0 || pthread_create(&m_thread, NULL, threadFcn, this) != 0) {
+		fprintf(stderr, "PtpMaster::start: Error: master thread creation failed\n");
+		stop();
+		return -1;
+	}
+
+	m_started = true;
+	return 0;
+}
+
+void PtpMaster::stop() {
+
+	if (m_started) {
+		uint64_t one = 1;
+		if (write(m_stop_fd, &one, sizeof(one)) < 0) {
+			fprintf(stderr, "PtpMaster::stop: Error: eventfd write failed\n");
+		}
+		pthread_join(m_thread, NULL);
+		m_started = false;
+	}
+
+	if (m_stop_fd >= 0) {
+		close(m_stop_fd);
+		m_stop_fd = -1;
+	}
+	if (m_event_fd >= 0) {
+		close(m_event_fd);
+		m_event_fd = -1;
+	}
+	if (m_general_fd >= 0) {
+		close(m_general_fd);
+		m_general_fd = -1;
+	}
+}
+
+int PtpMaster::header(uint8_t *buf, int type, int len, uint16_t seq, int8_t log_interval) {
+
+	static const uint8_t control[16] = { 0, 1, 5, 5, 5, 5, 5, 5, 2, 3, 5, 5, 5, 5, 5, 5 };
+
+	memset(buf, 0, len);
+	buf[0] = (uint8_t)type;
+	buf[1] = 2; // PTPv2
+	put_u16(buf + 2, (uint16_t)len);
+	buf[4] = m_cfg.domain;
+	memcpy(buf + 20, m_clock_id, 8);
+	put_u16(buf + 28, 1); // Port number
+	put_u16(buf + 30, seq);
+	buf[32] = control[type & 0x0F];
+	buf[33] = (uint8_t)log_interval;
+
+	return PTP_HDR_LEN;
+}
+
+int PtpMaster::sendTo(int fd, const uint8_t *buf, int len, const struct sockaddr_in *to) {
+
+	if (sendto(fd, buf, len, 0, (const struct sockaddr *)to, sizeof(*to)) != len) {
+		fprintf(stderr, "PtpMaster::sendTo: Error: %s\n", strerror(errno));
+		return -1;
+	}
+	return 0;
+}
+
+static int64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (int64_t)ts.tv_sec * 1000000000LL + ts.tv_nsec;
+}
+
+// Read one transmit timestamp from the error queue of the event socket.
+// Returns 1 with *id set when the kernel numbered it (OPT_ID), 0 without id,
+// -1 when the queue is empty.
+static int read_tx_timestamp(int fd, struct timespec *ts, uint32_t *id) {
+
+	char ctrl[256];
+	uint8_t data[128];
+	struct iovec iov = { data, sizeof(data) };
+	struct msghdr msg;
+	memset(&msg, 0, sizeof(msg));
+	msg.msg_iov = &iov;
+	msg.msg_iovlen = 1;
+	msg.msg_control = ctrl;
+	msg.msg_controllen = sizeof(ctrl);
+	if (recvmsg(fd, &msg, MSG_ERRQUEUE | MSG_DONTWAIT) < 0) {
+		return -1;
+	}
+
+	bool have_ts = false, have_id = false;
+	for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+		if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+			struct scm_timestamping tss;
+			memcpy(&tss, CMSG_DATA(c), sizeof(tss));
+			*ts = tss.ts[0];
+			have_ts = true;
+		} else if (c->cmsg_level == SOL_IP && c->cmsg_type == IP_RECVERR) {
+			struct sock_extended_err err;
+			memcpy(&err, CMSG_DATA(c), sizeof(err));
+			if (err.ee_origin == SO_EE_ORIGIN_TIMESTAMPING) {
+				*id = err.ee_data;
+				have_id = true;
+			}
+		}
+	}
+	if (!have_ts) {
+		return read_tx_timestamp(fd, ts, id); // Not a timestamp, next one
+	}
+	return have_id ? 1 : 0;
+}
+
+// Drop the transmit timestamps left in the error queue, e.g. one that
+// arrived after txTimestamp() gave up
+void PtpMaster::dropTxTimestamps() {
+	struct timespec ts;
+	uint32_t id;
+	while (read_tx_timestamp(m_event_fd, &ts, &id) >= 0) {}
+}
+
+// Software transmit timestamp of the Sync just sent. The queue is drained
+// before each Sync, so a timestamp numbered (OPT_ID) below the expected id
+// belongs to an earlier Sync and one at or above it is ours: the kernel also
+// counts sends that failed after queueing, m_tx_id follows it. Error queue
+// readiness is signalled as POLLERR.
+int PtpMaster::txTimestamp(struct timespec *ts) {
+
+	int64_t deadline = monotonic_ns() + PTP_TX_TS_TIMEOUT_MS * 1000000LL;
+	for (;;) {
+		uint32_t ts_id;
+		int res;
+		while ((res = read_tx_timestamp(m_event_fd, ts, &ts_id)) >= 0) {
+			if (res == 0) { // Kernel without OPT_ID
+				return 0;
+			}
+			if ((int32_t)(ts_id - m_tx_id) >= 0) {
+				m_tx_id = ts_id + 1;
+				return 0;
+			}
+		}
+
+		int left_ms = (int)((deadline - monotonic_ns() + 999999) / 1000000);
+		if (left_ms <= 0) {
+			return -1;
+		}
+		struct pollfd pfd = { m_event_fd, POLLERR, 0 };
+		if (poll(&pfd, 1, left_ms) < 0 && errno != EINTR) {
+			return -1;
+		}
+	}
+}
+
+void PtpMaster::sendSync() {
+
+	uint8_t buf[PTP_SYNC_LEN];
+	uint16_t seq = m_sync_seq++;
+
+	// Two step: the origin timestamp of the Sync is approximate
+	struct timespec before, tx, tai;
+	clock_gettime(CLOCK_REALTIME, &before);
+	header(buf, PTP_MSG_SYNC, PTP_SYNC_LEN, seq, m_cfg.log_sync_interval);
+	put_u16(buf + 6, PTP_FLAG_TWO_STEP);
+	if (toPtpTime(&before, &tai) < 0) {
+		return;
+	}
+	put_timestamp(buf + 34, &tai);
+	dropTxTimestamps();
+	if (sendTo(m_event_fd, buf, PTP_SYNC_LEN, &m_dest_event) < 0) {
+		return;
+	}
+
+	if (txTimestamp(&tx) < 0) {
+		tx = before;
+		m_tx_fallbacks.fetch_add(1, std::memory_order_relaxed);
+	} else {
+		int64_t d = delta_ns(&tx, &before);
+		m_tx_delay.record(d > 0 ? d : 0);
+	}
+
+	header(buf, PTP_MSG_FOLLOW_UP, PTP_SYNC_LEN, seq, m_cfg.log_sync_interval);
+	toPtpTime(&tx, &tai);
+	put_timestamp(buf + 34, &tai);
+	sendTo(m_general_fd, buf, PTP_SYNC_LEN, &m_dest_general);
+
+	m_syncs.fetch_add(1, std::memory_order_relaxed);
+}
+
+void PtpMaster::sendAnnounce() {
+
+	uint8_t buf[PTP_ANNOUNCE_LEN];
+	header(buf, PTP_MSG_ANNOUNCE, PTP_ANNOUNCE_LEN, m_announce_seq++, m_cfg.log_announce_interval);
+
+	TimeStamp::ClockState clk;
+	m_tstamp.getClockState(&clk);
+	struct timespec now, tai;
+	clock_gettime(CLOCK_REALTIME, &now);
+	int flags = toPtpTime(&now, &tai);
+
+	uint8_t clock_class = PTP_CLASS_DEFAULT;
+	uint8_t accuracy = PTP_ACCURACY_UNKNOWN;
+	uint16_t ptp_flags = PTP_FLAG_PTP_TIMESCALE;
+	if (flags == TimeStamp::TS_VALID) {
+		clock_class = PTP_CLASS_LOCKED;
+		accuracy = PTP_ACCURACY_1US;
+		ptp_flags |= PTP_FLAG_UTC_VALID | PTP_FLAG_TIME_TRACE | PTP_FLAG_FREQ_TRACE;
+	} else if (flags >= 0 && clk.holdover) {
+		clock_class = PTP_CLASS_HOLDOVER;
+		ptp_flags |= PTP_FLAG_UTC_VALID;
+	}
+	struct timespec utc;
+	time_scale_convert(&tai, TSCALE_TAI, TSCALE_UTC, &utc);
+	int leap = time_scale_leap_pending(utc.tv_sec);
+	if (leap > 0) {
+		ptp_flags |= PTP_FLAG_LEAP61;
+	} else if (leap < 0) {
+		ptp_flags |= PTP_FLAG_LEAP59;
+	}
+	put_u16(buf + 6, ptp_flags);
+
+	if (flags >= 0) {
+		put_timestamp(buf + 34, &tai);
+	}
+	put_u16(buf + 44, (uint16_t)time_scale_tai_utc(utc.tv_sec));
+	buf[47] = m_cfg.priority1;
+	buf[48] = clock_class;
+	buf[49] = accuracy;
+	put_u16(buf + 50, 0xFFFF); // offsetScaledLogVariance not computed
+	buf[52] = m_cfg.priority2;
+	memcpy(buf + 53, m_clock_id, 8);
+	put_u16(buf + 61, 0); // stepsRemoved
+	buf[63] = PTP_SOURCE_GPS;
+
+	sendTo(m_general_fd, buf, PTP_ANNOUNCE_LEN, &m_dest_general);
+}
+
+// Answer the Delay_Req received on the event socket
+void PtpMaster::handleEvent() {
+
+	uint8_t req[128], resp[PTP_DELAY_RESP_LEN];
+	char ctrl[256];
+	struct sockaddr_in from;
+
+	for (;;) {
+		struct iovec iov = { req, sizeof(req) };
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_name = &from;
+		msg.msg_namelen = sizeof(from);
+		msg.msg_iov = &iov;
+		msg.msg_iovlen = 1;
+		msg.msg_control = ctrl;
+		msg.msg_controllen = sizeof(ctrl);
+
+		int len = recvmsg(m_event_fd, &msg, 0);
+		if (len < 0) {
+			return;
+		}
+		if (len < PTP_SYNC_LEN || (req[0] & 0x0F) != PTP_MSG_DELAY_REQ || (req[1] & 0x0F) != 2 || req[4] != m_cfg.domain) {
+			continue;
+		}
+
+		struct timespec rx, tai;
+		bool have_rx = false;
+		for (struct cmsghdr *c = CMSG_FIRSTHDR(&msg); c != NULL; c = CMSG_NXTHDR(&msg, c)) {
+			if (c->cmsg_level == SOL_SOCKET && c->cmsg_type == SCM_TIMESTAMPING) {
+				struct scm_timestamping tss;
+				memcpy(&tss, CMSG_DATA(c), sizeof(tss));
+				rx = tss.ts[0];
+				have_rx = true;
+			}
+		}
+		if (!have_rx) {
+			clock_gettime(CLOCK_REALTIME, &rx);
+		}
+		if (toPtpTime(&rx, &tai) < 0) {
+			continue;
+		}
+
+		header(resp, PTP_MSG_DELAY_RESP, PTP_DELAY_RESP_LEN, get_u16(req + 30), m_cfg.log_sync_interval);
+		memcpy(resp + 8, req + 8, 8); // correctionField of the request
+		put_timestamp(resp + 34, &tai);
+		memcpy(resp + 44, req + 20, 10); // requestingPortIdentity
+
+		struct sockaddr_in to = m_dest_general;
+		if (!IN_MULTICAST(ntohl(to.sin_addr.s_addr))) {
+			to.sin_addr = from.sin_addr;
+		}
+		sendTo(m_general_fd, resp, PTP_DELAY_RESP_LEN, &to);
+		m_delay_resps.fetch_add(1, std::memory_order_relaxed);
+	}
+}
+
+static int64_t interval_ns(int8_t log_interval) {
+	return log_interval >= 0 ? 1000000000LL << log_interval : 1000000000LL >> -log_interval;
+}
+
+void *PtpMaster::threadFcn(void *ptr) {
+	PtpMaster *master = static_cast<PtpMaster *>(ptr);
+
+	int64_t next_sync = monotonic_ns();
+	int64_t next_announce = next_sync;
+
+	for (;;) {
+		int64_t now = monotonic_ns();
+		if (now >= next_announce) {
+			master->sendAnnounce();
+			next_announce += interval_ns(master->m_cfg.log_announce_interval);
+		}
+		if (now >= next_sync) {
+			master->sendSync();
+			next_sync += interval_ns(master->m_cfg.log_sync_interval);
+			if (next_sync < now) {
+				next_sync = now; // Late, do not burst
+			}
+		}
+
+		int64_t next = next_sync < next_announce ? next_sync : next_announce;
+		int timeout_ms = (int)((next - monotonic_ns()) / 1000000);
+
+		struct pollfd pfd[3];
+		pfd[0].fd = master->m_stop_fd;
+		pfd[0].events = POLLIN;
+		pfd[1].fd = master->m_event_fd;
+		pfd[1].events = POLLIN;
+		pfd[2].fd = master->m_general_fd;
+		pfd[2].events = POLLIN;
+
+		if (poll(pfd, 3, timeout_ms > 0 ? timeout_ms : 0) < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+			break;
+		}
+		if (pfd[0].revents) {
+			break;
+		}
+		if (pfd[1].revents & POLLIN) {
+			master->handleEvent();
+		}
+		if (pfd[1].revents & POLLERR) {
+			master->dropTxTimestamps();
+		}
+		if (pfd[2].revents & POLLIN) {
+			// Nothing to answer on the general port, drain it
+			uint8_t buf[256];
+			while (recv(master->m_general_fd, buf, sizeof(buf), 0) > 0) {}
+		}
+	}
+
+	return NULL;
+}
@@ -0,0 +1,103 @@
+#ifndef __PTP_MASTER_H__
+#define __PTP_MASTER_H__
+
+#include <cstdint>
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+#include <netinet/in.h>
+
+#include "tstamp.h"
+#include "time_scale.h"
+#include "latency_hist.h"
+
+#define PTP_EVENT_PORT 		319
+#define PTP_GENERAL_PORT 	320
+#define PTP_MCAST_ADDR 		"224.0.1.129"
+
+/* PTPv2 (IEEE 1588-2008) grandmaster over UDP/IPv4, two-step, E2E delay.
+ * Sync is timestamped by the kernel on transmit (SO_TIMESTAMPING, software)
+ * and Delay_Req on receive; the OS times are converted to TAI through
+ * TimeStamp::toUtc() and the leap second table (time_scale.h), the
+ * preciseOriginTimestamp of the Follow_Up is therefore GPS time even if the
+ * OS clock is off. The clock class in the
+ * Announce follows the status: 6 when valid, 7 in holdover, 248 otherwise.
+ *
+ * By default the messages go to the PTP multicast group. For tests on
+ * loopback or veth, dest_addr and the ports can point to a single client.
+ */
+class PtpMaster {
+
+public:
+
+	struct Config {
+		const char *bind_addr; 		// Local address, NULL for any
+		const char *dest_addr; 		// Multicast group or unicast client
+		uint16_t event_port; 		// Local ports
+		uint16_t general_port;
+		uint16_t dest_event_port; 	// Ports of the clients
+		uint16_t dest_general_port;
+		uint8_t domain;
+		int8_t log_sync_interval; 	// log2 s
+		int8_t log_announce_interval;
+		uint8_t priority1;
+		uint8_t priority2;
+		const char *iface; 			// MAC used for the clock identity
+
+		Config() : bind_addr(NULL), dest_addr(PTP_MCAST_ADDR), event_port(PTP_EVENT_PORT), general_port(PTP_GENERAL_PORT),
+			dest_event_port(PTP_EVENT_PORT), dest_general_port(PTP_GENERAL_PORT), domain(0), log_sync_interval(0),
+			log_announce_interval(1), priority1(128), priority2(128), iface("eth0") {}
+	};
+
+	explicit PtpMaster(TimeStamp &tstamp);
+	~PtpMaster();
+
+	int start(const Config &cfg = Config());
+	void stop();
+
+	uint64_t syncs() const { return m_syncs.load(std::memory_order_relaxed); }
+	uint64_t delayResps() const { return m_delay_resps.load(std::memory_order_relaxed); }
+	// Sync sent without a kernel transmit timestamp (user space time used)
+	uint64_t txFallbacks() const { return m_tx_fallbacks.load(std::memory_order_relaxed); }
+
+	// Kernel transmit timestamp of the Sync minus the time before sendto()
+	const LatencyHistogram &syncTxDelay() const { return m_tx_delay; }
+
+	// TAI time of an OS timestamp, returns the TimeStamp::toUtc() result
+	int toPtpTime(const struct timespec *os_ts, struct timespec *tai);
+
+private:
+
+	static void *threadFcn(void *ptr);
+
+	void sendSync();
+	void sendAnnounce();
+	void handleEvent();
+	int txTimestamp(struct timespec *ts);
+	void dropTxTimestamps();
+	int header(uint8_t *buf, int type, int len, uint16_t seq, int8_t log_interval);
+	int sendTo(int fd, const uint8_t *buf, int len, const struct sockaddr_in *to);
+
+	TimeStamp &m_tstamp;
+	Config m_cfg;
+
+	bool m_started;
+	int m_event_fd;
+	int m_general_fd;
+	int m_stop_fd;
+	pthread_t m_thread;
+
+	struct sockaddr_in m_dest_event;
+	struct sockaddr_in m_dest_general;
+	uint8_t m_clock_id[8];
+	uint16_t m_sync_seq;
+	uint16_t m_announce_seq;
+	uint32_t m_tx_id; // OPT_ID expected for the next Sync
+
+	std::atomic<uint64_t> m_syncs;
+	std::atomic<uint64_t> m_delay_resps;
+	std::atomic<uint64_t> m_tx_fallbacks;
+	LatencyHistogram m_tx_delay;
+};
+
+#endif /* __PTP_MASTER_H__ */
@@ -0,0 +1,205 @@
+#include <cstdio>
+#include <cmath>
+
+#include "sample_clock.h"
+#include "tstamp.h"
+
+SampleClock::SampleClock(double nominal_hz, int width_bits) {
+	m_nominal_hz = nominal_hz;
+	m_width = width_bits < 64 ? width_bits : 64;
+	m_mask = m_width < 64 ? (1ULL << m_width) - 1 : ~0ULL;
+	m_ts = NULL;
+	m_sub_id = -1;
+	m_reader = NULL;
+	m_reader_arg = NULL;
+	reset();
+}
+
+SampleClock::~SampleClock() {
+	detach();
+}
+
+void SampleClock::reset() {
+	m_edges = 0;
+	m_last_raw = 0;
+	m_last_unwrapped = 0;
+	m_rejected = 0;
+	Model model;
+	memset(&model, 0, sizeof(model));
+	m_model.store(model);
+}
+
+// Signed distance in counts from anchor to count, modulo the counter width
+int64_t SampleClock::delta(uint64_t count, uint64_t anchor) const {
+	uint64_t d = (count - anchor) & m_mask;
+	if (m_width < 64 && (d >> (m_width - 1))) {
+		d |= ~m_mask; // Sign extension
+	}
+	return (int64_t)d;
+}
+
+void sampleClockEpoch(const TimeEvent *ev, void *arg) {
+	SampleClock *clk = static_cast<SampleClock*>(arg);
+
+	struct timespec utc;
+	if (clk->m_ts->toUtc(&ev->edge, &utc) != TimeStamp::TS_VALID) {
+		return;
+	}
+	uint64_t count;
+	if (clk->m_reader(clk->m_reader_arg, utc.tv_sec, &count) < 0) {
+		return;
+	}
+	clk->addEdge(count, utc.tv_sec);
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Subscribe to the labelled PPS epochs of ts
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int SampleClock::attach(TimeStamp &ts, SampleCounterReader reader, void *arg) {
+
+	if (m_sub_id >= 0 || reader == NULL) {
+		fprintf(stderr, "SampleClock::attach: Error: already attached or no reader\n");
+		return -1;
+	}
+
+	m_ts = &ts;
+	m_reader = reader;
+	m_reader_arg = arg;
+	m_sub_id = ts.subscribe(TEV_EPOCH, sampleClockEpoch, this);
+	if (m_sub_id < 0) {
+		fprintf(stderr, "SampleClock::attach: Error: subscribe failed\n");
+		m_ts = NULL;
+		return -1;
+	}
+
+	return 0;
+}
+
+void SampleClock::detach() {
+	if (m_sub_id >= 0) {
+		m_ts->unsubscribe(m_sub_id);
+		m_sub_id = -1;
+		m_ts = NULL;
+	}
+}
+
+void SampleClock::addEdge(uint64_t count, int64_t utc_sec) {
+
+	count &= m_mask;
+
+	// Unwrap against the previous edge, then check against the prediction
+	uint64_t unwrapped = count;
+	if (m_edges > 0) {
+		unwrapped = m_last_unwrapped + delta(count, m_last_raw);
+		int64_t dsec = utc_sec - m_secs[(m_edges - 1) % SAMPLE_CLOCK_WINDOW];
+		Model model;
+		m_model.load(&model);
+		double rate = model.valid ? model.rate_hz : m_nominal_hz;
+		double err = (double)(int64_t)(unwrapped - m_last_unwrapped) - dsec * rate;
+		if (dsec <= 0 || fabs(err) > dsec * m_nominal_hz * SAMPLE_CLOCK_MAX_ERR_PPM * 1e-6) {
+			m_rejected++;
+			m_edges = 0; // Restart the fit from this edge
+			unwrapped = count;
+		}
+	}
+
+	m_counts[m_edges % SAMPLE_CLOCK_WINDOW] = unwrapped;
+	m_secs[m_edges % SAMPLE_CLOCK_WINDOW] = utc_sec;
+	m_edges++;
+	m_last_raw = count;
+	m_last_unwrapped = unwrapped;
+
+	Model model;
+	memset(&model, 0, sizeof(model));
+	model.count = count;
+	model.sec = utc_sec;
+	model.rate_hz = m_nominal_hz;
+
+	// Least squares rate, relative to the anchor to keep the doubles small
+	uint32_t n = m_edges < SAMPLE_CLOCK_WINDOW ? m_edges : SAMPLE_CLOCK_WINDOW;
+	if (n >= 2) {
+		double sx = 0, sy = 0, sxx = 0, sxy = 0;
+		for (uint32_t i = 0; i < n; i++) {
+			double x = (double)(m_secs[i] - utc_sec);
+			double y = (double)(int64_t)(m_counts[i] - unwrapped);
+			sx += x;
+			sy += y;
+			sxx += x * x;
+			sxy += x * y;
+		}
+		double den = n * sxx - sx * sx;
+		if (den > 0) {
+			model.rate_hz = (n * sxy - sx * sy) / den;
+			double icept = (sy - model.rate_hz * sx) / n;
+			double ss = 0;
+			for (uint32_t i = 0; i < n; i++) {
+				double x = (double)(m_secs[i] - utc_sec);
+				double r = (double)(int64_t)(m_counts[i] - unwrapped) - (icept + model.rate_hz * x);
+				ss += r * r;
+			}
+			model.residual_ns = sqrt(ss / n) * 1e9 / model.rate_hz;
+		}
+	}
+	model.ns_per_count = 1e9 / model.rate_hz;
+	model.valid = true;
+	m_model.store(model);
+}
+
+int SampleClock::toUtc(uint64_t count, struct timespec *utc) const {
+
+	Model model;
+	m_model.load(&model);
+	if (!model.valid) {
+		return -1;
+	}
+
+	int64_t ns = (int64_t)llround((double)delta(count, model.count) * model.ns_per_count);
+	int64_t sec = ns / 1000000000;
+	ns -= sec * 1000000000;
+	if (ns < 0) {
+		ns += 1000000000;
+		sec--;
+	}
+	utc->tv_sec = model.sec + sec;
+	utc->tv_nsec = ns;
+	return 0;
+}
+
+int SampleClock::toUtcBulk(uint64_t first, uint32_t n, uint32_t step, int64_t *utc_ns) const {
+
+	Model model;
+	m_model.load(&model);
+	if (!model.valid) {
+		return -1;
+	}
+
+	// One delta for the buffer, then a multiply-add per sample
+	int64_t base = model.sec * 1000000000LL;
+	double t = (double)delta(first, model.count) * model.ns_per_count;
+	double dt = (double)step * model.ns_per_count;
+	for (uint32_t i = 0; i < n; i++) {
+		utc_ns[i] = base + (int64_t)llround(t + i * dt);
+	}
+	return 0;
+}
+
+bool SampleClock::valid() const {
+	Model model;
+	m_model.load(&model);
+	return model.valid;
+}
+
+double SampleClock::rateHz() const {
+	Model model;
+	m_model.load(&model);
+	return model.rate_hz;
+}
+
+double SampleClock::residualNs() const {
+	Model model;
+	m_model.load(&model);
+	return model.residual_ns;
+}
@@ -0,0 +1,102 @@
+#ifndef __SAMPLE_CLOCK_H__
+#define __SAMPLE_CLOCK_H__
+
+#include <cstdint>
+#include <time.h>
+
+#include "seqlock.h"
+#include "tstamp_notify.h"
+
+class TimeStamp;
+
+void sampleClockEpoch(const TimeEvent *ev, void *arg);
+
+#define SAMPLE_CLOCK_HZ 		125000000.0 	// ADC sample clock of the Red Pitaya
+#define SAMPLE_CLOCK_WINDOW 	16 				// Edges in the rate fit
+
+// A latched count further than this from the model prediction restarts the
+// fit: counter reset, FPGA reload or a missed latch.
+#define SAMPLE_CLOCK_MAX_ERR_PPM 	1000.0
+
+// Reads the sample counter latched by the FPGA on the PPS edge of UTC second
+// utc_sec. Returns 0 and the count, -1 if the latch does not belong to that
+// edge (e.g. not updated yet).
+typedef int (*SampleCounterReader)(void *arg, int64_t utc_sec, uint64_t *count);
+
+/* Linear model from the free-running FPGA sample counter to UTC.
+ * Each labelled PPS epoch pairs the counter latched on the edge with its
+ * UTC second; the counter rate is fitted over the last SAMPLE_CLOCK_WINDOW
+ * edges and the last edge anchors the model. Sample indexes of a whole DAQ
+ * buffer are then converted without reading the OS clock, so the read-out
+ * latency of the buffer does not enter the timestamps.
+ *
+ * Counters narrower than 64 bits are unwrapped against the anchor, which
+ * covers +-2^(width-1) counts around the last edge (17 s for 32 bits at
+ * 125 MHz). The model is published through a seqlock: addEdge() has one
+ * writer (the GGA thread when attached), conversions run on any thread.
+ */
+class SampleClock {
+
+public:
+
+	SampleClock(double nominal_hz = SAMPLE_CLOCK_HZ, int width_bits = 64);
+	~SampleClock();
+
+	void reset();
+
+	// Feed the model from the TEV_EPOCH events of ts, reading the latched
+	// counter with reader. Returns 0 on success, -1 on failure.
+	int attach(TimeStamp &ts, SampleCounterReader reader, void *arg);
+	void detach();
+
+	// Pair a latched count with the UTC second of its PPS edge.
+	void addEdge(uint64_t count, int64_t utc_sec);
+
+	// UTC time of a count. Returns 0 on success, -1 if no model yet.
+	int toUtc(uint64_t count, struct timespec *utc) const;
+
+	// UTC ns of the counts first, first + step, ... (n values), e.g. the
+	// samples of a decimated buffer. Returns 0 on success, -1 if no model yet.
+	int toUtcBulk(uint64_t first, uint32_t n, uint32_t step, int64_t *utc_ns) const;
+
+	bool valid() const;
+	double rateHz() const; 		// Fitted counter rate
+	double residualNs() const; 	// RMS residual of the fit
+	uint32_t rejected() const { return m_rejected; }
+
+	friend void sampleClockEpoch(const TimeEvent *ev, void *arg);
+
+private:
+
+	typedef struct {
+		bool valid;
+		uint64_t count; 	// Anchor: count latched on the last edge (raw)
+		int64_t sec; 		// UTC second of the anchor
+		double ns_per_count;
+		double rate_hz;
+		double residual_ns;
+	} Model;
+
+	double m_nominal_hz;
+	uint64_t m_mask;
+	int m_width;
+
+	// Fit window, written by addEdge() only
+	uint64_t m_counts[SAMPLE_CLOCK_WINDOW]; // Unwrapped
+	int64_t m_secs[SAMPLE_CLOCK_WINDOW];
+	uint32_t m_edges;
+	uint64_t m_last_raw;
+	uint64_t m_last_unwrapped;
+	uint32_t m_rejected;
+
+	SeqLock<Model> m_model;
+
+	TimeStamp *m_ts;
+	int m_sub_id;
+	SampleCounterReader m_reader;
+	void *m_reader_arg;
+
+	int64_t delta(uint64_t count, uint64_t anchor) const;
+};
+
+#endif /* __SAMPLE_CLOCK_H__ */
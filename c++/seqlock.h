@@ -0,0 +1,43 @@
+#ifndef __SEQLOCK_H__
+#define __SEQLOCK_H__
+
+#include <cstdint>
+#include <cstring>
+#include <atomic>
+
+/* Single writer sequence lock for small trivially copyable values.
+ * The writer never blocks, readers retry while a store is in progress.
+ */
+template <typename T>
+class SeqLock {
+
+public:
+
+	SeqLock() : m_seq(0) {
+		memset(&m_val, 0, sizeof(m_val));
+	}
+
+	void store(const T &val) {
+		uint32_t seq = m_seq.load(std::memory_order_relaxed);
+		m_seq.store(seq + 1, std::memory_order_relaxed);
+		std::atomic_thread_fence(std::memory_order_release);
+		memcpy(&m_val, &val, sizeof(m_val));
+		m_seq.store(seq + 2, std::memory_order_release);
+	}
+
+	void load(T *val) const {
+		uint32_t seq;
+		do {
+			seq = m_seq.load(std::memory_order_acquire);
+			memcpy(val, &m_val, sizeof(m_val));
+			std::atomic_thread_fence(std::memory_order_acquire);
+		} while ((seq & 1) || seq != m_seq.load(std::memory_order_relaxed));
+	}
+
+private:
+
+	std::atomic<uint32_t> m_seq;
+	T m_val;
+};
+
+#endif /* __SEQLOCK_H__ */
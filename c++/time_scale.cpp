@@ -0,0 +1,336 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <pthread.h>
+#include <atomic>
+
+#include "time_scale.h"
+#include "seqlock.h"
+#include "tstamp_log.h"
+
+#define NTP_UNIX_OFFSET 	2208988800LL 	// leap-seconds.list counts from 1900
+
+// Leap seconds up to the 2017-01-01 one, used until a file or the receiver
+// provides a newer table. IERS Bulletin C: no leap second before the end of
+// 2026, hence the expiry.
+static const leap_entry_t g_leap_builtin[] = {
+	{   63072000, 10 }, {   78796800, 11 }, {   94694400, 12 }, {  126230400, 13 },
+	{  157766400, 14 }, {  189302400, 15 }, {  220924800, 16 }, {  252460800, 17 },
+	{  283996800, 18 }, {  315532800, 19 }, {  362793600, 20 }, {  394329600, 21 },
+	{  425865600, 22 }, {  489024000, 23 }, {  567993600, 24 }, {  631152000, 25 },
+	{  662688000, 26 }, {  709948800, 27 }, {  741484800, 28 }, {  773020800, 29 },
+	{  820454400, 30 }, {  867715200, 31 }, {  915148800, 32 }, { 1136073600, 33 },
+	{ 1230768000, 34 }, { 1341100800, 35 }, { 1435708800, 36 }, { 1483228800, 37 },
+};
+#define LEAP_BUILTIN_EXPIRES 	1798416000 	// 2026-12-28
+
+typedef struct {
+	uint32_t count;
+	int64_t expires; 	// UTC second, 0 if unknown
+	leap_entry_t e[TIME_SCALE_MAX_LEAPS];
+} leap_table_t;
+
+// Offset valid in [from, until), covers the present after each install
+typedef struct {
+	int64_t from;
+	int64_t until;
+	int32_t tai_utc;
+	int32_t next_step; 	// TAI - UTC change at until, 0 if none known
+} leap_cache_t;
+
+static leap_table_t g_leap_table = {
+	sizeof(g_leap_builtin) / sizeof(g_leap_builtin[0]), LEAP_BUILTIN_EXPIRES, {}
+};
+static bool g_leap_init = false;
+static SeqLock<leap_table_t> g_leap_published;
+static SeqLock<leap_cache_t> g_leap_cache;
+static pthread_mutex_t g_leap_lock = PTHREAD_MUTEX_INITIALIZER; // Writers
+static std::atomic<int64_t> g_leap_now(0); // Last GPS labelled UTC second, 0 if none
+
+static int32_t table_lookup(const leap_table_t *t, int64_t utc_sec, int64_t *from, int64_t *until, int32_t *next_step) {
+
+	// Last entry with utc_sec >= e.utc_sec
+	int lo = 0, hi = (int)t->count - 1, idx = -1;
+	while (lo <= hi) {
+		int mid = (lo + hi) / 2;
+		if (t->e[mid].utc_sec <= utc_sec) {
+			idx = mid;
+			lo = mid + 1;
+		} else {
+			hi = mid - 1;
+		}
+	}
+	int32_t off = idx >= 0 ? t->e[idx].tai_utc : t->e[0].tai_utc;
+	*from = idx >= 0 ? t->e[idx].utc_sec : INT64_MIN;
+	if (idx + 1 < (int)t->count) {
+		*until = t->e[idx + 1].utc_sec;
+		*next_step = t->e[idx + 1].tai_utc - off;
+	} else {
+		*until = INT64_MAX;
+		*next_step = 0;
+	}
+	return off;
+}
+
+// The present: the GPS labelled time once known, the OS clock may be wrong
+static int64_t present(void) {
+	int64_t now = g_leap_now.load(std::memory_order_relaxed);
+	return now != 0 ? now : (int64_t)time(NULL);
+}
+
+// Publish the cache around utc_sec, under g_leap_lock
+static void centre(int64_t utc_sec) {
+	leap_cache_t cache;
+	cache.tai_utc = table_lookup(&g_leap_table, utc_sec, &cache.from, &cache.until, &cache.next_step);
+	g_leap_cache.store(cache);
+}
+
+// Publish the table and the cache around the present, under g_leap_lock
+static void install(void) {
+
+	for (uint32_t i = g_leap_table.count; i < TIME_SCALE_MAX_LEAPS; i++) {
+		memset(&g_leap_table.e[i], 0, sizeof(g_leap_table.e[i]));
+	}
+	if (!g_leap_init) {
+		memcpy(g_leap_table.e, g_leap_builtin, sizeof(g_leap_builtin));
+		g_leap_init = true;
+	}
+	g_leap_published.store(g_leap_table);
+	centre(present());
+}
+
+// Move the cache forward to utc_sec once past its end, unless a writer holds
+// the lock: the lookups never wait, the next one retries
+static void advance(int64_t utc_sec) {
+	if (pthread_mutex_trylock(&g_leap_lock) != 0) {
+		return;
+	}
+	leap_cache_t cache;
+	g_leap_cache.load(&cache);
+	if (utc_sec >= cache.until) {
+		centre(utc_sec);
+	}
+	pthread_mutex_unlock(&g_leap_lock);
+}
+
+static void ensure_init(void) {
+	static pthread_once_t once = PTHREAD_ONCE_INIT;
+	pthread_once(&once, []() {
+		pthread_mutex_lock(&g_leap_lock);
+		install();
+		pthread_mutex_unlock(&g_leap_lock);
+	});
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Load the leap second table from an IERS/IETF leap-seconds.list file
+ *
+ * Data lines are "<NTP seconds> <TAI - UTC>", "#@ <NTP seconds>" is the expiry.
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error message is printed on standard error
+ *--------------------------------------------------------------------------------------*/
+int time_scale_load(const char *path) {
+
+	ensure_init();
+
+	FILE *f = fopen(path, "r");
+	if (f == NULL) {
+		fprintf(stderr, "time_scale_load: Error: cannot open %s\n", path);
+		return -1;
+	}
+
+	leap_table_t t;
+	memset(&t, 0, sizeof(t));
+	char line[256];
+	while (fgets(line, sizeof(line), f) != NULL) {
+		long long ntp;
+		int off;
+		if (strncmp(line, "#@", 2) == 0) {
+			if (sscanf(line + 2, "%lld", &ntp) == 1) {
+				t.expires = ntp - NTP_UNIX_OFFSET;
+			}
+		} else if (line[0] != '#' && sscanf(line, "%lld %d", &ntp, &off) == 2) {
+			if (t.count >= TIME_SCALE_MAX_LEAPS || (t.count > 0 && ntp - NTP_UNIX_OFFSET <= t.e[t.count - 1].utc_sec)) {
+				fprintf(stderr, "time_scale_load: Error: %s: table too long or not sorted\n", path);
+				fclose(f);
+				return -1;
+			}
+			t.e[t.count].utc_sec = ntp - NTP_UNIX_OFFSET;
+			t.e[t.count].tai_utc = off;
+			t.count++;
+		}
+	}
+	fclose(f);
+
+	if (t.count == 0) {
+		fprintf(stderr, "time_scale_load: Error: %s: no leap second entries\n", path);
+		return -1;
+	}
+
+	pthread_mutex_lock(&g_leap_lock);
+	g_leap_table = t;
+	install();
+	pthread_mutex_unlock(&g_leap_lock);
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Update the table from the receiver leap second data (e.g. UBX-NAV-TIMELS or the
+ * GPS almanac): the current TAI - UTC and, if announced, the next change. The
+ * table is only extended, the past entries are kept.
+ *
+ * @retval  0 Success
+ * @retval -1 Inconsistent with the table, logged (TL_LEAP_MISMATCH)
+ *--------------------------------------------------------------------------------------*/
+int time_scale_update(int32_t tai_utc_now, int64_t next_leap_utc, int32_t next_tai_utc) {
+
+	ensure_init();
+
+	pthread_mutex_lock(&g_leap_lock);
+
+	int64_t now = present();
+	int64_t from, until;
+	int32_t step;
+	int32_t current = table_lookup(&g_leap_table, now, &from, &until, &step);
+	if (current != tai_utc_now) {
+		// Missing entries between the table end and now: the change is dated now
+		if (tai_utc_now < current || g_leap_table.count >= TIME_SCALE_MAX_LEAPS || until != INT64_MAX) {
+			pthread_mutex_unlock(&g_leap_lock);
+			tstamp_log(TL_LEAP_MISMATCH, tai_utc_now, current);
+			return -1;
+		}
+		g_leap_table.e[g_leap_table.count].utc_sec = now;
+		g_leap_table.e[g_leap_table.count].tai_utc = tai_utc_now;
+		g_leap_table.count++;
+	}
+
+	if (next_leap_utc > now && next_tai_utc != tai_utc_now) {
+		leap_entry_t *last = &g_leap_table.e[g_leap_table.count - 1];
+		if (last->utc_sec == next_leap_utc) {
+			last->tai_utc = next_tai_utc;
+		} else if (last->utc_sec < next_leap_utc && g_leap_table.count < TIME_SCALE_MAX_LEAPS) {
+			g_leap_table.e[g_leap_table.count].utc_sec = next_leap_utc;
+			g_leap_table.e[g_leap_table.count].tai_utc = next_tai_utc;
+			g_leap_table.count++;
+		}
+	}
+	if (g_leap_table.expires < now) {
+		g_leap_table.expires = 0; // Receiver data, no expiry given
+	}
+
+	install();
+	pthread_mutex_unlock(&g_leap_lock);
+
+	return 0;
+}
+
+// Centre the O(1) lookups on the GPS labelled UTC second utc_sec, called on
+// each label. Lock-free while utc_sec stays in the cached interval.
+void time_scale_recentre(int64_t utc_sec) {
+
+	ensure_init();
+
+	g_leap_now.store(utc_sec, std::memory_order_relaxed);
+	leap_cache_t cache;
+	g_leap_cache.load(&cache);
+	if (utc_sec >= cache.from && utc_sec < cache.until) {
+		return;
+	}
+	pthread_mutex_lock(&g_leap_lock);
+	centre(utc_sec);
+	pthread_mutex_unlock(&g_leap_lock);
+}
+
+// Expiry of the table (UTC second), 0 if unknown
+int64_t time_scale_expires(void) {
+	ensure_init();
+	leap_table_t t;
+	g_leap_published.load(&t);
+	return t.expires;
+}
+
+// TAI - UTC at a UTC second. O(1) around the present, a binary search otherwise.
+int32_t time_scale_tai_utc(int64_t utc_sec) {
+
+	ensure_init();
+
+	leap_cache_t cache;
+	g_leap_cache.load(&cache);
+	if (utc_sec >= cache.from && utc_sec < cache.until) {
+		return cache.tai_utc;
+	}
+	if (utc_sec >= cache.until) {
+		advance(utc_sec);
+	}
+
+	leap_table_t t;
+	g_leap_published.load(&t);
+	int64_t from, until;
+	int32_t step;
+	return table_lookup(&t, utc_sec, &from, &until, &step);
+}
+
+// +1 (or -1) if the UTC day of utc_sec ends with an inserted (deleted) second
+int time_scale_leap_pending(int64_t utc_sec) {
+
+	ensure_init();
+
+	leap_cache_t cache;
+	g_leap_cache.load(&cache);
+	if (utc_sec < cache.from || utc_sec >= cache.until) {
+		if (utc_sec >= cache.until) {
+			advance(utc_sec);
+		}
+		leap_table_t t;
+		g_leap_published.load(&t);
+		table_lookup(&t, utc_sec, &cache.from, &cache.until, &cache.next_step);
+	}
+	if (cache.next_step != 0 && cache.until != INT64_MAX && cache.until - utc_sec <= 86400) {
+		return cache.next_step > 0 ? 1 : -1;
+	}
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Convert a time between UTC, TAI and GPS (TimeScaleId)
+ *
+ * @retval  0 Success
+ * @retval -1 Unknown time scale
+ *--------------------------------------------------------------------------------------*/
+int time_scale_convert(const struct timespec *in, int from, int to, struct timespec *out) {
+
+	// To TAI
+	int64_t tai;
+	switch (from) {
+	case TSCALE_UTC: tai = (int64_t)in->tv_sec + time_scale_tai_utc(in->tv_sec); break;
+	case TSCALE_TAI: tai = (int64_t)in->tv_sec; break;
+	case TSCALE_GPS: tai = (int64_t)in->tv_sec + GPS_EPOCH_UNIX + TAI_GPS_OFFSET; break;
+	default: return -1;
+	}
+
+	int64_t sec;
+	switch (to) {
+	case TSCALE_UTC: {
+		// The offset is that of the UTC second, found from a first guess
+		int32_t off = time_scale_tai_utc(tai - time_scale_tai_utc(tai));
+		sec = tai - off;
+		break;
+	}
+	case TSCALE_TAI: sec = tai; break;
+	case TSCALE_GPS: sec = tai - TAI_GPS_OFFSET - GPS_EPOCH_UNIX; break;
+	default: return -1;
+	}
+
+	out->tv_sec = (time_t)sec;
+	out->tv_nsec = in->tv_nsec;
+	return 0;
+}
+
+// GPS week (not rolled over) and time of week of a GPS time
+void time_scale_gps_week(const struct timespec *gps, uint32_t *week, uint64_t *tow_ns) {
+	int64_t sec = (int64_t)gps->tv_sec;
+	*week = (uint32_t)(sec / GPS_WEEK_SEC);
+	*tow_ns = (uint64_t)(sec % GPS_WEEK_SEC) * 1000000000ULL + gps->tv_nsec;
+}
@@ -0,0 +1,39 @@
+#ifndef __TIME_SCALE_H__
+#define __TIME_SCALE_H__
+
+#include <cstdint>
+#include <time.h>
+
+#define TIME_SCALE_MAX_LEAPS 	64
+
+#define GPS_EPOCH_UNIX 			315964800 	// 1980-01-06T00:00:00Z
+#define TAI_GPS_OFFSET 			19 			// TAI - GPS (s), constant
+#define GPS_WEEK_SEC 			604800
+
+// Time scales of time_scale_convert(). UTC and TAI count from 1970-01-01
+// (TAI as CLOCK_TAI and PTP do), GPS from the GPS epoch, so that the GPS
+// week and time of week follow directly.
+enum TimeScaleId {
+	TSCALE_UTC = 0,
+	TSCALE_TAI,
+	TSCALE_GPS,
+};
+
+// From UTC second utc_sec on, TAI - UTC = tai_utc
+typedef struct {
+	int64_t utc_sec;
+	int32_t tai_utc;
+} leap_entry_t;
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+int time_scale_load(const char *path);
+int time_scale_update(int32_t tai_utc_now, int64_t next_leap_utc, int32_t next_tai_utc);
+int64_t time_scale_expires(void);
+void time_scale_recentre(int64_t utc_sec);
+
+int32_t time_scale_tai_utc(int64_t utc_sec);
+int time_scale_leap_pending(int64_t utc_sec);
+int time_scale_convert(const struct timespec *in, int from, int to, struct timespec *out);
+void time_scale_gps_week(const struct timespec *gps, uint32_t *week, uint64_t *tow_ns);
+
+#endif /* __TIME_SCALE_H__ */
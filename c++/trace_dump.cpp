@@ -0,0 +1,125 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <algorithm>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#include "tstamp_trace.h"
+
+// Decode the tracepoint rings written with TRACEON into a single timeline.
+//
+//	trace_dump /tmp/tstamp-trace.<pid>.*
+
+struct Event {
+	uint32_t tid;
+	trace_record_t rec;
+};
+
+static const char *trace_name(uint16_t id) {
+	switch (id) {
+		case TP_PPS_EDGE: 	return "PPS_EDGE";
+		case TP_PPS_MISS: 	return "PPS_MISS";
+		case TP_GGA_PARSE: 	return "GGA_PARSE";
+		case TP_FLAGS: 		return "FLAGS";
+		case TP_READ: 		return "READ";
+		case TP_PPS_REJECT: return "PPS_REJECT";
+		default: 			return "?";
+	}
+}
+
+static int load_ring(const char *path, std::vector<Event> &events) {
+
+	int fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		fprintf(stderr, "%s: cannot open\n", path);
+		return -1;
+	}
+	struct stat st;
+	if (fstat(fd, &st) < 0 || (size_t)st.st_size < sizeof(trace_ring_hdr_t)) {
+		close(fd);
+		return -1;
+	}
+	void *p = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		return -1;
+	}
+
+	const trace_ring_hdr_t *hdr = (const trace_ring_hdr_t *)p;
+	if (hdr->magic != TSTAMP_TRACE_MAGIC || hdr->version != TSTAMP_TRACE_VERSION || hdr->rec_size != sizeof(trace_record_t)
+		|| sizeof(*hdr) + (size_t)hdr->capacity * sizeof(trace_record_t) > (size_t)st.st_size) {
+		fprintf(stderr, "%s: not a trace ring\n", path);
+		munmap(p, st.st_size);
+		return -1;
+	}
+
+	uint64_t head = __atomic_load_n(&hdr->head, __ATOMIC_ACQUIRE);
+	uint64_t first = head > hdr->capacity ? head - hdr->capacity : 0;
+	const trace_record_t *recs = (const trace_record_t *)(hdr + 1);
+	for (uint64_t i = first; i < head; i++) {
+		Event ev;
+		ev.tid = hdr->tid;
+		ev.rec = recs[i % hdr->capacity];
+		if (ev.rec.seq == (uint32_t)i) { // Skip records overwritten while reading
+			events.push_back(ev);
+		}
+	}
+
+	munmap(p, st.st_size);
+	return 0;
+}
+
+static bool by_time(const Event &a, const Event &b) {
+	return a.rec.ts_ns < b.rec.ts_ns;
+}
+
+int main(int argc, char **argv) {
+
+	if (argc < 2) {
+		fprintf(stderr, "usage: %s <trace ring>...\n", argv[0]);
+		return EXIT_FAILURE;
+	}
+
+	std::vector<Event> events;
+	for (int i = 1; i < argc; i++) {
+		load_ring(argv[i], events);
+	}
+	std::sort(events.begin(), events.end(), by_time);
+
+	uint64_t t0 = events.empty() ? 0 : events[0].rec.ts_ns;
+	for (size_t i = 0; i < events.size(); i++) {
+		const trace_record_t &r = events[i].rec;
+		printf("%14.6f us  tid %-6u %-10s", (r.ts_ns - t0) / 1e3, events[i].tid, trace_name(r.id));
+		switch (r.id) {
+			case TP_PPS_EDGE:
+				printf(" edge %llu.%09llu iterations %llu\n", (unsigned long long)(r.a / 1000000000ULL),
+					(unsigned long long)(r.a % 1000000000ULL), (unsigned long long)r.b);
+				break;
+			case TP_PPS_MISS:
+				printf(" iterations %llu\n", (unsigned long long)r.a);
+				break;
+			case TP_GGA_PARSE:
+				printf(" delay %llu ns label %02llu:%02llu:%02llu\n", (unsigned long long)r.a,
+					(unsigned long long)(r.b / 3600), (unsigned long long)(r.b / 60 % 60), (unsigned long long)(r.b % 60));
+				break;
+			case TP_FLAGS:
+				printf(" 0x%02llX -> 0x%02llX\n", (unsigned long long)r.a, (unsigned long long)r.b);
+				break;
+			case TP_READ:
+				printf(" status 0x%02llX duration %llu ns\n", (unsigned long long)r.a, (unsigned long long)r.b);
+				break;
+			case TP_PPS_REJECT:
+				printf(" residual %lld ns rejected %llu\n", (long long)r.a, (unsigned long long)r.b);
+				break;
+			default:
+				printf(" %llu %llu\n", (unsigned long long)r.a, (unsigned long long)r.b);
+				break;
+		}
+	}
+
+	return EXIT_SUCCESS;
+}
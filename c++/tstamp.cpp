@@ -1,16 +1,27 @@
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
+#include <cmath>
 #include <time.h>
 #include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sched.h>
+#include <sys/eventfd.h>
 
 #include "hk_fpga.h"
 #include "uart.h"
+#include "nmea.h"
 
 #include "tstamp.h"
-
-#define TH_MINUTES 20
+#include "tstamp_acq.h"
+#include "tstamp_trace.h"
+#include "tstamp_log.h"
 
 static struct timespec m_pps_ts;
+static uint32_t m_pps_unc_ns = 0; // +- bound of m_pps_ts
+static uint64_t m_pps_count = 0; // hw_counter_read() of the edge, Options::hw_counter only
+static bool m_pps_count_kept = false; // m_pps_count is that of the edge kept by pps_gate()
 static struct timespec m_gga_ts;
 
 static struct timespec m_tstamp_ts;
@@ -18,8 +29,18 @@ static int m_tstamp_hh = 0;
 static int m_tstamp_mm = 0;
 static int m_tstamp_ss = 0;
 static int m_tstamp_us = 0;
+static uint32_t m_tstamp_unc_ns = 0;
+static uint8_t m_tstamp_fix = NMEA_FIX_UNKNOWN; // Fix fields of the labelling GGA
+static uint8_t m_tstamp_sats = NMEA_SATS_UNKNOWN;
+static uint16_t m_tstamp_hdop = NMEA_HDOP_UNKNOWN;
+
+// Relation between the GGA label and the OS clock, kept for the state file
+static bool m_label_valid = false;
+static int m_label_offset = 0;
+static uint8_t m_label_talker = 0;
+static uint32_t m_gga_delay_ns = 0;
 
-pthread_mutex_t m_tstamp_lock;
+static pthread_mutex_t m_tstamp_lock = PTHREAD_MUTEX_INITIALIZER;
 
 static inline uint32_t delta_nsec(const struct timespec *t1, const struct timespec *t0) {
 	uint32_t dsec = t1->tv_sec - t0->tv_sec;
@@ -49,234 +70,749 @@ static inline void delta_time(const struct timespec *t1, const struct timespec *
 	}
 }
 
-inline int TimeStamp::pps_wait() {
-	int count = 0;
-	uint32_t state, old_state = 0x0000 ;
-	for(int i = 0; i < 150000; i++) {
-		state = g_hk_fpga_reg_mem->in_p & HK_FPGA_GPIO_BIT7;
-		if ( state != old_state ) {
-			old_state = state;
-			if (i > 0) { //If PPS does not change from 1, then PPS is not active
-				clock_gettime(CLOCK_REALTIME, &m_pps_ts);
-				return 0;
-			}	
-		} else {
-			count++;
-			usleep(5);
-		}
+static inline uint64_t monotonic_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static inline uint64_t timespec_delta_ns(const struct timespec *t1, const struct timespec *t0) {
+	int64_t d = (int64_t)(t1->tv_sec - t0->tv_sec) * 1000000000LL + (t1->tv_nsec - t0->tv_nsec);
+	return d > 0 ? (uint64_t)d : 0;
+}
+
+// Edge from the PPS source (tstamp_acq.h): kernel PPS, or the FPGA poll
+// timed by the OS clock or by the CPU counter
+void TimeStamp::onEdge(const PpsEdge *edge) {
+
+	m_pps_ts = edge->ts;
+	m_pps_unc_ns = edge->unc_ns;
+	if (m_hw_counter) {
+		m_pps_count = edge->ticks;
+		m_pps_count_kept = true;
+	}
+	m_latency[LAT_PPS_WAIT].record(edge->waited_ns);
+	if (!m_pps_dev) {
+		m_latency[LAT_PPS_BRACKET].record(edge->bracket_ns);
+	}
+	TSTAMP_TRACE(TP_PPS_EDGE, (uint64_t)m_pps_ts.tv_sec * 1000000000ULL + m_pps_ts.tv_nsec, edge->polls);
+
+	if (m_warm_pending) {
+		warmStart();
+	}
+	if (pps_gate()) {
+		m_servo.update(&m_pps_ts, m_pps_unc_ns);
+	}
+	tstamp_log(TL_PPS_EDGE, m_pps_ts.tv_sec, m_pps_ts.tv_nsec, m_pps_unc_ns);
+	publishClockState();
+	if (++m_edge_count % TSTAMP_STATE_PERIOD == 0) {
+		saveState();
+	}
+}
+
+void TimeStamp::onPpsMiss(const PpsEdge *edge) {
+	TSTAMP_TRACE(TP_PPS_MISS, edge->polls, m_pps_dev ? 1 : 0);
+	tstamp_log(TL_PPS_MISS);
+}
+
+// Outlier gate against the servo prediction. A rejected edge (late wakeup
+// of the poll) is replaced by the prediction before the GGA thread pairs it.
+// Returns false for a rejected edge: it must not reach the servo, whose
+// jitter and sample count would take the prediction as a perfect edge.
+inline bool TimeStamp::pps_gate() {
+
+	if (!m_servo.locked() || !m_servo.hasEdge()) {
+		return true;
 	}
-	return -1;
+	const struct timespec &last = m_servo.lastEdge();
+	int64_t d = (int64_t)(m_pps_ts.tv_sec - last.tv_sec) * 1000000000LL + (m_pps_ts.tv_nsec - last.tv_nsec);
+	int64_t n = (d + 500000000LL) / 1000000000LL;
+	if (n < 1 || n > PPS_SERVO_MAX_GAP) {
+		return true;
+	}
+
+	struct timespec pred;
+	m_servo.predict(n, &pred);
+	int64_t resid = (int64_t)(m_pps_ts.tv_sec - pred.tv_sec) * 1000000000LL + (m_pps_ts.tv_nsec - pred.tv_nsec);
+	if (!m_filter.check((double)resid)) {
+		TSTAMP_TRACE(TP_PPS_REJECT, (uint64_t)resid, m_filter.rejected());
+		m_pps_ts = pred;
+		m_pps_unc_ns = (uint32_t)m_filter.gateNs();
+		m_pps_count_kept = false; // Counter of the late wakeup, not of the prediction
+		return false;
+	}
+	return true;
 }
 
 void *ppsAcqThreadFcn(void *ptr) {
 	TimeStamp* timestamp = static_cast<TimeStamp*>(ptr);
-	
-    timestamp->clearFlag(TimeStamp::TS_NOPPS);
+	TSTAMP_TRACE_THREAD_START();
+
+	// The source and the clock are picked once, each loop is compiled for its pair
+	typedef TimeStampAcq<TSTAMP_FLAG_POLICY> Acq;
+	if (timestamp->m_pps_dev) {
+		Acq::ppsLoop(timestamp, timestamp->m_pps_kernel, timestamp->m_clock);
+	} else if (timestamp->m_hw_counter) {
+		Acq::ppsLoop(timestamp, timestamp->m_pps_poll, timestamp->m_hw_clock);
+	} else {
+		Acq::ppsLoop(timestamp, timestamp->m_pps_poll, timestamp->m_clock);
+	}
 
-	sleep(1);
-    
-    for(;;) {
-        int res = timestamp->pps_wait();
-        if (res == 0) { // PPS found wait till the next one
-        	AUTO_CLEAR(timestamp, TimeStamp::TS_NOPPS);
-			// printf("PPS received\n");
-        	usleep(750000);
-        } else { // No signal/fix from PPS
-        	timestamp->raiseFlag(TimeStamp::TS_NOPPS);
-			// printf("PPS not received\n");
-        	sleep(1);
-        }
-    }
-    
-    // This point should never be reached
+	TSTAMP_TRACE_THREAD_STOP();
     return EXIT_SUCCESS;
 }
 
-inline void TimeStamp::gga_read() {
+// Pair the time label with the last PPS edge, from the GGA or from gpsd
+void TimeStamp::label_pair(const nmea_gga_t *gga) {
 
-	if (g_uart_nbytes < 17) {
-		return;
-	}
+	clock_gettime(CLOCK_REALTIME, &m_gga_ts);
 	
-	if (g_uart_buff[0] == '$') {
+	uint32_t dnsec = delta_nsec(&m_gga_ts, &m_pps_ts);
+	m_latency[LAT_GGA_DELAY].record(dnsec);
+
+	time_t rawtime;
+	struct tm *timeinfo;
+	time(&rawtime);
+	timeinfo = localtime(&rawtime);
+	int current_hour = timeinfo->tm_hour;
+	int current_minute = timeinfo->tm_min;
+
+	// Compare parsed time with system time
+	int minute_difference;
+	StatusFlags raise, clear;
+	if (TimeStampAcq<TSTAMP_FLAG_POLICY>::pairFlags(dnsec, gga->hh, gga->mm, current_hour, current_minute,
+		&minute_difference, &raise, &clear)) {
+		tstamp_log(TL_GGA_PAIRED, dnsec);
 		
-		if (g_uart_buff[1] == 'G') {
-		
-			if (g_uart_buff[2] == 'P' || g_uart_buff[2] == 'L' || g_uart_buff[2] == 'N') {
-				
-				if (g_uart_buff[3] == 'G') { // GGA
-				
-					if (g_uart_buff[4] == 'G') {
-					
-						if (g_uart_buff[5] == 'A') {
-						
-							clock_gettime(CLOCK_REALTIME, &m_gga_ts);
-							
-							uint32_t dnsec = delta_nsec(&m_gga_ts, &m_pps_ts);
-							if (dnsec < 1000000000) {
-								// printf("delta sec between current OS and PPS sampled time is lower than 1s: %u ns \n", dnsec);
-            				
-								AUTO_CLEAR(this, TimeStamp::TS_OVTIME);
-								pthread_mutex_lock(&m_tstamp_lock);
-
-								m_tstamp_ts.tv_sec = m_pps_ts.tv_sec;
-								m_tstamp_ts.tv_nsec = m_pps_ts.tv_nsec;
-
-								m_tstamp_hh = (uint32_t)(g_uart_buff[7]-'0')*10 + (uint32_t)(g_uart_buff[8]-'0');
-								m_tstamp_mm = (uint32_t)(g_uart_buff[9]-'0')*10 + (uint32_t)(g_uart_buff[10]-'0');
-								m_tstamp_ss = (uint32_t)(g_uart_buff[11]-'0')*10 + (uint32_t)(g_uart_buff[12]-'0');
-								m_tstamp_us = (uint32_t)(g_uart_buff[14]-'0')*100000 + (uint32_t)(g_uart_buff[15]-'0')*10000 + (uint32_t)(g_uart_buff[16]-'0');
-								
-								time_t rawtime;
-								struct tm *timeinfo;
-    							time(&rawtime);
-								timeinfo = localtime(&rawtime);
-								int current_hour = timeinfo->tm_hour;
-								int current_minute = timeinfo->tm_min;
-
-								// Compare parsed time with system time
-								int minute_difference = (m_tstamp_hh * 60 + m_tstamp_mm) - (current_hour * 60 + current_minute);
-								int threshold_minutes = TH_MINUTES;  // Set the threshold range of minutes
-								
-								if (abs(minute_difference) > threshold_minutes) {
-									// printf("Error: System time is not within %d minutes of GNGGA time: current %d:%d ; gps %d:%d\n", threshold_minutes, current_hour, current_minute, m_tstamp_hh, m_tstamp_mm );
-									raiseFlag(TimeStamp::TS_NOTIME);
-								} else {
-									// printf("System time is within %d minutes of GNGGA time. difference %d min\n", threshold_minutes, minute_difference);
-									AUTO_CLEAR(this, TimeStamp::TS_NOTIME);
-								}
-
-								pthread_mutex_unlock(&m_tstamp_lock);
-								
-							} 
-							else {
-								// printf("not checking time. delta sec between current OS and PPS sampled time is greater than 1s: %u ns \n", dnsec);
-								raiseFlag(TimeStamp::TS_OVTIME);
-								raiseFlag(TimeStamp::TS_NOTIME);
-							}
-							
-						}
-					
-					}
-					
-				}
-				
-			}
+		pthread_mutex_lock(&m_tstamp_lock);
+
+		m_tstamp_ts.tv_sec = m_pps_ts.tv_sec;
+		m_tstamp_ts.tv_nsec = m_pps_ts.tv_nsec;
+
+		m_tstamp_hh = gga->hh;
+		m_tstamp_mm = gga->mm;
+		m_tstamp_ss = gga->ss;
+		m_tstamp_us = gga->us;
+		m_tstamp_unc_ns = m_pps_unc_ns;
+		m_tstamp_fix = gga->fix;
+		m_tstamp_sats = gga->sats;
+		m_tstamp_hdop = gga->hdop_x10;
+		uint64_t edge_count = m_pps_count;
+		bool edge_count_kept = m_pps_count_kept;
+
+		m_label_offset = label_offset(m_tstamp_hh, m_tstamp_mm, m_tstamp_ss, &m_tstamp_ts);
+		m_label_talker = gga->talker;
+		m_gga_delay_ns = dnsec;
+		m_label_valid = true;
+
+		TSTAMP_TRACE(TP_GGA_PARSE, dnsec, m_tstamp_hh * 3600 + m_tstamp_mm * 60 + m_tstamp_ss);
 		
+		if (raise & TimeStamp::TS_NOTIME) {
+			tstamp_log(TL_TIME_MISMATCH, current_hour, current_minute, m_tstamp_hh, m_tstamp_mm);
+		} else {
+			tstamp_log(TL_TIME_OK, TH_MINUTES, minute_difference);
+		}
+		StatusFlags old_flags, new_flags;
+		updateFlags(raise, clear, &old_flags, &new_flags);
+
+		struct timespec edge = m_tstamp_ts;
+		uint32_t hh = m_tstamp_hh, mm = m_tstamp_mm, ss = m_tstamp_ss, us = m_tstamp_us;
+		struct timespec label = { edge.tv_sec + m_label_offset, 0 };
+
+		LabelFix lf = { true, m_tstamp_unc_ns, *gga };
+
+		pthread_mutex_unlock(&m_tstamp_lock);
+
+		m_label_fix.store(lf);
+		time_scale_recentre(label.tv_sec);
+
+		// hwNow() stays on the last kept edge when the gate rejected this one
+		if (m_hw_counter && edge_count_kept) {
+			HwLabel hw = { true, edge_count, (int64_t)label.tv_sec };
+			m_hw_label.store(hw);
+		}
+
+		notifyFlags(old_flags, new_flags);
+		notifyEpoch(&edge, hh, mm, ss, us);
+		m_journal.append(&edge, hh, mm, ss, us, dnsec, new_flags);
+		if (new_flags == TimeStamp::TS_VALID) {
+			m_shm.publish(&label, &edge, &m_gga_ts);
 		}
 		
+	} 
+	else {
+		tstamp_log(TL_GGA_LATE, dnsec);
+		applyFlags(raise, clear);
 	}
 
 }
 
 void *ggaAcqThreadFcn(void *ptr) {
 	TimeStamp* timestamp = static_cast<TimeStamp*>(ptr);
-	
-	timestamp->clearFlag(TimeStamp::TS_NOUART);
-	timestamp->clearFlag(TimeStamp::TS_OVTIME);
-	timestamp->clearFlag(TimeStamp::TS_NOTIME);
+	TSTAMP_TRACE_THREAD_START();
 
-	sleep(1);
-    
-    for(;;) {
-        int res = uart_read();
-        if (res > 0) { // Search GGA sentence 
-        	AUTO_CLEAR(timestamp, TimeStamp::TS_NOUART );
-			AUTO_CLEAR(timestamp, TimeStamp::TS_NOTIME);
-			AUTO_CLEAR(timestamp, TimeStamp::TS_OVTIME);
-        	timestamp->gga_read();
-        } else {	// No data from UART
-        	timestamp->raiseFlag(TimeStamp::TS_NOUART);
-			timestamp->raiseFlag(TimeStamp::TS_OVTIME);
-			timestamp->raiseFlag(TimeStamp::TS_NOTIME);
-        	sleep(1);
-        }
-    }
-    
-    // This point should never be reached
+	typedef TimeStampAcq<TSTAMP_FLAG_POLICY> Acq;
+	if (timestamp->m_gpsd) {
+		Acq::labelLoop(timestamp, timestamp->m_label_gpsd);
+	} else {
+		Acq::labelLoop(timestamp, timestamp->m_label_nmea);
+	}
+
+	TSTAMP_TRACE_THREAD_STOP();
     return EXIT_SUCCESS;
 }
 	
 TimeStamp::TimeStamp() {
 	threadStarted = false;
+	devicesOpen = false;
+	m_pps_dev = false;
+	m_gpsd = false;
+	m_hw_counter = false;
+	m_stop_fd = -1;
+	m_stop = false;
+	m_state_file[0] = '\0';
+	memset(&m_warm, 0, sizeof(m_warm));
+	m_warm_pending = false;
+	m_edge_count = 0;
 	m_status = TimeStamp::TS_NOPPS + TimeStamp::TS_NOUART + TimeStamp::TS_OVTIME + TimeStamp::TS_NOTIME;
-	pthread_mutex_init(&m_status_mutex, NULL);
+	m_stats_seq = 0;
+	m_stats_flags = m_status;
+	memset(m_counters, 0, sizeof(m_counters));
+	uint64_t now = monotonic_ns();
+	for (int i = 0; i < 8; i++) {
+		m_raised_since[i] = now;
+	}
 }
 
 TimeStamp::~TimeStamp() {
-	if (threadStarted) {
-        pthread_cancel(ggaAcqThreadInfo);
-        pthread_join(ggaAcqThreadInfo, NULL);    
-        pthread_cancel(ppsAcqThreadInfo);
-        pthread_join(ppsAcqThreadInfo, NULL);
-        uart_uninit();
-        hk_fpga_uninit();
-    }
-    pthread_mutex_destroy(&m_status_mutex);
+	destroy();
+	if (m_stop_fd >= 0) {
+		close(m_stop_fd);
+	}
 }
 
 int TimeStamp::init() {
+	return init(Options());
+}
+
+int TimeStamp::init(const Options &opts) {
+
+	if (opts.state_file != NULL) {
+		snprintf(m_state_file, sizeof(m_state_file), "%s", opts.state_file);
+	} else {
+		m_state_file[0] = '\0';
+	}
+
+	// Warm start from the persisted state, checked against the first PPS edge
+	m_warm_pending = false;
+	if (m_state_file[0] != '\0' && tstamp_state_load(m_state_file, &m_warm) == 0) {
+		time_t now = time(NULL);
+		if (now >= m_warm.saved_sec && now - m_warm.saved_sec < TSTAMP_STATE_MAX_AGE) {
+			m_warm_pending = true;
+		}
+	}
+
+	if (opts.journal_file != NULL && !m_journal.isOpen()) {
+		if (m_journal.open(opts.journal_file, opts.journal_records) < 0) {
+			fprintf(stderr, "TimeStamp::init: Error: journal open failed (%s)\n", opts.journal_file);
+			return -1;
+		}
+	}
 
-	pthread_mutex_init(&m_tstamp_lock, NULL);
+	if (opts.shm_unit >= 0 && !m_shm.isOpen()) {
+		if (m_shm.open(opts.shm_unit) < 0) {
+			fprintf(stderr, "TimeStamp::init: Error: NTP SHM open failed\n");
+			m_journal.close();
+			return -1;
+		}
+	}
 
-	int res = hk_fpga_init();
-    if (res < 0) {
-		fprintf(stderr, "TimeStamp::init: Error: hk_fpga_init() failed\n");
+	if (m_stop_fd < 0) {
+		m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (m_stop_fd < 0) {
+			fprintf(stderr, "TimeStamp::init: Error: eventfd() failed\n");
+			return -1;
+		}
+	}
+
+	m_pps_dev = opts.pps_device != NULL;
+
+	TimeStampCoreConfig pps_cfg;
+	pps_cfg.fpga_sim = opts.fpga_sim;
+	pps_cfg.pps_device = opts.pps_device;
+	pps_cfg.pps_edge = opts.pps_edge;
+	int res = m_pps_dev ? m_pps_kernel.open(pps_cfg) : m_pps_poll.open(pps_cfg);
+	if (res < 0) {
+		fprintf(stderr, "TimeStamp::init: Error: PPS source open failed\n");
+		m_pps_dev = false;
 		return -1;
 	}
+
+	// CPU counter for the FPGA poll, checked before use
+	m_hw_counter = opts.hw_counter && !m_pps_dev;
+	if (m_hw_counter) {
+		double hz;
+		if (hw_counter_init() < 0 || hw_counter_selftest(&hz) < 0) {
+			fprintf(stderr, "TimeStamp::init: Error: hardware counter self-test failed\n");
+			closePps();
+			return -1;
+		}
+		m_hw_clock.reset(hz);
+		HwLabel hw;
+		memset(&hw, 0, sizeof(hw));
+		m_hw_label.store(hw);
+	}
 	
-	res = uart_init();
+	m_gpsd = opts.gpsd_host != NULL;
+	if (m_gpsd) {
+		res = gpsd_init(opts.gpsd_host, opts.gpsd_port);
+		if (res < 0) {
+			fprintf(stderr, "TimeStamp::init: Error: gpsd_init() failed\n");
+			closePps();
+			return -1;
+		}
+	} else {
+		res = uart_init(opts.uart_device);
+		if (res < 0) {
+			fprintf(stderr, "TimeStamp::init: Error: uart_init() failed\n");
+			closePps();
+			return -1;
+		}
+	}
+
+	devicesOpen = true;
+
+	res = startThreads();
 	if (res < 0) {
-		fprintf(stderr, "TimeStamp::init: Error: uart_init() failed\n");
-		hk_fpga_uninit();
+		closeLabel();
+		closePps();
+		devicesOpen = false;
+        return -1;
+	}
+	
+	return 0;
+}
+
+void TimeStamp::destroy() {
+
+	stopThreads();
+
+	if (devicesOpen) {
+        
+        closeLabel();
+        
+        closePps();
+
+        devicesOpen = false;
+        
+    }
+
+	m_journal.close();
+	m_shm.close();
+
+}
+
+void TimeStamp::closeLabel() {
+	if (m_gpsd) {
+		gpsd_uninit();
+	} else {
+		uart_uninit();
+	}
+	m_gpsd = false;
+}
+
+void TimeStamp::closePps() {
+	if (m_pps_dev) {
+		m_pps_kernel.close();
+	} else {
+		m_pps_poll.close();
+	}
+	if (m_hw_counter) {
+		hw_counter_uninit();
+		m_hw_counter = false;
+	}
+	m_pps_dev = false;
+}
+
+int TimeStamp::restart() {
+
+	if (!devicesOpen) {
+		fprintf(stderr, "TimeStamp::restart: Error: not initialized\n");
 		return -1;
 	}
 
+	stopThreads();
+
+	return startThreads();
+}
+
+int TimeStamp::startThreads() {
+
+	if (threadStarted) {
+		return 0;
+	}
+
+	// Consume a pending wake up left by a previous stop
+	uint64_t val;
+	while (::read(m_stop_fd, &val, sizeof(val)) > 0) {}
+	m_stop = false;
+
 	// Pass 'this' pointer to threads so they can access instance methods
-	res = pthread_create(&ppsAcqThreadInfo, NULL, ppsAcqThreadFcn, this);
-	if (res < 0) {
-		fprintf(stderr, "TimeStamp::init: Error: pps acquisition thread creation failed\n");
-		uart_uninit();
-        hk_fpga_uninit();
+	int res = pthread_create(&ppsAcqThreadInfo, NULL, ppsAcqThreadFcn, this);
+	if (res != 0) {
+		fprintf(stderr, "TimeStamp::startThreads: Error: pps acquisition thread creation failed\n");
         return -1;
 	}
 	    
     res = pthread_create(&ggaAcqThreadInfo, NULL, ggaAcqThreadFcn, this);
-    if (res < 0) {
-		fprintf(stderr, "TimeStamp::init: Error: gga sentence acquisition thread creation failed\n");
-		pthread_cancel(ppsAcqThreadInfo);
+    if (res != 0) {
+		fprintf(stderr, "TimeStamp::startThreads: Error: gga sentence acquisition thread creation failed\n");
+		// Wake the PPS thread out of its sleep, as stopThreads()
+		m_stop = true;
+		uint64_t one = 1;
+		if (write(m_stop_fd, &one, sizeof(one)) < 0) {
+			fprintf(stderr, "TimeStamp::startThreads: Error: eventfd write failed\n");
+		}
     	pthread_join(ppsAcqThreadInfo, NULL);
-		uart_uninit();
-        hk_fpga_uninit();
         return -1;
 	}
     
     threadStarted = true;
-	
+
 	return 0;
 }
 
-void TimeStamp::destroy() {
+void TimeStamp::stopThreads() {
 
-	 if (threadStarted) {
-    
-        pthread_cancel(ggaAcqThreadInfo);
-        pthread_join(ggaAcqThreadInfo, NULL);
-        
-        pthread_cancel(ppsAcqThreadInfo);
-        pthread_join(ppsAcqThreadInfo, NULL);
-        
-        uart_uninit();
-        
-        hk_fpga_uninit();
+	if (!threadStarted) {
+		return;
+	}
 
-        threadStarted = false;
-        
-    }
+	// Threads exit at their next check: the PPS source polls the flag, the sleeps
+	// and the UART select() also watch the eventfd.
+	m_stop = true;
+	uint64_t one = 1;
+	if (write(m_stop_fd, &one, sizeof(one)) < 0) {
+		fprintf(stderr, "TimeStamp::stopThreads: Error: eventfd write failed\n");
+	}
 
+	pthread_join(ggaAcqThreadInfo, NULL);
+	pthread_join(ppsAcqThreadInfo, NULL);
+
+	threadStarted = false;
+
+	// Rings of the joined threads, restart() maps new ones
+	TSTAMP_TRACE_CLEANUP();
+
+	saveState();
+}
+
+void TimeStamp::publishClockState() {
+	ClockState state;
+	memset(&state, 0, sizeof(state));
+	state.locked = m_servo.locked();
+	state.samples = m_servo.samples();
+	state.freq_ppb = m_servo.freqPpb();
+	state.offset_ns = m_servo.offsetNs();
+	state.jitter_ns = m_servo.jitterNs();
+	state.edge_unc_ns = m_pps_unc_ns;
+	state.rejected = m_filter.rejected();
+	state.last_edge = m_servo.lastEdge();
+	m_clock_state.store(state);
+}
+
+void TimeStamp::getClockState(ClockState *state) {
+	m_clock_state.load(state);
+	state->holdover = state->locked && (getFlags() & TimeStamp::TS_NOPPS);
+	state->holdover_s = 0.0;
+	if (state->holdover) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		state->holdover_s = (double)timespec_delta_ns(&now, &state->last_edge) / 1e9;
+	}
+}
+
+int TimeStamp::toUtc(const struct timespec *os_ts, struct timespec *utc) {
+
+	pthread_mutex_lock(&m_tstamp_lock);
+	bool valid = m_label_valid;
+	struct timespec edge = m_tstamp_ts;
+	int offset = m_label_offset;
+	pthread_mutex_unlock(&m_tstamp_lock);
+
+	if (!valid) {
+		return -1;
+	}
+
+	ClockState clk;
+	m_clock_state.load(&clk);
+
+	// OS ns since the edge, scaled to PPS ns
+	int64_t d = (int64_t)(os_ts->tv_sec - edge.tv_sec) * 1000000000LL + (os_ts->tv_nsec - edge.tv_nsec);
+	if (clk.locked) {
+		d = llround((double)d * 1e9 / (1e9 + clk.freq_ppb));
+	}
+
+	int64_t sec = (int64_t)edge.tv_sec + offset + d / 1000000000LL;
+	int64_t nsec = d % 1000000000LL;
+	if (nsec < 0) {
+		sec--;
+		nsec += 1000000000LL;
+	}
+	utc->tv_sec = (time_t)sec;
+	utc->tv_nsec = (long)nsec;
+
+	return getFlags();
+}
+
+int TimeStamp::toScale(const struct timespec *os_ts, int scale, struct timespec *out) {
+
+	struct timespec utc;
+	int flags = toUtc(os_ts, &utc);
+	if (flags < 0 || time_scale_convert(&utc, TSCALE_UTC, scale, out) < 0) {
+		return -1;
+	}
+	return flags;
+}
+
+int TimeStamp::hwNow(struct timespec *utc) {
+
+	HwLabel hw;
+	m_hw_label.load(&hw);
+	if (!m_hw_counter || !hw.valid) {
+		return -1;
+	}
+
+	int64_t d = m_hw_clock.toNs((int64_t)(hw_counter_read() - hw.count));
+	int64_t sec = hw.utc_sec + d / 1000000000LL;
+	int64_t nsec = d % 1000000000LL;
+	if (nsec < 0) {
+		sec--;
+		nsec += 1000000000LL;
+	}
+	utc->tv_sec = (time_t)sec;
+	utc->tv_nsec = (long)nsec;
+
+	return getFlags();
+}
+
+void TimeStamp::warmStart() {
+
+	m_warm_pending = false;
+
+	// Edge predicted from the persisted one and the persisted frequency
+	struct timespec saved_edge;
+	saved_edge.tv_sec = m_warm.edge_sec;
+	saved_edge.tv_nsec = m_warm.edge_nsec;
+	int64_t d = (int64_t)(m_pps_ts.tv_sec - saved_edge.tv_sec) * 1000000000LL + (m_pps_ts.tv_nsec - saved_edge.tv_nsec);
+	int64_t n = (int64_t)((double)d / (1e9 + m_warm.freq_ppb) + 0.5);
+	int64_t err = d - n * 1000000000LL - (int64_t)(m_warm.freq_ppb * (double)n);
+
+	if (n <= 0 || llabs(err) > TSTAMP_WARM_TOL_NS) {
+		// The OS clock moved or the state is stale: cold start
+		return;
+	}
+
+	m_servo.seed(m_warm.freq_ppb);
+
+	// Label the edge as the GGA sentence would
+	int sod = (int)((m_pps_ts.tv_sec + m_warm.label_offset) % 86400);
+	if (sod < 0) {
+		sod += 86400;
+	}
+
+	pthread_mutex_lock(&m_tstamp_lock);
+
+	m_tstamp_ts.tv_sec = m_pps_ts.tv_sec;
+	m_tstamp_ts.tv_nsec = m_pps_ts.tv_nsec;
+	m_tstamp_hh = sod / 3600;
+	m_tstamp_mm = (sod / 60) % 60;
+	m_tstamp_ss = sod % 60;
+	m_tstamp_us = m_warm.label_us;
+	struct timespec edge = m_tstamp_ts;
+
+	m_label_offset = m_warm.label_offset;
+	m_label_talker = m_warm.talker;
+	m_gga_delay_ns = m_warm.gga_delay_ns;
+	m_label_valid = true;
+
+	pthread_mutex_unlock(&m_tstamp_lock);
+
+	notifyEpoch(&edge, sod / 3600, (sod / 60) % 60, sod % 60, m_warm.label_us);
+}
+
+void TimeStamp::saveState() {
+
+	if (m_state_file[0] == '\0' || !m_servo.hasEdge()) {
+		return;
+	}
+
+	tstamp_state_t state;
+	memset(&state, 0, sizeof(state));
+
+	pthread_mutex_lock(&m_tstamp_lock);
+	bool label_valid = m_label_valid;
+	state.label_offset = m_label_offset;
+	state.label_us = m_tstamp_us;
+	state.gga_delay_ns = m_gga_delay_ns;
+	state.talker = m_label_talker;
+	pthread_mutex_unlock(&m_tstamp_lock);
+
+	if (!label_valid) {
+		return;
+	}
+
+	state.saved_sec = time(NULL);
+	state.edge_sec = m_servo.lastEdge().tv_sec;
+	state.edge_nsec = m_servo.lastEdge().tv_nsec;
+	state.freq_ppb = m_servo.freqPpb();
+
+	tstamp_state_save(m_state_file, &state);
+}
+
+bool TimeStamp::waitStop(int timeout_ms) {
+	struct pollfd pfd;
+	pfd.fd = m_stop_fd;
+	pfd.events = POLLIN;
+	pfd.revents = 0;
+	poll(&pfd, 1, timeout_ms);
+	return stopRequested();
 }
 
 uint32_t TimeStamp::read(CurrentTime *currTime) {
+	return readLabel(currTime, NULL, NULL);
+}
+
+uint32_t TimeStamp::read(CurrentTime *currTime, uint32_t *uncertainty_ns) {
+	return readLabel(currTime, uncertainty_ns, NULL);
+}
+
+// Error of the receiver PPS for the fix of the label, ns
+static uint32_t fix_error_ns(const nmea_gga_t *fix) {
+	switch (fix->fix) {
+	case NMEA_FIX_NONE:
+	case NMEA_FIX_ESTIMATED:
+	case NMEA_FIX_MANUAL:
+	case NMEA_FIX_SIMULATED:
+		return TQ_NO_FIX_NS;
+	default:
+		break;
+	}
+	if (fix->sats != NMEA_SATS_UNKNOWN && fix->sats < 4) {
+		return TQ_FEW_SATS_NS;
+	}
+	// The PPS error grows with the geometry, HDOP 1 or better is nominal
+	if (fix->hdop_x10 != NMEA_HDOP_UNKNOWN && fix->hdop_x10 > 10) {
+		return TQ_RX_PPS_NS * fix->hdop_x10 / 10;
+	}
+	return TQ_RX_PPS_NS;
+}
+
+uint32_t TimeStamp::read(CurrentTime *currTime, TimeQuality *quality) {
+
+	uint32_t edge_unc = 0;
+	nmea_gga_t fix;
+	uint32_t flags = readLabel(currTime, &edge_unc, &fix);
+
+	ClockState clk;
+	m_clock_state.load(&clk);
+	bool holdover = clk.locked && (flags & TS_NOPPS);
+	if (holdover) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		clk.holdover_s = (double)timespec_delta_ns(&now, &clk.last_edge) / 1e9;
+		edge_unc = (uint32_t)clk.edge_unc_ns;
+
+		// readLabel() leaves currTime alone with TS_NOPPS: label the last
+		// edge predicted from the servo instead
+		int64_t n = (int64_t)(clk.holdover_s / (1.0 + clk.freq_ppb * 1e-9));
+		int64_t d = n * 1000000000LL + llround((double)n * clk.freq_ppb);
+		struct timespec edge, utc;
+		edge.tv_sec = clk.last_edge.tv_sec + d / 1000000000LL;
+		edge.tv_nsec = clk.last_edge.tv_nsec + d % 1000000000LL;
+		if (edge.tv_nsec >= 1000000000L) {
+			edge.tv_sec++;
+			edge.tv_nsec -= 1000000000L;
+		}
+		if (toUtc(&edge, &utc) < 0) {
+			holdover = false; // Never labelled, nothing to extrapolate
+		} else {
+			int sod = (int)(utc.tv_sec % 86400);
+			currTime->ts = edge;
+			currTime->hh = sod / 3600;
+			currTime->mm = (sod / 60) % 60;
+			currTime->ss = sod % 60;
+			currTime->us = (uint32_t)(utc.tv_nsec / 1000);
+		}
+	}
+
+	classify(flags, holdover, edge_unc, &fix, &clk, quality);
+
+	return flags;
+}
+
+uint32_t TimeStamp::getQuality(TimeQuality *quality) {
+
+	uint32_t flags = getFlags();
+
+	LabelFix lf;
+	m_label_fix.load(&lf);
+	if (!lf.valid) {
+		lf.unc_ns = 0;
+		lf.fix.fix = NMEA_FIX_UNKNOWN;
+		lf.fix.sats = NMEA_SATS_UNKNOWN;
+		lf.fix.hdop_x10 = NMEA_HDOP_UNKNOWN;
+	}
+
+	ClockState clk;
+	m_clock_state.load(&clk);
+	uint32_t edge_unc = lf.unc_ns;
+	bool holdover = lf.valid && clk.locked && (flags & TS_NOPPS);
+	if (holdover) {
+		struct timespec now;
+		clock_gettime(CLOCK_REALTIME, &now);
+		clk.holdover_s = (double)timespec_delta_ns(&now, &clk.last_edge) / 1e9;
+		edge_unc = (uint32_t)clk.edge_unc_ns;
+	}
+
+	classify(flags, holdover, edge_unc, &lf.fix, &clk, quality);
+
+	return flags;
+}
+
+// Uncertainty and class of a label, shared by read() and getQuality()
+void TimeStamp::classify(uint32_t flags, bool holdover, uint32_t edge_unc, const nmea_gga_t *fix, const ClockState *clk, TimeQuality *quality) {
+
+	double unc = (double)edge_unc + clk->jitter_ns + fix_error_ns(fix);
+	if (holdover) {
+		unc += clk->holdover_s * TQ_HOLDOVER_DRIFT_PPB;
+	}
+
+	quality->flags = (uint8_t)flags;
+	quality->fix = fix->fix;
+	quality->sats = fix->sats;
+	quality->hdop_x10 = fix->hdop_x10;
+	quality->holdover = holdover;
+	quality->jitter_ns = clk->jitter_ns;
+	quality->uncertainty_ns = unc < 4e9 ? (uint32_t)unc : 0xFFFFFFFF;
+
+	bool no_fix = fix_error_ns(fix) >= TQ_NO_FIX_NS;
+	bool weak = (fix->sats != NMEA_SATS_UNKNOWN && fix->sats < 4) ||
+		(fix->hdop_x10 != NMEA_HDOP_UNKNOWN && fix->hdop_x10 > TQ_MAX_HDOP_X10);
+	if ((flags != TS_VALID && !holdover) || no_fix) {
+		quality->cls = TQ_UNUSABLE;
+	} else if (holdover || weak || unc > TQ_GOOD_NS) {
+		quality->cls = TQ_DEGRADED;
+	} else if (unc > TQ_EXCELLENT_NS) {
+		quality->cls = TQ_GOOD;
+	} else {
+		quality->cls = TQ_EXCELLENT;
+	}
+}
+
+uint32_t TimeStamp::readLabel(CurrentTime *currTime, uint32_t *uncertainty_ns, nmea_gga_t *fix) {
+
+	uint64_t start = monotonic_ns();
 
 	pthread_mutex_lock(&m_tstamp_lock);
 	
@@ -288,9 +824,21 @@ uint32_t TimeStamp::read(CurrentTime *currTime) {
 		currTime->mm = m_tstamp_mm;
 		currTime->ss = m_tstamp_ss;
 		currTime->us = m_tstamp_us;
+		if (uncertainty_ns != NULL) {
+			*uncertainty_ns = m_tstamp_unc_ns;
+		}
+	}
+	if (fix != NULL) {
+		fix->fix = m_tstamp_fix;
+		fix->sats = m_tstamp_sats;
+		fix->hdop_x10 = m_tstamp_hdop;
 	}
 	
 	pthread_mutex_unlock(&m_tstamp_lock);
+
+	uint64_t duration = monotonic_ns() - start;
+	m_latency[LAT_READ].record(duration);
+	TSTAMP_TRACE(TP_READ, currentStatus, duration);
 	
 	return currentStatus;
 
@@ -322,32 +870,126 @@ void TimeStamp::computeAbsoluteTime(const struct timespec *ts, CurrentTime *curr
 
 // Thread-safe flag manipulation methods (public interface)
 void TimeStamp::raiseFlag(TimeSts flag) {
-	pthread_mutex_lock(&m_status_mutex);
-	m_status |= (uint32_t)flag;
-	pthread_mutex_unlock(&m_status_mutex);
+	StatusFlags old_flags, new_flags;
+	updateFlags(flag, 0, &old_flags, &new_flags);
+	notifyFlags(old_flags, new_flags);
 }
 
 void TimeStamp::clearFlag(TimeSts flag) {
-	pthread_mutex_lock(&m_status_mutex);
-	m_status &= ~((uint32_t)flag);
-	pthread_mutex_unlock(&m_status_mutex);
+	StatusFlags old_flags, new_flags;
+	updateFlags(0, flag, &old_flags, &new_flags);
+	notifyFlags(old_flags, new_flags);
 }
 
 void TimeStamp::clearFlags() {
-	pthread_mutex_lock(&m_status_mutex);
-	m_status = TimeStamp::TS_VALID;
-	pthread_mutex_unlock(&m_status_mutex);
+	StatusFlags old_flags, new_flags;
+	updateFlags(0, 0xFF, &old_flags, &new_flags);
+	notifyFlags(old_flags, new_flags);
 }
 
-TimeStamp::StatusFlags TimeStamp::getFlags() {
-	pthread_mutex_lock(&m_status_mutex);
-	StatusFlags currentStatus = m_status;
-	pthread_mutex_unlock(&m_status_mutex);
-	return currentStatus;
+void TimeStamp::applyFlags(StatusFlags raise, StatusFlags clear) {
+	StatusFlags old_flags, new_flags;
+	updateFlags(raise, clear, &old_flags, &new_flags);
+	notifyFlags(old_flags, new_flags);
+}
+
+void TimeStamp::updateFlags(StatusFlags raise, StatusFlags clear, StatusFlags *old_flags, StatusFlags *new_flags) {
+
+	StatusFlags cur = m_status.load(std::memory_order_acquire);
+	StatusFlags next;
+	do {
+		next = (cur | raise) & ~clear;
+		if (next == cur) { // Nothing to change
+			*old_flags = cur;
+			*new_flags = cur;
+			return;
+		}
+	} while (!m_status.compare_exchange_weak(cur, next, std::memory_order_acq_rel, std::memory_order_acquire));
+
+	*old_flags = cur;
+	*new_flags = next;
+
+	// Counters: writer side of the seqlock, the other acquisition thread
+	// holds it for a few stores, yield rather than spin if it was preempted
+	uint32_t seq = m_stats_seq.load(std::memory_order_relaxed);
+	while ((seq & 1) || !m_stats_seq.compare_exchange_weak(seq, seq + 1, std::memory_order_acquire,
+		std::memory_order_relaxed)) {
+		sched_yield();
+		seq = m_stats_seq.load(std::memory_order_relaxed);
+	}
+	std::atomic_thread_fence(std::memory_order_release);
+
+	StatusFlags changed = cur ^ next;
+	m_stats_flags ^= changed;
+	uint64_t now = monotonic_ns();
+	for (int i = 0; i < 8; i++) {
+		if (!(changed & (1 << i))) {
+			continue;
+		}
+		if (next & (1 << i)) {
+			m_counters[i].raised++;
+			m_raised_since[i] = now;
+		} else {
+			m_counters[i].cleared++;
+			// A raise by the other thread may be accounted just after
+			if (now > m_raised_since[i]) {
+				m_counters[i].raised_ns += now - m_raised_since[i];
+			}
+		}
+	}
+
+	m_stats_seq.store(seq + 2, std::memory_order_release);
+}
+
+void TimeStamp::getStatusSnapshot(StatusSnapshot *snap) {
+	uint32_t seq;
+	uint64_t since[8];
+	do {
+		seq = m_stats_seq.load(std::memory_order_acquire);
+		snap->flags = m_stats_flags;
+		memcpy(snap->counters, m_counters, sizeof(m_counters));
+		memcpy(since, m_raised_since, sizeof(since));
+		std::atomic_thread_fence(std::memory_order_acquire);
+	} while ((seq & 1) || seq != m_stats_seq.load(std::memory_order_relaxed));
+
+	clock_gettime(CLOCK_MONOTONIC, &snap->ts);
+	uint64_t now = (uint64_t)snap->ts.tv_sec * 1000000000ULL + snap->ts.tv_nsec;
+
+	// Account for the flags still raised
+	for (int i = 0; i < 8; i++) {
+		if ((snap->flags & (1 << i)) && now > since[i]) {
+			snap->counters[i].raised_ns += now - since[i];
+		}
+	}
+}
+
+void TimeStamp::notifyFlags(StatusFlags old_flags, StatusFlags new_flags) {
+	if (old_flags == new_flags) {
+		return;
+	}
+	TSTAMP_TRACE(TP_FLAGS, old_flags, new_flags);
+	TimeEvent ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.kind = TEV_FLAGS;
+	ev.flags = new_flags;
+	ev.old_flags = old_flags;
+	m_notifier.publish(&ev);
+}
+
+void TimeStamp::notifyEpoch(const struct timespec *edge, uint32_t hh, uint32_t mm, uint32_t ss, uint32_t us) {
+	TimeEvent ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.kind = TEV_EPOCH;
+	ev.flags = getFlags();
+	ev.old_flags = ev.flags;
+	ev.edge = *edge;
+	ev.hh = hh;
+	ev.mm = mm;
+	ev.ss = ss;
+	ev.us = us;
+	m_notifier.publish(&ev);
 }
 
 void TimeStamp::autoClear(TimeSts flag) {
-#ifdef AUTO_CLEAR_FLAGS
 	clearFlag(flag);
-#endif
 }
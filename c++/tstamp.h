@@ -2,14 +2,58 @@
 #define __TSTAMP_V2_H__
 
 #include <cstdint>
+#include <atomic>
 #include <pthread.h>
 
+#include "uart.h"
+#include "pps_dev.h"
+#include "gpsd.h"
+#include "hw_counter.h"
+#include "tstamp_policy.h"
+#include "time_scale.h"
+#include "pps_servo.h"
+#include "pps_filter.h"
+#include "tstamp_state.h"
+#include "tstamp_notify.h"
+#include "latency_hist.h"
+#include "seqlock.h"
+#include "pps_journal.h"
+#include "ntp_shm.h"
+
+// Warm start: accept the persisted state if younger than this (s) and if
+// the first PPS edge is within TSTAMP_WARM_TOL_NS of the predicted one.
+#define TSTAMP_STATE_MAX_AGE 	3600
+#define TSTAMP_WARM_TOL_NS 		5000000
+
+// Save the state every TSTAMP_STATE_PERIOD PPS edges.
+#define TSTAMP_STATE_PERIOD 	64
+
+// Time quality (read() with TimeQuality): error of the receiver PPS with a
+// nominal fix, with fewer than 4 satellites and without a fix (RTC or dead
+// reckoning time), drift assumed in holdover and class thresholds.
+#define TQ_RX_PPS_NS 			50
+#define TQ_FEW_SATS_NS 			1000
+#define TQ_NO_FIX_NS 			1000000
+#define TQ_HOLDOVER_DRIFT_PPB 	1000.0
+#define TQ_MAX_HDOP_X10 		50
+#define TQ_EXCELLENT_NS 		5000
+#define TQ_GOOD_NS 				50000
+
+// Maximum difference between the label and the OS time of day before TS_NOTIME is
+// raised: the local time in TimeStamp, the UTC time of the edge in TimeStampCore
+#define TH_MINUTES 20
+
+// Flag policy (tstamp_policy.h) of TimeStamp and default of TimeStampCore
 #ifndef AUTO_CLEAR_FLAGS_DISABLED
     #define AUTO_CLEAR_FLAGS 1  // Default ON
+    #define TSTAMP_FLAG_POLICY FlagsAutoClear
+#else
+    #define TSTAMP_FLAG_POLICY FlagsLatched
 #endif
 
 // Forward declaration for friend functions
 class TimeStamp;
+template <class FlagPolicy> struct TimeStampAcq;
 
 // Thread function declarations that can access private members
 void *ppsAcqThreadFcn(void *ptr);
@@ -63,37 +107,221 @@ public:
 		};
 	} AbsoluteTime;
 	
+	// Quality classes, from the worst
+	enum QualityClass {
+		TQ_UNUSABLE = 0, 	// Not valid, or the receiver has no real fix
+		TQ_DEGRADED, 		// Holdover, weak geometry or uncertainty above TQ_GOOD_NS
+		TQ_GOOD, 			// Uncertainty within TQ_GOOD_NS
+		TQ_EXCELLENT, 		// Uncertainty within TQ_EXCELLENT_NS
+	};
+
+	// Quality of the time returned by read()
+	typedef struct {
+		uint8_t cls; 				// QualityClass
+		uint8_t flags; 				// Status flags, as returned by read()
+		uint8_t fix; 				// GGA fix quality of the label (NmeaFix)
+		uint8_t sats; 				// Satellites in use, NMEA_SATS_UNKNOWN if not reported
+		uint16_t hdop_x10; 			// HDOP * 10, NMEA_HDOP_UNKNOWN if not reported
+		bool holdover;
+		double jitter_ns; 			// Servo jitter of the PPS edges
+		uint32_t uncertainty_ns; 	// Estimated +- error of currTime->ts: edge bound, jitter, receiver, holdover drift
+	} TimeQuality;
+
+	// Initialization options
+	struct Options {
+		const char *state_file; // Persisted clock state, NULL to disable
+		const char *journal_file; // Journal of the PPS epochs, NULL to disable
+		uint32_t journal_records; // Records per journal file before rotating
+		const char *uart_device; // Serial port of the GPS receiver
+		bool fpga_sim; // Registers simulated by hk_fpga_sim (GnssSim), /dev/mem is not mapped
+		int shm_unit; // NTP SHM refclock units shm_unit and shm_unit + 1, -1 to disable
+		const char *pps_device; // Kernel PPS source (/dev/ppsN) in place of the FPGA poll, NULL for the FPGA
+		int pps_edge; // PPS_DEV_ASSERT or PPS_DEV_CLEAR, kernel PPS source only
+		const char *gpsd_host; // Time labels from the gpsd TPV reports in place of the UART, NULL for the UART
+		uint16_t gpsd_port;
+		bool hw_counter; // Stamp the FPGA polled edges with the CPU counter (hw_counter.h), enables hwNow()
+		
+		Options() : state_file(TSTAMP_STATE_FILE), journal_file(NULL), journal_records(PPS_JOURNAL_RECORDS),
+			uart_device(UART_DEVICE), fpga_sim(false), shm_unit(-1), pps_device(NULL), pps_edge(PPS_DEV_ASSERT),
+			gpsd_host(NULL), gpsd_port(GPSD_PORT), hw_counter(false) {}
+	};
+
+	// Transition counters of one status flag
+	typedef struct {
+		uint32_t raised; 	// Number of 0 -> 1 transitions
+		uint32_t cleared; 	// Number of 1 -> 0 transitions
+		uint64_t raised_ns; // Cumulative time spent raised
+	} FlagCounters;
+
+	// Consistent view of the status word and of the flag counters
+	typedef struct {
+		StatusFlags flags;
+		struct timespec ts; 		// CLOCK_MONOTONIC time of the snapshot
+		FlagCounters counters[8]; 	// Indexed by bit number, e.g. TS_NOPPS is 7
+	} StatusSnapshot;
+
+	// Latency histograms
+	enum LatencyId {
+		LAT_PPS_WAIT = 0, 	// Time the PPS source polled before seeing the edge
+		LAT_GGA_DELAY, 		// Arrival of the GGA sentence after the PPS edge
+		LAT_READ, 			// Duration of read(), lock wait included
+		LAT_PPS_BRACKET, 	// Width of the interval bracketing the FPGA edge
+		LAT_COUNT,
+	};
+
+	// Servo state, published by the PPS thread on each edge
+	typedef struct {
+		bool locked; 				// Frequency estimate available
+		bool holdover; 				// Locked but the PPS is missing
+		uint32_t samples; 			// Edges used by the servo
+		double freq_ppb; 			// OS clock frequency error
+		double offset_ns; 			// Error of the last edge against the prediction
+		double jitter_ns; 			// Mean absolute edge error
+		double edge_unc_ns; 		// +- bound of the last edge timestamp
+		uint32_t rejected; 			// Edges rejected by the outlier gate
+		struct timespec last_edge; 	// Last PPS edge, OS time
+		double holdover_s; 			// Time since the last edge while in holdover
+	} ClockState;
+
 	TimeStamp();
 	~TimeStamp();
 	
 	int init();
+	int init(const Options &opts);
 	void destroy();
 
+	// Stop and start again the acquisition threads. The FPGA mapping and the
+	// UART are kept open, so this takes milliseconds instead of seconds.
+	int restart();
+
 	// Clear all flags (set them to 0). External reset of the status flags.
 	void clearFlags();
 
 	// Get the status flags.
-	StatusFlags getFlags();
+	StatusFlags getFlags() { return m_status.load(std::memory_order_acquire); }
+
+	// Get the status flags together with the per flag counters.
+	void getStatusSnapshot(StatusSnapshot *snap);
 	
 	uint32_t read(CurrentTime *currTime);
+	// Same as read(), with the +- bound of the edge timestamp in currTime->ts
+	// (half the poll interval that bracketed the edge). Set only when valid.
+	uint32_t read(CurrentTime *currTime, uint32_t *uncertainty_ns);
+	// Same as read(), with the quality of the label: receiver fix, servo state
+	// and uncertainty combined into a class. quality is always filled. In
+	// holdover (TS_NOPPS raised, quality->holdover set) currTime is the edge
+	// predicted by the servo for the last second, labelled with toUtc(); it is
+	// filled whenever quality->cls is not TQ_UNUSABLE.
+	uint32_t read(CurrentTime *currTime, TimeQuality *quality);
 	void computeAbsoluteTime(const struct timespec *ts, CurrentTime *currTime, AbsoluteTime *absTime);
 	
+	// Event subscriptions (see tstamp_notify.h). TEV_EPOCH is published on
+	// each validated PPS epoch, TEV_FLAGS on each status flags transition.
+	int subscribe(uint32_t mask, TimeEventCallback cb, void *arg) { return m_notifier.subscribe(mask, cb, arg); }
+	int subscribeFd(uint32_t mask, int *fd) { return m_notifier.subscribeFd(mask, fd); }
+	void unsubscribe(int id) { m_notifier.unsubscribe(id); }
+	int waitEvent(uint32_t mask, uint32_t after_seq, TimeEvent *ev, int timeout_ms) { return m_notifier.waitEvent(mask, after_seq, ev, timeout_ms); }
+	TimeNotifier &notifier() { return m_notifier; }
+
+	// Lock-free snapshot of the servo state.
+	void getClockState(ClockState *state);
+	// Lock-free quality of the last label, as read() with TimeQuality but
+	// without the time, for pollers (metrics) that must not take the label lock.
+	uint32_t getQuality(TimeQuality *quality);
+
+	// UTC time of an OS timestamp (CLOCK_REALTIME), extrapolated from the last
+	// labelled PPS edge with the servo frequency. Returns the status flags,
+	// -1 if no edge has been labelled yet.
+	int toUtc(const struct timespec *os_ts, struct timespec *utc);
+
+	// Same as toUtc() in the time scale scale (TimeScaleId): UTC, TAI or GPS
+	// (seconds since the GPS epoch, see time_scale_gps_week()).
+	int toScale(const struct timespec *os_ts, int scale, struct timespec *out);
+
+	// UTC time now from the CPU counter, without reading the OS clock: the
+	// counts since the last labelled edge at the PPS calibrated rate. Needs
+	// Options::hw_counter. Returns the status flags, -1 if not available.
+	int hwNow(struct timespec *utc);
+	const HwTimebase &timebase() const { return m_hw_clock.timebase(); }
+
+	// Latency histograms, percentiles are in ns. The notify to wake latency
+	// is in notifier().wakeHistogram().
+	const LatencyHistogram &latency(LatencyId id) const { return m_latency[id]; }
+	uint64_t latencyPercentile(LatencyId id, double q) const { return m_latency[id].percentile(q); }
+
 	// Auto clear method (public for macro usage)
 	void autoClear(TimeSts flag);
 	
 	// Friend functions for thread access
 	friend void *ppsAcqThreadFcn(void *ptr);
 	friend void *ggaAcqThreadFcn(void *ptr);
+	template <class> friend struct TimeStampAcq;
 	
 protected:
 	
 private:
 
 	bool threadStarted;
+	bool devicesOpen; // FPGA mapped and UART opened by init()
+	bool m_pps_dev; // PPS from the kernel (pps_dev.h) instead of the FPGA
+	bool m_gpsd; // Time labels from gpsd instead of the UART
+	bool m_hw_counter; // FPGA edges stamped with hw_counter_read()
+
+	int m_stop_fd; // eventfd used to wake up the threads on shutdown
+	std::atomic<bool> m_stop; // Cooperative shutdown request
+
+	std::atomic<StatusFlags> m_status; // Instance status
 
-	StatusFlags m_status; // Instance status
-	pthread_mutex_t m_status_mutex; // Mutex for status protection
+	// Flag counters, written only on transitions and read through the
+	// m_stats_seq seqlock. Writers take it with a CAS from even to odd.
+	std::atomic<uint32_t> m_stats_seq;
+	StatusFlags m_stats_flags; // m_status as accounted in the counters
+	FlagCounters m_counters[8];
+	uint64_t m_raised_since[8]; // CLOCK_MONOTONIC ns of the last raise
 	
+	char m_state_file[256]; // Empty if persistence is disabled
+	tstamp_state_t m_warm; // State loaded by init()
+	bool m_warm_pending; // Warm start on the first PPS edge
+	uint32_t m_edge_count;
+
+	PpsServo m_servo; // Owned by the PPS thread
+	PpsFilter m_filter; // Owned by the PPS thread
+	SeqLock<ClockState> m_clock_state; // Published copy of m_servo
+
+	TimeNotifier m_notifier;
+
+	LatencyHistogram m_latency[LAT_COUNT];
+
+	PpsJournal m_journal; // Written by the GGA thread
+	NtpShm m_shm; // Written by the GGA thread
+
+	// Counter time base, written by the PPS thread, and counter of the last
+	// labelled edge, written by the GGA thread
+	typedef struct {
+		bool valid;
+		uint64_t count;
+		int64_t utc_sec;
+	} HwLabel;
+	SeqLock<HwLabel> m_hw_label;
+
+	// Receiver fix and edge uncertainty of the last label, written by the GGA thread
+	typedef struct {
+		bool valid;
+		uint32_t unc_ns;
+		nmea_gga_t fix;
+	} LabelFix;
+	SeqLock<LabelFix> m_label_fix;
+
+	// PPS sources and clocks (tstamp_policy.h), owned by the PPS thread
+	PpsFpgaPoll<> m_pps_poll;
+	PpsKernel m_pps_kernel;
+	ClockRealtime m_clock;
+	ClockHwCounter m_hw_clock;
+
+	// Label sources (tstamp_policy.h), owned by the GGA thread
+	LabelNmea m_label_nmea;
+	LabelGpsd m_label_gpsd;
+
     pthread_t ppsAcqThreadInfo;
     pthread_t ggaAcqThreadInfo;	
 
@@ -101,15 +329,39 @@ private:
 	void raiseFlag(TimeSts flag);
 	void clearFlag(TimeSts flag);
 
-	inline void gga_read();
-	inline int pps_wait();
+	// Raise and clear flags without notifying, for use under m_tstamp_lock.
+	// The status word moves with a CAS, transitions update the counters.
+	// The caller publishes the transition with notifyFlags() after unlocking.
+	void updateFlags(StatusFlags raise, StatusFlags clear, StatusFlags *old_flags, StatusFlags *new_flags);
+	void applyFlags(StatusFlags raise, StatusFlags clear); // Update and notify
+	void notifyFlags(StatusFlags old_flags, StatusFlags new_flags);
+	void notifyEpoch(const struct timespec *edge, uint32_t hh, uint32_t mm, uint32_t ss, uint32_t us);
+
+	int startThreads();
+	void stopThreads();
+
+	// Sleep up to timeout_ms, returns true as soon as a shutdown is requested.
+	bool waitStop(int timeout_ms);
+	bool stopRequested() const { return m_stop.load(std::memory_order_relaxed); }
+
+	void publishClockState();
+	void warmStart();
+	void saveState();
+
+	void closePps();
+	void closeLabel();
+
+	uint32_t readLabel(CurrentTime *currTime, uint32_t *uncertainty_ns, nmea_gga_t *fix);
+	static void classify(uint32_t flags, bool holdover, uint32_t edge_unc, const nmea_gga_t *fix, const ClockState *clk, TimeQuality *quality);
+
+	// Hooks of the acquisition loops (tstamp_acq.h)
+	void onEdge(const PpsEdge *edge);
+	void onPpsMiss(const PpsEdge *edge);
+	void label_pair(const nmea_gga_t *gga);
+	inline bool pps_gate();
 };
 
-// Instance-based AUTO_CLEAR macro for the new version
-#ifdef AUTO_CLEAR_FLAGS
-#define AUTO_CLEAR(instance, flag) (instance)->autoClear(flag);
-#else
-#define AUTO_CLEAR(instance, flag)
-#endif
+// Instance-based AUTO_CLEAR macro, a constant condition folded by the compiler
+#define AUTO_CLEAR(instance, flag) do { if (TSTAMP_FLAG_POLICY::auto_clear) (instance)->autoClear(flag); } while (0)
 
 #endif /* __TSTAMP_V2_H__ */
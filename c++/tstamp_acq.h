@@ -0,0 +1,109 @@
+#ifndef __TSTAMP_ACQ_H__
+#define __TSTAMP_ACQ_H__
+
+#include <cstdint>
+#include <cstdlib>
+
+#include "tstamp.h"
+#include "tstamp_policy.h"
+
+/* Acquisition threads shared by TimeStamp and TimeStampCore: the PPS and
+ * label loops, the status flags each event raises and clears under the
+ * FlagPolicy, and the pairing of a label with the last edge. The PPS source,
+ * the clock and the label source are template arguments, TimeStamp picks
+ * them from its Options once per thread. The owner class befriends
+ * TimeStampAcq and provides:
+ *
+ *   std::atomic<bool> m_stop;  int m_stop_fd;  bool stopRequested() const;
+ *   bool waitStop(int timeout_ms);
+ *   void applyFlags(StatusFlags raise, StatusFlags clear);
+ *   void onEdge(const PpsEdge *edge);            edge captured, before TS_NOPPS is cleared
+ *   void onPpsMiss(const PpsEdge *edge);         no edge, before TS_NOPPS is raised
+ *   void label_pair(const nmea_gga_t *label);    label read, flags from pairFlags()
+ *
+ * Latched flags start clear when the threads start. Auto cleared ones stay
+ * raised until the first edge and the first paired label drop them.
+ */
+template <class FlagPolicy>
+struct TimeStampAcq {
+
+	typedef TimeStamp::StatusFlags StatusFlags;
+
+	enum {
+		// Mask of the flags an event clears, none when latched
+		CLEAR = FlagPolicy::auto_clear ? 0xFF : 0,
+
+		PPS_START_CLEAR = FlagPolicy::auto_clear ? 0 : TimeStamp::TS_NOPPS,
+		PPS_EDGE_CLEAR = TimeStamp::TS_NOPPS & CLEAR,
+		PPS_MISS_RAISE = TimeStamp::TS_NOPPS,
+
+		LABEL_FLAGS = TimeStamp::TS_NOUART | TimeStamp::TS_OVTIME | TimeStamp::TS_NOTIME,
+		LABEL_START_CLEAR = FlagPolicy::auto_clear ? 0 : LABEL_FLAGS,
+		LABEL_READ_CLEAR = TimeStamp::TS_NOUART & CLEAR,
+		LABEL_SILENT_RAISE = LABEL_FLAGS,
+		LABEL_LATE_RAISE = TimeStamp::TS_OVTIME | TimeStamp::TS_NOTIME,
+	};
+
+	// Flags of a label read delay_ns after the last edge (negative without an
+	// edge). TS_NOTIME if hh:mm is more than TH_MINUTES from the reference
+	// time of day ref_hh:ref_mm, minute_diff is the difference. Returns false
+	// if the label is late and must not be paired.
+	static bool pairFlags(int64_t delay_ns, int hh, int mm, int ref_hh, int ref_mm, int *minute_diff,
+		StatusFlags *raise, StatusFlags *clear) {
+
+		if (delay_ns < 0 || delay_ns >= 1000000000LL) {
+			*minute_diff = 0;
+			*raise = LABEL_LATE_RAISE;
+			*clear = 0;
+			return false;
+		}
+		*minute_diff = (hh * 60 + mm) - (ref_hh * 60 + ref_mm);
+		if (abs(*minute_diff) > TH_MINUTES) {
+			*raise = TimeStamp::TS_NOTIME;
+			*clear = TimeStamp::TS_OVTIME & CLEAR;
+		} else {
+			*raise = 0;
+			*clear = (TimeStamp::TS_OVTIME | TimeStamp::TS_NOTIME) & CLEAR;
+		}
+		return true;
+	}
+
+	template <class Owner, class PpsSource, class ClockSource>
+	static void ppsLoop(Owner *owner, PpsSource &pps, ClockSource &clock) {
+
+		owner->applyFlags(0, PPS_START_CLEAR);
+
+		while (!owner->stopRequested()) {
+			PpsEdge edge;
+			if (pps.wait(clock, owner->m_stop, &edge) == 0) { // PPS found wait till the next one
+				owner->onEdge(&edge);
+				owner->applyFlags(0, PPS_EDGE_CLEAR);
+				owner->waitStop(750);
+			} else if (!owner->stopRequested()) { // No signal/fix from PPS
+				owner->onPpsMiss(&edge);
+				owner->applyFlags(PPS_MISS_RAISE, 0);
+				owner->waitStop(1000);
+			}
+		}
+	}
+
+	template <class Owner, class LabelSource>
+	static void labelLoop(Owner *owner, LabelSource &source) {
+
+		owner->applyFlags(0, LABEL_START_CLEAR);
+
+		while (!owner->stopRequested()) {
+			nmea_gga_t label;
+			int res = source.read(owner->m_stop_fd, &label);
+			if (res > 0) {
+				owner->applyFlags(0, LABEL_READ_CLEAR);
+				owner->label_pair(&label);
+			} else if (res < 0 && !owner->stopRequested()) { // Label source silent
+				owner->applyFlags(LABEL_SILENT_RAISE, 0);
+				owner->waitStop(1000);
+			}
+		}
+	}
+};
+
+#endif /* __TSTAMP_ACQ_H__ */
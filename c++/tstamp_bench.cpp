@@ -0,0 +1,411 @@
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <string>
+#include <unistd.h>
+#include <pthread.h>
+
+#include "tstamp.h"
+#include "tstamp_core.h"
+#include "nmea.h"
+#include "gnss_sim.h"
+#include "sample_clock.h"
+#include "tstamp_log.h"
+#include "bench.h"
+
+// Microbenchmarks of the timestamp library against the simulated GNSS
+// receiver (gnss_sim.h), results on standard output as JSON.
+//
+//	tstamp_bench [-e epochs] [-t seconds per case] [-o file]
+
+static double g_case_s = BENCH_MIN_S;
+
+static const char *g_gga = "$GNGGA,123519.00,4807.038,N,01131.000,E,1,08,0.9,545.4,M,46.9,M,,*5B\r\n";
+
+static int64_t rt_delta_ns(const struct timespec *a, const struct timespec *b) {
+	return (int64_t)(a->tv_sec - b->tv_sec) * 1000000000LL + (a->tv_nsec - b->tv_nsec);
+}
+
+static void bench_parse(BenchReport *report) {
+
+	LatencyHistogram hist;
+	int len = (int)strlen(g_gga);
+	nmea_gga_t gga;
+	uint64_t t0 = bench_now_ns();
+	uint64_t ops = bench_run([&]() {
+		nmea_gga_parse((const uint8_t*)g_gga, len, &gga);
+		bench_keep(gga);
+	}, &hist, g_case_s);
+	report->add("nmea_gga_parse", hist, ops, bench_now_ns() - t0);
+}
+
+static void bench_compute(BenchReport *report, TimeStamp *ts) {
+
+	TimeStamp::CurrentTime curr;
+	TimeStamp::AbsoluteTime abs;
+	struct timespec now;
+	ts->read(&curr);
+	clock_gettime(CLOCK_REALTIME, &now);
+
+	LatencyHistogram hist;
+	uint64_t t0 = bench_now_ns();
+	uint64_t ops = bench_run([&]() {
+		ts->computeAbsoluteTime(&now, &curr, &abs);
+		bench_keep(abs);
+	}, &hist, g_case_s);
+	report->add("computeAbsoluteTime", hist, ops, bench_now_ns() - t0);
+}
+
+static void bench_quality(BenchReport *report, TimeStamp *ts) {
+
+	TimeStamp::CurrentTime curr;
+	TimeStamp::TimeQuality quality;
+	LatencyHistogram hist;
+	uint64_t t0 = bench_now_ns();
+	uint64_t ops = bench_run([&]() {
+		ts->read(&curr, &quality);
+		bench_keep(quality);
+	}, &hist, g_case_s);
+	report->add("read_quality", hist, ops, bench_now_ns() - t0);
+	report->addValue("quality_class", quality.cls, "class");
+	report->addValue("quality_uncertainty", quality.uncertainty_ns, "ns");
+}
+
+typedef struct {
+	TimeStamp *ts;
+	LatencyHistogram *hist;
+	uint64_t ops;
+} reader_arg_t;
+
+static void *reader_fcn(void *ptr) {
+	reader_arg_t *arg = static_cast<reader_arg_t*>(ptr);
+	TimeStamp::CurrentTime curr;
+	arg->ops = bench_run([&]() {
+		arg->ts->read(&curr);
+		bench_keep(curr);
+	}, arg->hist, g_case_s);
+	return NULL;
+}
+
+// read() from n threads at once, one histogram shared by all of them
+static void bench_read(BenchReport *report, TimeStamp *ts, int n) {
+
+	LatencyHistogram hist;
+	pthread_t threads[16];
+	reader_arg_t args[16];
+	uint64_t t0 = bench_now_ns();
+	for (int i = 0; i < n; i++) {
+		args[i].ts = ts;
+		args[i].hist = &hist;
+		args[i].ops = 0;
+		pthread_create(&threads[i], NULL, reader_fcn, &args[i]);
+	}
+	uint64_t ops = 0;
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+		ops += args[i].ops;
+	}
+	report->add("read/threads:" + std::to_string(n), hist, ops, bench_now_ns() - t0, n);
+}
+
+template <class Core>
+struct core_reader_arg_t {
+	Core *core;
+	LatencyHistogram *hist;
+	uint64_t ops;
+};
+
+template <class Core>
+static void *core_reader_fcn(void *ptr) {
+	core_reader_arg_t<Core> *arg = static_cast<core_reader_arg_t<Core>*>(ptr);
+	TimeStamp::CurrentTime curr;
+	arg->ops = bench_run([&]() {
+		arg->core->read(&curr);
+		bench_keep(curr);
+	}, arg->hist, g_case_s);
+	return NULL;
+}
+
+// Clock of the core before init(): the virtual clock starts at the OS time so
+// that the labels of the simulator match the edges
+template <class Clock>
+static void core_clock_start(Clock &) {}
+
+static void core_clock_start(ClockVirtual &clock) {
+	struct timespec now;
+	clock_gettime(CLOCK_REALTIME, &now);
+	clock.set((uint64_t)now.tv_sec * 1000000000ULL + now.tv_nsec);
+}
+
+// Compile time configured core (tstamp_core.h) on the simulator: time to the
+// first valid label, then read() from n threads as bench_read()
+template <class Core>
+static void bench_core(BenchReport *report, const char *name, const char *uart_device, int n) {
+
+	Core core;
+	core_clock_start(core.clock());
+	TimeStampCoreConfig cfg;
+	cfg.fpga_sim = true;
+	cfg.uart_device = uart_device;
+	uint64_t t0 = bench_now_ns();
+	if (core.init(cfg) < 0) {
+		return;
+	}
+	TimeStamp::CurrentTime curr;
+	memset(&curr, 0, sizeof(curr));
+	while (core.read(&curr) != TimeStamp::TS_VALID && bench_now_ns() - t0 < 5000000000ULL) {
+		usleep(1000);
+	}
+	if (core.getFlags() != TimeStamp::TS_VALID) {
+		fprintf(stderr, "tstamp_bench: Error: %s core not valid (flags 0x%02X)\n", name, core.getFlags());
+		return;
+	}
+	report->addValue(std::string("core_to_valid/") + name, (bench_now_ns() - t0) / 1e6, "ms");
+
+	LatencyHistogram hist;
+	pthread_t threads[16];
+	core_reader_arg_t<Core> args[16];
+	t0 = bench_now_ns();
+	for (int i = 0; i < n; i++) {
+		args[i].core = &core;
+		args[i].hist = &hist;
+		args[i].ops = 0;
+		pthread_create(&threads[i], NULL, core_reader_fcn<Core>, &args[i]);
+	}
+	uint64_t ops = 0;
+	for (int i = 0; i < n; i++) {
+		pthread_join(threads[i], NULL);
+		ops += args[i].ops;
+	}
+	report->add(std::string("core_read/") + name + "/threads:" + std::to_string(n), hist, ops, bench_now_ns() - t0, n);
+}
+
+// Cost of a diagnostic on the caller side: tstamp_log() against formatting
+// and writing the same line in place. Bursts of half the queue, each drained
+// by the writer thread before the next one, so no record is dropped.
+#define LOG_BURST 	(TSTAMP_LOG_RECORDS / 2)
+#define LOG_ROUNDS 	8
+
+static void bench_log(BenchReport *report) {
+
+	if (tstamp_log_start("/dev/null", TLOG_DEBUG) < 0) {
+		return;
+	}
+	LatencyHistogram async_hist, sync_hist;
+	for (int r = 0; r < LOG_ROUNDS; r++) {
+		for (int i = 0; i < LOG_BURST; i++) {
+			uint64_t t0 = bench_now_ns();
+			tstamp_log(TL_GGA_PAIRED, i);
+			async_hist.record(bench_now_ns() - t0);
+		}
+		usleep(2 * TSTAMP_LOG_FLUSH_MS * 1000);
+	}
+	tstamp_log_stop();
+
+	log_stats_t stats;
+	tstamp_log_stats(&stats);
+	report->add("log_enqueue", async_hist);
+	report->addValue("log_dropped", (double)stats.dropped, "count");
+	report->addValue("log_suppressed", (double)stats.suppressed, "count");
+
+	FILE *null = fopen("/dev/null", "w");
+	if (null == NULL) {
+		return;
+	}
+	for (int i = 0; i < LOG_ROUNDS * LOG_BURST; i++) {
+		uint64_t t0 = bench_now_ns();
+		fprintf(null, "delta between current OS and PPS sampled time is lower than 1s: %u ns\n", (uint32_t)i);
+		fflush(null);
+		sync_hist.record(bench_now_ns() - t0);
+	}
+	fclose(null);
+	report->add("log_fprintf", sync_hist);
+}
+
+// Edge capture latency (simulated edge to m_pps_ts) and end to end latency
+// (simulated edge to the wake up of a TEV_EPOCH waiter) over a few epochs.
+static void bench_epochs(BenchReport *report, TimeStamp *ts, GnssSim *sim, int epochs, const char *suffix = "") {
+
+	LatencyHistogram capture, valid;
+	TimeEvent ev;
+	uint32_t seq = ts->notifier().lastSeq(); // Only epochs seen live
+	int misses = 0;
+	for (int i = 0; i < epochs && misses < 3; ) {
+		if (ts->waitEvent(TEV_EPOCH, seq, &ev, 2000) != 0) {
+			misses++;
+			continue;
+		}
+		struct timespec wake, edge;
+		clock_gettime(CLOCK_REALTIME, &wake);
+		seq = ev.seq;
+		// The bracketed edge can fall just before the second boundary
+		if (sim->findEdge(ev.edge.tv_sec + (ev.edge.tv_nsec >= 500000000 ? 1 : 0), &edge) < 0) {
+			continue;
+		}
+		int64_t dcap = rt_delta_ns(&ev.edge, &edge);
+		capture.record(dcap > 0 ? dcap : -dcap); // Midpoint of the bracket, either side
+		valid.record(rt_delta_ns(&wake, &edge));
+		i++;
+	}
+	report->add(std::string("pps_edge_capture") + suffix, capture);
+	if (suffix[0] != '\0') {
+		return;
+	}
+	report->add("pps_to_valid", valid);
+	report->add("notify_to_wake", ts->notifier().wakeHistogram());
+	report->add("pps_edge_bracket", ts->latency(TimeStamp::LAT_PPS_BRACKET));
+}
+
+// Simulated FPGA latch: a 32 bit counter at 125 MHz + 20 ppm, sampled at
+// the simulated edge time
+#define SIM_COUNTER_PPM 	20.0
+#define SIM_BUFFER_SAMPLES 	16384
+
+static int sim_latch(void *arg, int64_t utc_sec, uint64_t *count) {
+	const GnssSim *sim = static_cast<const GnssSim*>(arg);
+	struct timespec edge;
+	if (sim->findEdge(utc_sec, &edge) < 0) {
+		return -1;
+	}
+	double ns = (double)(edge.tv_sec % 100000) * 1e9 + edge.tv_nsec;
+	*count = (uint64_t)llround(ns * SAMPLE_CLOCK_HZ * 1e-9 * (1 + SIM_COUNTER_PPM * 1e-6)) & 0xFFFFFFFFULL;
+	return 0;
+}
+
+static void bench_sample_clock(BenchReport *report, const SampleClock *clk) {
+
+	if (!clk->valid()) {
+		fprintf(stderr, "tstamp_bench: Error: no sample clock model\n");
+		return;
+	}
+	static int64_t utc_ns[SIM_BUFFER_SAMPLES];
+	uint64_t first = 0;
+	LatencyHistogram hist;
+	uint64_t t0 = bench_now_ns();
+	uint64_t ops = bench_run([&]() {
+		clk->toUtcBulk(first, SIM_BUFFER_SAMPLES, 1, utc_ns);
+		first += SIM_BUFFER_SAMPLES;
+		bench_keep(utc_ns[SIM_BUFFER_SAMPLES - 1]);
+	}, &hist, g_case_s);
+	uint64_t elapsed = bench_now_ns() - t0;
+	report->add("sample_clock_bulk_16k", hist, ops, elapsed);
+	report->addValue("sample_clock_ns_per_sample", ops > 0 ? (double)elapsed / ops / SIM_BUFFER_SAMPLES : 0, "ns");
+	report->addValue("sample_clock_rate_error", (clk->rateHz() / SAMPLE_CLOCK_HZ - 1) * 1e6 - SIM_COUNTER_PPM, "ppm");
+	report->addValue("sample_clock_residual", clk->residualNs(), "ns");
+}
+
+int main(int argc, char **argv) {
+
+	int epochs = 10;
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "e:t:o:")) != -1) {
+		switch (opt) {
+		case 'e': epochs = atoi(optarg); break;
+		case 't': g_case_s = atof(optarg); break;
+		case 'o': out_path = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-e epochs] [-t seconds per case] [-o file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+
+	BenchReport report("tstamp");
+	bench_parse(&report);
+	bench_log(&report);
+
+	// Diagnostics of the acquisition threads while benchmarking, as gps_demo:
+	// TSTAMP_LOG=file (or - for stderr), TSTAMP_LOG_LEVEL=0..3
+	const char *log_path = getenv("TSTAMP_LOG");
+	if (log_path != NULL) {
+		const char *log_level = getenv("TSTAMP_LOG_LEVEL");
+		tstamp_log_start(log_path, log_level != NULL ? atoi(log_level) : TLOG_INFO);
+	}
+
+	GnssSim sim;
+	if (sim.start() < 0) {
+		return EXIT_FAILURE;
+	}
+
+	TimeStamp::Options opts;
+	opts.state_file = NULL; // Always a cold start
+	opts.uart_device = sim.uartDevice();
+	opts.fpga_sim = true;
+
+	TimeStamp ts;
+	uint64_t t0 = bench_now_ns();
+	if (ts.init(opts) < 0) {
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	// Cold start: init() to the first epoch with the flags valid
+	TimeEvent ev;
+	uint32_t seq = 0;
+	int64_t first_valid = -1;
+	for (int i = 0; i < 5 && first_valid < 0; i++) {
+		if (ts.waitEvent(TEV_ALL, seq, &ev, 2000) != 0) {
+			continue;
+		}
+		seq = ev.seq;
+		if (ts.getFlags() == TimeStamp::TS_VALID && ev.kind == TEV_EPOCH) {
+			first_valid = (int64_t)(bench_now_ns() - t0);
+		}
+	}
+	if (first_valid < 0) {
+		fprintf(stderr, "tstamp_bench: Error: no valid epoch from the simulator (flags 0x%02X)\n", ts.getFlags());
+		ts.destroy();
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+	report.addValue("cold_start_to_valid", first_valid / 1e6, "ms");
+
+	bench_compute(&report, &ts);
+	bench_quality(&report, &ts);
+	for (int n = 1; n <= 4; n *= 2) {
+		bench_read(&report, &ts, n);
+	}
+	SampleClock clk(SAMPLE_CLOCK_HZ, 32);
+	clk.attach(ts, sim_latch, &sim);
+	bench_epochs(&report, &ts, &sim, epochs);
+	bench_sample_clock(&report, &clk);
+	clk.detach();
+
+	// Load spikes: one edge in four seen 1 ms late, caught by the outlier gate.
+	// The simulated edges already jitter by tens of us, hence the large spike.
+	TimeStamp::ClockState clk_state;
+	ts.getClockState(&clk_state);
+	uint32_t rejected = clk_state.rejected;
+	sim.setLateEdges(4, 1000);
+	bench_epochs(&report, &ts, &sim, epochs, "/late_edges");
+	sim.setLateEdges(0, 0);
+	ts.getClockState(&clk_state);
+	report.addValue("late_edges_rejected", clk_state.rejected - rejected, "count");
+
+	ts.destroy();
+
+	// Same acquisition as policies, labels behind a mutex or a seqlock, UBX
+	// labels, and edges timed by a virtual clock on the simulated registers
+	bench_core<TimeStampDefaultCore>(&report, "mutex", sim.uartDevice(), 4);
+	bench_core<TimeStampCore<PpsFpgaPoll<>, LabelNmea, SeqLock, ClockRealtime> >(&report, "seqlock", sim.uartDevice(), 4);
+	sim.setUbx(true);
+	bench_core<TimeStampCore<PpsFpgaPoll<>, LabelUbx, SeqLock, ClockRealtime> >(&report, "ubx", sim.uartDevice(), 4);
+	sim.setUbx(false);
+	bench_core<TimeStampCore<PpsFpgaPoll<>, LabelNmea, SeqLock, ClockVirtual> >(&report, "virtual", sim.uartDevice(), 4);
+
+	sim.stop();
+	tstamp_log_stop();
+
+	FILE *out = out_path ? fopen(out_path, "w") : stdout;
+	if (out == NULL) {
+		fprintf(stderr, "tstamp_bench: Error: cannot open %s\n", out_path);
+		return EXIT_FAILURE;
+	}
+	report.print(out);
+	if (out != stdout) {
+		fclose(out);
+	}
+
+	return EXIT_SUCCESS;
+}
@@ -0,0 +1,178 @@
+#include <ctime>
+
+#include "tstamp_codec.h"
+
+static inline uint64_t zigzag(int64_t v) {
+	return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63);
+}
+
+static inline int64_t unzigzag(uint64_t v) {
+	return (int64_t)(v >> 1) ^ -(int64_t)(v & 1);
+}
+
+TsEncoder::TsEncoder() {
+	clear();
+}
+
+void TsEncoder::clear() {
+	m_buf.clear();
+	m_index.clear();
+	m_open = false;
+	m_sec = 0;
+	m_flags = 0;
+	m_prev_nsec = 0;
+	m_prev_delta = 0;
+	m_events = 0;
+}
+
+inline void TsEncoder::putVarint(uint64_t v) {
+	while (v >= 0x80) {
+		m_buf.push_back((uint8_t)(v | 0x80));
+		v >>= 7;
+	}
+	m_buf.push_back((uint8_t)v);
+}
+
+void TsEncoder::append(int64_t sec, uint32_t nsec, uint8_t flags) {
+
+	if (!m_open || sec != m_sec || flags != m_flags) {
+		TsIndexEntry entry;
+		entry.sec = sec;
+		entry.offset = m_buf.size();
+		m_index.push_back(entry);
+
+		// The first block is relative to 0
+		putVarint(zigzag(sec - (m_open ? m_sec : 0)) << 1 | 1);
+		m_buf.push_back(flags);
+
+		m_open = true;
+		m_sec = sec;
+		m_flags = flags;
+		m_prev_nsec = 0;
+		m_prev_delta = 0;
+	}
+
+	int64_t delta = (int64_t)nsec - (int64_t)m_prev_nsec;
+	putVarint(zigzag(delta - m_prev_delta) << 1);
+	m_prev_nsec = nsec;
+	m_prev_delta = delta;
+	m_events++;
+}
+
+void TsEncoder::append(const TimeStamp::AbsoluteTime *absTime, uint8_t flags) {
+
+	// AbsoluteTime is not normalized: ss and us may overflow
+	uint64_t us = absTime->us;
+	struct tm tm_utc;
+	tm_utc.tm_year = absTime->year;
+	tm_utc.tm_mon = absTime->month;
+	tm_utc.tm_mday = absTime->day;
+	tm_utc.tm_hour = absTime->hh;
+	tm_utc.tm_min = absTime->mm;
+	tm_utc.tm_sec = absTime->ss + (int)(us / 1000000);
+	tm_utc.tm_isdst = 0;
+
+	append((int64_t)timegm(&tm_utc), (uint32_t)(us % 1000000) * 1000, flags);
+}
+
+TsDecoder::TsDecoder(const uint8_t *data, size_t size, const TsIndexEntry *index, size_t n_index) {
+	m_data = data;
+	m_size = size;
+	if (index != NULL) {
+		m_index.assign(index, index + n_index);
+	} else {
+		buildIndex();
+	}
+	rewind();
+}
+
+void TsDecoder::rewind() {
+	m_pos = 0;
+	m_sec = 0;
+	m_flags = 0;
+	m_prev_nsec = 0;
+	m_prev_delta = 0;
+	m_in_block = false;
+}
+
+inline bool TsDecoder::getVarint(uint64_t *v) {
+	uint64_t r = 0;
+	for (int shift = 0; shift < 64 && m_pos < m_size; shift += 7) {
+		uint8_t b = m_data[m_pos++];
+		r |= (uint64_t)(b & 0x7F) << shift;
+		if (!(b & 0x80)) {
+			*v = r;
+			return true;
+		}
+	}
+	return false;
+}
+
+void TsDecoder::buildIndex() {
+	rewind();
+	m_index.clear();
+	uint64_t v;
+	size_t start = m_pos;
+	while (getVarint(&v)) {
+		if (v & 1) {
+			m_sec += unzigzag(v >> 1);
+			TsIndexEntry entry;
+			entry.sec = m_sec;
+			entry.offset = start;
+			m_index.push_back(entry);
+			m_pos++; // Flags
+		}
+		start = m_pos;
+	}
+}
+
+bool TsDecoder::next(int64_t *sec, uint32_t *nsec, uint8_t *flags) {
+	uint64_t v;
+	while (getVarint(&v)) {
+		if (v & 1) { // New block
+			m_sec += unzigzag(v >> 1);
+			if (m_pos >= m_size) {
+				return false;
+			}
+			m_flags = m_data[m_pos++];
+			m_prev_nsec = 0;
+			m_prev_delta = 0;
+			m_in_block = true;
+			continue;
+		}
+		if (!m_in_block) {
+			return false;
+		}
+		int64_t delta = m_prev_delta + unzigzag(v >> 1);
+		m_prev_nsec = (uint32_t)((int64_t)m_prev_nsec + delta);
+		m_prev_delta = delta;
+		*sec = m_sec;
+		*nsec = m_prev_nsec;
+		*flags = m_flags;
+		return true;
+	}
+	return false;
+}
+
+int TsDecoder::seek(int64_t sec) {
+
+	// First entry with entry.sec >= sec
+	size_t lo = 0, hi = m_index.size();
+	while (lo < hi) {
+		size_t mid = (lo + hi) / 2;
+		if (m_index[mid].sec < sec) {
+			lo = mid + 1;
+		} else {
+			hi = mid;
+		}
+	}
+	if (lo == m_index.size()) {
+		return -1;
+	}
+
+	// Block seconds are relative to the previous block
+	rewind();
+	m_pos = m_index[lo].offset;
+	m_sec = lo > 0 ? m_index[lo - 1].sec : 0;
+	return 0;
+}
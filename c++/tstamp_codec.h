@@ -0,0 +1,93 @@
+#ifndef __TSTAMP_CODEC_H__
+#define __TSTAMP_CODEC_H__
+
+#include <cstdint>
+#include <cstddef>
+#include <vector>
+
+#include "tstamp.h"
+
+/* Compact stream of event timestamps.
+ *
+ * The stream is a sequence of blocks, one per PPS second (and a new one
+ * when the flags change). Every item is a varint whose low bit tells its
+ * kind:
+ *	block: zigzag(second - previous block second) << 1 | 1, then the flags byte
+ *	event: zigzag(delta of delta of the ns offset in the second) << 1
+ * Events at a steady rate cost one byte, a new second about three.
+ *
+ * The encoder keeps an index of the block offsets, used by the decoder to
+ * seek to a second. A stream without index can be indexed by scanning it.
+ */
+
+typedef struct {
+	int64_t sec; 		// Block second
+	uint64_t offset; 	// Byte offset of the block in the stream
+} TsIndexEntry;
+
+class TsEncoder {
+
+public:
+
+	TsEncoder();
+
+	// Append an event, sec/nsec must be non-decreasing across seconds.
+	void append(int64_t sec, uint32_t nsec, uint8_t flags);
+
+	// Append an event computed by TimeStamp::computeAbsoluteTime().
+	void append(const TimeStamp::AbsoluteTime *absTime, uint8_t flags);
+
+	const uint8_t *data() const { return m_buf.data(); }
+	size_t size() const { return m_buf.size(); }
+	const std::vector<TsIndexEntry> &index() const { return m_index; }
+	uint64_t events() const { return m_events; }
+
+	// Drop the encoded data, the next event starts a new stream.
+	void clear();
+
+private:
+
+	void putVarint(uint64_t v);
+
+	std::vector<uint8_t> m_buf;
+	std::vector<TsIndexEntry> m_index;
+	bool m_open; 			// A block is open
+	int64_t m_sec; 			// Second of the open block
+	uint8_t m_flags; 		// Flags of the open block
+	uint32_t m_prev_nsec;
+	int64_t m_prev_delta;
+	uint64_t m_events;
+};
+
+class TsDecoder {
+
+public:
+
+	// index may be NULL: it is then built by scanning the stream.
+	TsDecoder(const uint8_t *data, size_t size, const TsIndexEntry *index = NULL, size_t n_index = 0);
+
+	// Next event. Returns false at the end of the stream or on corrupted data.
+	bool next(int64_t *sec, uint32_t *nsec, uint8_t *flags);
+
+	// Position on the first block with second >= sec. Returns -1 if none.
+	int seek(int64_t sec);
+
+	void rewind();
+
+private:
+
+	bool getVarint(uint64_t *v);
+	void buildIndex();
+
+	const uint8_t *m_data;
+	size_t m_size;
+	size_t m_pos;
+	std::vector<TsIndexEntry> m_index;
+	int64_t m_sec;
+	uint8_t m_flags;
+	uint32_t m_prev_nsec;
+	int64_t m_prev_delta;
+	bool m_in_block;
+};
+
+#endif /* __TSTAMP_CODEC_H__ */
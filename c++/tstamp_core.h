@@ -0,0 +1,259 @@
+#ifndef __TSTAMP_CORE_H__
+#define __TSTAMP_CORE_H__
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <atomic>
+#include <pthread.h>
+#include <unistd.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+
+#include "tstamp.h"
+#include "tstamp_policy.h"
+#include "tstamp_acq.h"
+
+/* Time stamping core configured at compile time. The PPS source, the label
+ * source, the synchronization between the two threads and read(), the clock
+ * of the edges and the flag behaviour are policies (tstamp_policy.h), so a
+ * deployment compiles only the path it uses, e.g. a busy polled FPGA input
+ * with SeqLock published labels:
+ *
+ *   TimeStampCore<PpsFpgaPoll<0>, LabelUbx, SeqLock, ClockHwCounter> core;
+ *
+ * and a bench test can run it on simulated registers with ClockVirtual.
+ * With ClockHwCounter, hw_counter_init() and clock().reset() come before
+ * init(). The status flags, CurrentTime and the acquisition loops are
+ * those of TimeStamp (tstamp_acq.h), but TS_NOTIME compares the label with
+ * the UTC time of the edge rather than the local time. TimeStamp keeps the
+ * runtime options and the servo, holdover, journal, notifier and exporters,
+ * on top of the same PPS sources and clocks.
+ */
+template <class PpsSource, class LabelSource, template <typename> class SyncPolicy, class ClockSource,
+	class FlagPolicy = TSTAMP_FLAG_POLICY>
+class TimeStampCore {
+
+public:
+
+	typedef TimeStamp::StatusFlags StatusFlags;
+	typedef TimeStamp::CurrentTime CurrentTime;
+
+	TimeStampCore() : m_started(false), m_open(false), m_stop_fd(-1), m_stop(false) {
+		m_status = TimeStamp::TS_NOPPS | TimeStamp::TS_NOUART | TimeStamp::TS_OVTIME | TimeStamp::TS_NOTIME;
+	}
+
+	~TimeStampCore() {
+		destroy();
+		if (m_stop_fd >= 0) {
+			close(m_stop_fd);
+		}
+	}
+
+	int init(const TimeStampCoreConfig &cfg = TimeStampCoreConfig()) {
+
+		if (m_open) {
+			return 0;
+		}
+
+		if (m_stop_fd < 0) {
+			m_stop_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+			if (m_stop_fd < 0) {
+				fprintf(stderr, "TimeStampCore::init: Error: eventfd() failed\n");
+				return -1;
+			}
+		}
+
+		if (m_pps.open(cfg) < 0) {
+			return -1;
+		}
+		if (m_label.open(cfg) < 0) {
+			fprintf(stderr, "TimeStampCore::init: Error: label source open failed\n");
+			m_pps.close();
+			return -1;
+		}
+		m_open = true;
+
+		uint64_t val;
+		while (::read(m_stop_fd, &val, sizeof(val)) > 0) {}
+		m_stop = false;
+
+		if (pthread_create(&m_pps_thread, NULL, ppsThread, this) != 0) {
+			fprintf(stderr, "TimeStampCore::init: Error: pps acquisition thread creation failed\n");
+			closeSources();
+			return -1;
+		}
+		if (pthread_create(&m_label_thread, NULL, labelThread, this) != 0) {
+			fprintf(stderr, "TimeStampCore::init: Error: label acquisition thread creation failed\n");
+			stopThreads(false);
+			closeSources();
+			return -1;
+		}
+		m_started = true;
+
+		return 0;
+	}
+
+	void destroy() {
+		if (m_started) {
+			stopThreads(true);
+			m_started = false;
+		}
+		closeSources();
+	}
+
+	StatusFlags getFlags() const { return m_status.load(std::memory_order_acquire); }
+	void clearFlags() { m_status.store(TimeStamp::TS_VALID, std::memory_order_release); }
+
+	// Last labelled edge, as TimeStamp::read(). uncertainty_ns (optional) is
+	// the +- bound of currTime->ts. Set only when valid.
+	uint32_t read(CurrentTime *currTime, uint32_t *uncertainty_ns = NULL) {
+		Label label;
+		m_tstamp.load(&label);
+		StatusFlags flags = getFlags();
+		if (flags == TimeStamp::TS_VALID) {
+			currTime->ts = label.ts;
+			currTime->hh = label.hh;
+			currTime->mm = label.mm;
+			currTime->ss = label.ss;
+			currTime->us = label.us;
+			if (uncertainty_ns != NULL) {
+				*uncertainty_ns = label.unc_ns;
+			}
+		}
+		return flags;
+	}
+
+	// Policy instances, to drive simulators and virtual clocks
+	PpsSource &pps() { return m_pps; }
+	LabelSource &label() { return m_label; }
+	ClockSource &clock() { return m_clock; }
+
+private:
+
+	template <class> friend struct TimeStampAcq;
+	typedef TimeStampAcq<FlagPolicy> Acq;
+
+	// Last PPS edge, written by the PPS thread
+	typedef struct {
+		bool valid;
+		struct timespec ts;
+		uint64_t ticks;
+		uint32_t unc_ns;
+	} Edge;
+
+	// Labelled edge, written by the label thread
+	typedef struct {
+		struct timespec ts;
+		uint32_t hh;
+		uint32_t mm;
+		uint32_t ss;
+		uint32_t us;
+		uint32_t unc_ns;
+	} Label;
+
+	PpsSource m_pps;
+	LabelSource m_label;
+	ClockSource m_clock;
+	SyncPolicy<Edge> m_edge;
+	SyncPolicy<Label> m_tstamp;
+
+	std::atomic<StatusFlags> m_status;
+
+	bool m_started;
+	bool m_open;
+	int m_stop_fd; // eventfd used to wake up the threads on shutdown
+	std::atomic<bool> m_stop;
+	pthread_t m_pps_thread;
+	pthread_t m_label_thread;
+
+	void applyFlags(StatusFlags raise, StatusFlags clear) {
+		if (raise != 0) {
+			m_status.fetch_or(raise, std::memory_order_acq_rel);
+		}
+		if (clear != 0) {
+			m_status.fetch_and((StatusFlags)~clear, std::memory_order_acq_rel);
+		}
+	}
+
+	bool stopRequested() const { return m_stop.load(std::memory_order_relaxed); }
+
+	// Sleep up to timeout_ms, returns true as soon as a shutdown is requested.
+	bool waitStop(int timeout_ms) {
+		struct pollfd pfd;
+		pfd.fd = m_stop_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		poll(&pfd, 1, timeout_ms);
+		return stopRequested();
+	}
+
+	// Wake up the threads blocked on m_stop_fd and join them, the label
+	// thread only if it was started
+	void stopThreads(bool label_started) {
+		m_stop = true;
+		uint64_t one = 1;
+		if (write(m_stop_fd, &one, sizeof(one)) < 0) {
+			fprintf(stderr, "TimeStampCore::stopThreads: Error: eventfd write failed\n");
+		}
+		if (label_started) {
+			pthread_join(m_label_thread, NULL);
+		}
+		pthread_join(m_pps_thread, NULL);
+	}
+
+	void closeSources() {
+		if (m_open) {
+			m_label.close();
+			m_pps.close();
+			m_open = false;
+		}
+	}
+
+	void onEdge(const PpsEdge *pps) {
+		Edge edge = { true, pps->ts, pps->ticks, pps->unc_ns };
+		m_edge.store(edge);
+	}
+
+	void onPpsMiss(const PpsEdge *) {}
+
+	// Pair the label with the last edge, checked against the UTC time of the edge
+	void label_pair(const nmea_gga_t *gga) {
+
+		Edge edge;
+		m_edge.load(&edge);
+		uint64_t now = m_clock.now();
+		int64_t delay = edge.valid ? m_clock.toNs((int64_t)(now - edge.ticks)) : -1;
+		int edge_sod = (int)(edge.ts.tv_sec % 86400);
+		int minute_diff;
+		StatusFlags raise, clear;
+		if (Acq::pairFlags(delay, gga->hh, gga->mm, edge_sod / 3600, (edge_sod / 60) % 60, &minute_diff, &raise, &clear)) {
+			Label label;
+			label.ts = edge.ts;
+			label.hh = gga->hh;
+			label.mm = gga->mm;
+			label.ss = gga->ss;
+			label.us = gga->us;
+			label.unc_ns = edge.unc_ns;
+			m_tstamp.store(label);
+		}
+		applyFlags(raise, clear);
+	}
+
+	static void *ppsThread(void *ptr) {
+		TimeStampCore *core = static_cast<TimeStampCore *>(ptr);
+		Acq::ppsLoop(core, core->m_pps, core->m_clock);
+		return NULL;
+	}
+
+	static void *labelThread(void *ptr) {
+		TimeStampCore *core = static_cast<TimeStampCore *>(ptr);
+		Acq::labelLoop(core, core->m_label);
+		return NULL;
+	}
+};
+
+// PPS and label path of TimeStamp with the default Options, without its servo and services
+typedef TimeStampCore<PpsFpgaPoll<>, LabelNmea, SyncMutex, ClockRealtime> TimeStampDefaultCore;
+
+#endif /* __TSTAMP_CORE_H__ */
@@ -0,0 +1,135 @@
+#ifdef TSTAMP_COROUTINES
+
+#include <unistd.h>
+#include <sys/eventfd.h>
+
+#include "tstamp_coro.h"
+
+TimeAwaiter::TimeAwaiter(TimeEventLoop *loop, uint32_t kind, TimeStamp::StatusFlags mask) : m_loop(loop) {
+	m_node.next = nullptr;
+	m_node.kind = kind;
+	m_node.mask = mask;
+	m_node.ev = TimeEvent();
+}
+
+void TimeAwaiter::await_suspend(std::coroutine_handle<> h) {
+	m_node.handle = h;
+	TimeEventLoop::push(m_node.kind == TEV_EPOCH ? m_loop->m_epoch_waiting : m_loop->m_flags_waiting, &m_node, &m_node);
+}
+
+TimeEventLoop::TimeEventLoop(TimeStamp &tstamp) : m_tstamp(tstamp), m_sub(-1), m_epoch_waiting(nullptr),
+	m_flags_waiting(nullptr), m_ready(nullptr), m_flags_changed(0) {
+	m_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (m_fd >= 0) {
+		m_sub = m_tstamp.subscribe(TEV_ALL, onEvent, this);
+	}
+}
+
+TimeEventLoop::~TimeEventLoop() {
+	m_tstamp.unsubscribe(m_sub);
+	if (m_fd >= 0) {
+		close(m_fd);
+	}
+}
+
+void TimeEventLoop::push(std::atomic<TimeWaiter *> &list, TimeWaiter *first, TimeWaiter *last) {
+	TimeWaiter *head = list.load(std::memory_order_relaxed);
+	do {
+		last->next = head;
+	} while (!list.compare_exchange_weak(head, first, std::memory_order_release, std::memory_order_relaxed));
+}
+
+// Called by the publishing threads: no lock and no walk of the tasks left
+// waiting. Every epoch waiter matches, the detached list goes to the ready
+// list whole. The flag waiters are matched by runReady().
+void TimeEventLoop::onEvent(const TimeEvent *ev, void *arg) {
+	TimeEventLoop *loop = static_cast<TimeEventLoop *>(arg);
+
+	if (ev->kind == TEV_EPOCH) {
+		TimeWaiter *first = loop->m_epoch_waiting.exchange(nullptr, std::memory_order_acquire);
+		if (first == nullptr) {
+			return;
+		}
+		TimeWaiter *last = first;
+		for (;;) {
+			last->ev = *ev;
+			if (last->next == nullptr) {
+				break;
+			}
+			last = last->next;
+		}
+		push(loop->m_ready, first, last);
+	} else {
+		uint32_t changed = (uint32_t)(ev->flags ^ ev->old_flags);
+		if (changed == 0) {
+			return;
+		}
+		loop->m_flags_changed.fetch_or(changed, std::memory_order_release);
+	}
+
+	uint64_t one = 1;
+	if (write(loop->m_fd, &one, sizeof(one)) < 0) {
+		// Already signalled
+	}
+}
+
+void TimeEventLoop::runReady() {
+	uint64_t val;
+	if (read(m_fd, &val, sizeof(val)) < 0) {
+		// Nothing pending
+	}
+
+	// Flag waiters of the changed bits, the others go back
+	TimeWaiter *flags_fifo = nullptr;
+	uint32_t changed = m_flags_changed.exchange(0, std::memory_order_acquire);
+	if (changed != 0) {
+		TimeEvent ev = TimeEvent();
+		ev.kind = TEV_FLAGS;
+		ev.flags = m_tstamp.getFlags();
+		ev.old_flags = (uint8_t)(ev.flags ^ changed);
+		clock_gettime(CLOCK_MONOTONIC, &ev.notify_ts);
+
+		TimeWaiter *node = m_flags_waiting.exchange(nullptr, std::memory_order_acquire);
+		TimeWaiter *keep = nullptr, *keep_last = nullptr;
+		while (node != nullptr) {
+			TimeWaiter *next = node->next;
+			if (node->mask & changed) {
+				node->ev = ev;
+				node->next = flags_fifo;
+				flags_fifo = node;
+			} else {
+				node->next = nullptr;
+				if (keep_last == nullptr) {
+					keep = node;
+				} else {
+					keep_last->next = node;
+				}
+				keep_last = node;
+			}
+			node = next;
+		}
+		if (keep != nullptr) {
+			push(m_flags_waiting, keep, keep_last);
+		}
+	}
+
+	// Epoch waiters, in arrival order
+	TimeWaiter *node = m_ready.exchange(nullptr, std::memory_order_acquire);
+	TimeWaiter *fifo = nullptr;
+	while (node != nullptr) {
+		TimeWaiter *next = node->next;
+		node->next = fifo;
+		fifo = node;
+		node = next;
+	}
+
+	for (TimeWaiter *list : { fifo, flags_fifo }) {
+		while (list != nullptr) {
+			TimeWaiter *next = list->next; // The node dies with the frame once resumed
+			list->handle.resume();
+			list = next;
+		}
+	}
+}
+
+#endif /* TSTAMP_COROUTINES */
@@ -0,0 +1,120 @@
+#ifndef __TSTAMP_CORO_H__
+#define __TSTAMP_CORO_H__
+
+/* C++20 coroutine awaitables for the TimeStamp events.
+ * Opt-in: build with -std=c++20 -DTSTAMP_COROUTINES, the rest of the library
+ * stays C++11 (see the coro_bench rule of the Makefile).
+ *
+ *	TimeEventLoop loop(tstamp);
+ *	// add loop.fd() to the epoll set, call loop.runReady() when readable
+ *
+ *	TimeTask daq(TimeEventLoop &loop) {
+ *		for (;;) {
+ *			TimeEvent ev = co_await loop.nextEpoch();
+ *			...
+ *		}
+ *	}
+ *
+ * Waiting tasks cost one node in their coroutine frame, no thread and no
+ * allocation. The tasks are kept in one waiting list per event kind and the
+ * publishing thread never walks the tasks it does not resume, nor takes a
+ * lock: on an epoch it detaches the whole epoch list to the ready list, on a
+ * flag transition it only records the changed bits. It then signals the
+ * eventfd and the thread calling runReady() resumes the tasks, matching the
+ * flag waiters against the bits changed since the last call. A flag waiter
+ * may thus see a transition published just before it started waiting.
+ */
+
+#ifdef TSTAMP_COROUTINES
+
+#if !defined(__cpp_impl_coroutine)
+	#error "TSTAMP_COROUTINES requires C++20 coroutines (-std=c++20)"
+#endif
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+
+#include "tstamp.h"
+
+class TimeEventLoop;
+
+// Fire and forget coroutine type, the frame is freed when the task returns.
+struct TimeTask {
+	struct promise_type {
+		TimeTask get_return_object() { return TimeTask(); }
+		std::suspend_never initial_suspend() noexcept { return {}; }
+		std::suspend_never final_suspend() noexcept { return {}; }
+		void return_void() {}
+		void unhandled_exception() { std::terminate(); }
+	};
+};
+
+// Node of a waiting coroutine, lives in the awaiter in the coroutine frame.
+struct TimeWaiter {
+	TimeWaiter *next;
+	uint32_t kind; 					// TEV_EPOCH or TEV_FLAGS
+	TimeStamp::StatusFlags mask; 	// Flags of interest (TEV_FLAGS)
+	std::coroutine_handle<> handle;
+	TimeEvent ev; 					// Event which resumed the coroutine. TEV_FLAGS: flags
+									// read by runReady(), old_flags with the changed bits
+									// toggled, no seq
+};
+
+class TimeAwaiter {
+
+public:
+
+	TimeAwaiter(TimeEventLoop *loop, uint32_t kind, TimeStamp::StatusFlags mask);
+
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h);
+	TimeEvent await_resume() const noexcept { return m_node.ev; }
+
+private:
+
+	TimeEventLoop *m_loop;
+	TimeWaiter m_node;
+};
+
+class TimeEventLoop {
+
+public:
+
+	explicit TimeEventLoop(TimeStamp &tstamp);
+	~TimeEventLoop();
+
+	// eventfd readable when some tasks are ready to be resumed, -1 on error.
+	int fd() const { return m_fd; }
+
+	// Resume the ready tasks in the calling thread.
+	void runReady();
+
+	// Resumed on the next validated PPS epoch.
+	TimeAwaiter nextEpoch() { return TimeAwaiter(this, TEV_EPOCH, 0); }
+
+	// Resumed on the next transition of one of the flags in mask.
+	TimeAwaiter flagsChanged(TimeStamp::StatusFlags mask) { return TimeAwaiter(this, TEV_FLAGS, mask); }
+
+private:
+
+	friend class TimeAwaiter;
+
+	static void onEvent(const TimeEvent *ev, void *arg);
+
+	// Push the nodes first..last, linked through next, on list
+	static void push(std::atomic<TimeWaiter *> &list, TimeWaiter *first, TimeWaiter *last);
+
+	TimeStamp &m_tstamp;
+	int m_sub;
+	int m_fd;
+
+	std::atomic<TimeWaiter *> m_epoch_waiting;
+	std::atomic<TimeWaiter *> m_flags_waiting;
+	std::atomic<TimeWaiter *> m_ready; 			// Epoch waiters with their event
+	std::atomic<uint32_t> m_flags_changed; 		// Bits changed since the last runReady()
+};
+
+#endif /* TSTAMP_COROUTINES */
+
+#endif /* __TSTAMP_CORO_H__ */
@@ -0,0 +1,129 @@
+#include <cstdio>
+#include <cstdlib>
+#include <unistd.h>
+#include <signal.h>
+
+#include "tstamp.h"
+#include "gnss_sim.h"
+#include "latency_probe.h"
+#include "bench.h"
+
+// End to end PPS to consumer latency, reported every interval.
+//
+//	tstamp_latency [-l] [-p poll_us] [-i interval s] [-d duration s] [-o file]
+//
+// By default the PPS and the GGA are simulated (gnss_sim.h). With -l the real
+// FPGA and receiver are used and the PPS input is driven through the digital
+// loopback, the receiver PPS must be disconnected from DIO7_P.
+
+static volatile bool running = true;
+
+static void signal_handler(int sig) {
+	running = false;
+}
+
+static int sim_lookup(void *arg, int64_t sec, struct timespec *edge) {
+	return static_cast<GnssSim*>(arg)->findEdge(sec, edge);
+}
+
+static void print_line(const LatencyProbe &probe) {
+	const LatencyHistogram &e2e = probe.endToEnd();
+	const LatencyHistogram &cap = probe.capture();
+	printf("epochs %u unmatched %u | e2e ms p50 %.3f p99 %.3f max %.3f | capture us p50 %.1f p99 %.1f max %.1f\n",
+		probe.epochs(), probe.unmatched(),
+		e2e.percentile(0.5) / 1e6, e2e.percentile(0.99) / 1e6, e2e.max() / 1e6,
+		cap.percentile(0.5) / 1e3, cap.percentile(0.99) / 1e3, cap.max() / 1e3);
+	fflush(stdout);
+}
+
+int main(int argc, char **argv) {
+
+	bool loopback = false;
+	uint32_t poll_us = LATENCY_PROBE_POLL_US;
+	int interval = 10;
+	int duration = 0;
+	const char *out_path = NULL;
+	int opt;
+	while ((opt = getopt(argc, argv, "lp:i:d:o:")) != -1) {
+		switch (opt) {
+		case 'l': loopback = true; break;
+		case 'p': poll_us = (uint32_t)atoi(optarg); break;
+		case 'i': interval = atoi(optarg); break;
+		case 'd': duration = atoi(optarg); break;
+		case 'o': out_path = optarg; break;
+		default:
+			fprintf(stderr, "usage: %s [-l] [-p poll_us] [-i interval s] [-d duration s] [-o file]\n", argv[0]);
+			return EXIT_FAILURE;
+		}
+	}
+	if (interval <= 0) {
+		interval = 10;
+	}
+
+	signal(SIGINT, signal_handler);
+	signal(SIGTERM, signal_handler);
+
+	GnssSim sim;
+	TimeStamp ts;
+	TimeStamp::Options opts;
+	opts.state_file = NULL;
+
+	if (loopback) {
+		if (ts.init(opts) < 0) {
+			return EXIT_FAILURE;
+		}
+		if (sim.startLoopback() < 0) {
+			ts.destroy();
+			return EXIT_FAILURE;
+		}
+	} else {
+		if (sim.start() < 0) {
+			return EXIT_FAILURE;
+		}
+		opts.uart_device = sim.uartDevice();
+		opts.fpga_sim = true;
+		if (ts.init(opts) < 0) {
+			sim.stop();
+			return EXIT_FAILURE;
+		}
+	}
+
+	LatencyProbe probe(ts);
+	if (probe.start(sim_lookup, &sim, poll_us) < 0) {
+		ts.destroy();
+		sim.stop();
+		return EXIT_FAILURE;
+	}
+
+	for (int t = 1; running && (duration == 0 || t <= duration); t++) {
+		sleep(1);
+		if (t % interval == 0) {
+			print_line(probe);
+		}
+	}
+
+	probe.stop();
+	if (loopback) {
+		sim.stop(); // Restores the FPGA registers before they are unmapped
+		ts.destroy();
+	} else {
+		ts.destroy();
+		sim.stop();
+	}
+
+	if (out_path != NULL) {
+		FILE *out = fopen(out_path, "w");
+		if (out == NULL) {
+			fprintf(stderr, "tstamp_latency: Error: cannot open %s\n", out_path);
+			return EXIT_FAILURE;
+		}
+		BenchReport report("latency");
+		report.add("pps_to_read", probe.endToEnd());
+		report.add("pps_edge_capture", probe.capture());
+		report.addValue("unmatched", probe.unmatched(), "count");
+		report.print(out);
+		fclose(out);
+	}
+
+	return EXIT_SUCCESS;
+}
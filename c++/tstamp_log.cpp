@@ -0,0 +1,319 @@
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <time.h>
+#include <errno.h>
+#include <unistd.h>
+#include <poll.h>
+#include <pthread.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+
+#include "tstamp_log.h"
+
+// Message table, indexed by LogId. With err set, a is an errno printed with
+// strerror() by the first %s of the format.
+static const struct {
+	uint8_t level;
+	bool err;
+	const char *name;
+	const char *fmt;
+} g_log_msgs[TL_COUNT] = {
+	{ TLOG_ERROR, true, "uart_read", "UART read error: %s" },
+	{ TLOG_ERROR, true, "uart_read", "Select error: %s" },
+	{ TLOG_ERROR, false, "gpsd_read", "connection lost or refused (errno %lld)" },
+	{ TLOG_ERROR, true, "pps_dev_fetch", "PPS_FETCH failed: %s" },
+	{ TLOG_DEBUG, false, "pps", "PPS received at %lld.%09lld +- %lld ns" },
+	{ TLOG_WARN, false, "pps", "PPS not received" },
+	{ TLOG_DEBUG, false, "gga", "delta between current OS and PPS sampled time is lower than 1s: %lld ns" },
+	{ TLOG_WARN, false, "gga", "not checking time, delta between current OS and PPS sampled time is greater than 1s: %lld ns" },
+	{ TLOG_WARN, false, "gga", "System time is not within the threshold of GNGGA time: current %lld:%02lld ; gps %lld:%02lld" },
+	{ TLOG_DEBUG, false, "gga", "System time is within %lld minutes of GNGGA time. difference %lld min" },
+	{ TLOG_ERROR, true, "tstamp_state_save", "cannot create the temporary state file: %s" },
+	{ TLOG_ERROR, true, "tstamp_state_save", "state file write failed: %s" },
+	{ TLOG_ERROR, true, "pps_journal", "cannot open the journal file: %s" },
+	{ TLOG_ERROR, true, "pps_journal", "ftruncate failed: %s" },
+	{ TLOG_ERROR, true, "pps_journal", "mmap failed: %s" },
+	{ TLOG_ERROR, true, "pps_journal", "rename to .1 failed, journal overwritten: %s" },
+	{ TLOG_ERROR, false, "time_scale_update", "TAI-UTC %lld s, table says %lld s" },
+};
+
+static const char *g_log_level_names[] = { "ERROR", "WARN", "INFO", "DEBUG" };
+
+// Bounded multi producer queue: each cell carries the position it is
+// expected at, producers claim a position with a CAS on the tail, the
+// single consumer frees the cell by moving its sequence one lap ahead.
+typedef struct {
+	std::atomic<uint64_t> seq;
+	log_record_t rec;
+} log_cell_t;
+
+static log_cell_t g_log_cells[TSTAMP_LOG_RECORDS];
+static std::atomic<uint64_t> g_log_tail(0);
+static uint64_t g_log_head = 0; // Writer thread only
+
+static std::atomic<bool> g_log_running(false);
+static std::atomic<int> g_log_level(TLOG_INFO);
+static std::atomic<uint64_t> g_log_dropped(0);
+static std::atomic<uint64_t> g_log_written(0);
+static std::atomic<uint64_t> g_log_suppressed(0);
+
+static FILE *g_log_out = NULL;
+static int g_log_stop_fd = -1;
+static pthread_t g_log_thread;
+
+// Rate limit state per message ID, writer thread only
+static uint64_t g_log_window_ns[TL_COUNT];
+static uint32_t g_log_burst[TL_COUNT];
+static uint32_t g_log_held[TL_COUNT];
+
+static inline uint64_t realtime_ns() {
+	struct timespec ts;
+	clock_gettime(CLOCK_REALTIME, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
+static void log_format(FILE *out, const log_record_t *rec) {
+
+	char msg[256];
+	if (g_log_msgs[rec->id].err) {
+		snprintf(msg, sizeof(msg), g_log_msgs[rec->id].fmt, strerror((int)rec->a));
+	} else {
+		snprintf(msg, sizeof(msg), g_log_msgs[rec->id].fmt, (long long)rec->a, (long long)rec->b,
+			(long long)rec->c, (long long)rec->d);
+	}
+
+	time_t sec = (time_t)(rec->ts_ns / 1000000000ULL);
+	struct tm tm;
+	gmtime_r(&sec, &tm);
+	fprintf(out, "%02d:%02d:%02d.%06u %-5s %s[%u]: %s\n", tm.tm_hour, tm.tm_min, tm.tm_sec,
+		(unsigned)(rec->ts_ns % 1000000000ULL / 1000), g_log_level_names[g_log_msgs[rec->id].level],
+		g_log_msgs[rec->id].name, rec->tid, msg);
+}
+
+// Report the records held back in the window of id
+static void log_report_held(int id) {
+	if (g_log_held[id] > 0) {
+		fprintf(g_log_out, "%-5s %s: %u similar messages suppressed\n", g_log_level_names[g_log_msgs[id].level],
+			g_log_msgs[id].name, g_log_held[id]);
+		g_log_held[id] = 0;
+	}
+}
+
+// Report the records held back by windows that are over
+static void log_flush_held(uint64_t now) {
+	for (int id = 0; id < TL_COUNT; id++) {
+		if (now - g_log_window_ns[id] >= TSTAMP_LOG_PERIOD_MS * 1000000ULL) {
+			log_report_held(id);
+		}
+	}
+}
+
+// Drain the queue, returns the records taken
+static int log_drain() {
+
+	int n = 0;
+	for (;;) {
+		log_cell_t *cell = &g_log_cells[g_log_head & (TSTAMP_LOG_RECORDS - 1)];
+		if (cell->seq.load(std::memory_order_acquire) != g_log_head + 1) {
+			break;
+		}
+		log_record_t rec = cell->rec;
+		cell->seq.store(g_log_head + TSTAMP_LOG_RECORDS, std::memory_order_release);
+		g_log_head++;
+		n++;
+
+		if (rec.id >= TL_COUNT) {
+			continue;
+		}
+		if (rec.ts_ns - g_log_window_ns[rec.id] >= TSTAMP_LOG_PERIOD_MS * 1000000ULL) {
+			log_report_held(rec.id); // Count of the old window first
+			g_log_window_ns[rec.id] = rec.ts_ns;
+			g_log_burst[rec.id] = 0;
+		}
+		if (g_log_burst[rec.id] >= TSTAMP_LOG_BURST) {
+			g_log_held[rec.id]++;
+			g_log_suppressed.fetch_add(1, std::memory_order_relaxed);
+			continue;
+		}
+		g_log_burst[rec.id]++;
+		log_format(g_log_out, &rec);
+		g_log_written.fetch_add(1, std::memory_order_relaxed);
+	}
+	return n;
+}
+
+static void *logThreadFcn(void *) {
+
+	struct pollfd pfd;
+	pfd.fd = g_log_stop_fd;
+	pfd.events = POLLIN;
+	bool stop = false;
+	while (!stop) {
+		pfd.revents = 0;
+		stop = poll(&pfd, 1, TSTAMP_LOG_FLUSH_MS) > 0;
+		if (log_drain() > 0) {
+			fflush(g_log_out);
+		}
+		log_flush_held(realtime_ns());
+	}
+	log_drain();
+	log_flush_held(UINT64_MAX);
+	fflush(g_log_out);
+
+	return NULL;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Start the writer thread
+ *
+ * @param path  Log file, appended to. NULL or "-" for stderr
+ * @param level Most verbose LogLevel written
+ *
+ * @retval  0 Success
+ * @retval -1 Already started, file or thread error
+ *--------------------------------------------------------------------------------------*/
+int tstamp_log_start(const char *path, int level) {
+
+	if (g_log_running.load(std::memory_order_acquire)) {
+		fprintf(stderr, "tstamp_log_start: Error: already started\n");
+		return -1;
+	}
+
+	if (path == NULL || strcmp(path, "-") == 0) {
+		g_log_out = stderr;
+	} else {
+		g_log_out = fopen(path, "a");
+		if (g_log_out == NULL) {
+			fprintf(stderr, "tstamp_log_start: Error: cannot open %s: %s\n", path, strerror(errno));
+			return -1;
+		}
+	}
+
+	g_log_stop_fd = eventfd(0, EFD_CLOEXEC);
+	if (g_log_stop_fd < 0) {
+		fprintf(stderr, "tstamp_log_start: Error: eventfd() failed\n");
+		if (g_log_out != stderr) {
+			fclose(g_log_out);
+		}
+		return -1;
+	}
+
+	for (uint64_t i = 0; i < TSTAMP_LOG_RECORDS; i++) {
+		g_log_cells[i].seq.store(i, std::memory_order_relaxed);
+	}
+	g_log_head = 0;
+	g_log_tail.store(0, std::memory_order_relaxed);
+	memset(g_log_window_ns, 0, sizeof(g_log_window_ns));
+	memset(g_log_burst, 0, sizeof(g_log_burst));
+	memset(g_log_held, 0, sizeof(g_log_held));
+	g_log_dropped = 0;
+	g_log_written = 0;
+	g_log_suppressed = 0;
+	g_log_level.store(level, std::memory_order_relaxed);
+
+	if (pthread_create(&g_log_thread, NULL, logThreadFcn, NULL) != 0) {
+		fprintf(stderr, "tstamp_log_start: Error: writer thread creation failed\n");
+		close(g_log_stop_fd);
+		g_log_stop_fd = -1;
+		if (g_log_out != stderr) {
+			fclose(g_log_out);
+		}
+		return -1;
+	}
+
+	g_log_running.store(true, std::memory_order_release);
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Stop the writer thread after writing the queued records
+ *
+ * Records logged while stopping may be lost. Calls made after the return
+ * fall back to stderr for errors.
+ *--------------------------------------------------------------------------------------*/
+void tstamp_log_stop() {
+
+	if (!g_log_running.exchange(false, std::memory_order_acq_rel)) {
+		return;
+	}
+
+	uint64_t one = 1;
+	if (write(g_log_stop_fd, &one, sizeof(one)) < 0) {
+		fprintf(stderr, "tstamp_log_stop: Error: eventfd write failed\n");
+	}
+	pthread_join(g_log_thread, NULL);
+
+	close(g_log_stop_fd);
+	g_log_stop_fd = -1;
+	if (g_log_out != stderr) {
+		fclose(g_log_out);
+	}
+	g_log_out = NULL;
+}
+
+void tstamp_log_level(int level) {
+	g_log_level.store(level, std::memory_order_relaxed);
+}
+
+void tstamp_log_stats(log_stats_t *stats) {
+	stats->written = g_log_written.load(std::memory_order_relaxed);
+	stats->dropped = g_log_dropped.load(std::memory_order_relaxed);
+	stats->suppressed = g_log_suppressed.load(std::memory_order_relaxed);
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Log message id with its arguments
+ *
+ * Lock-free and wait-free apart from the CAS retries between concurrent
+ * callers: one clock read and a record copy. Messages above the level are
+ * discarded before touching the queue.
+ *--------------------------------------------------------------------------------------*/
+void tstamp_log(uint16_t id, int64_t a, int64_t b, int64_t c, int64_t d) {
+
+	if (id >= TL_COUNT || g_log_msgs[id].level > g_log_level.load(std::memory_order_relaxed)) {
+		return;
+	}
+
+	log_record_t rec;
+	rec.ts_ns = realtime_ns();
+	rec.id = id;
+	rec.reserved = 0;
+	static thread_local uint32_t t_tid = 0;
+	if (t_tid == 0) {
+		t_tid = (uint32_t)syscall(SYS_gettid);
+	}
+	rec.tid = t_tid;
+	rec.a = a;
+	rec.b = b;
+	rec.c = c;
+	rec.d = d;
+
+	if (!g_log_running.load(std::memory_order_acquire)) {
+		// No writer: errors go straight to stderr
+		if (g_log_msgs[id].level == TLOG_ERROR) {
+			log_format(stderr, &rec);
+		}
+		return;
+	}
+
+	uint64_t pos = g_log_tail.load(std::memory_order_relaxed);
+	log_cell_t *cell;
+	for (;;) {
+		cell = &g_log_cells[pos & (TSTAMP_LOG_RECORDS - 1)];
+		int64_t diff = (int64_t)(cell->seq.load(std::memory_order_acquire) - pos);
+		if (diff == 0) {
+			if (g_log_tail.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+				break;
+			}
+		} else if (diff < 0) { // Full: the writer is a lap behind
+			g_log_dropped.fetch_add(1, std::memory_order_relaxed);
+			return;
+		} else {
+			pos = g_log_tail.load(std::memory_order_relaxed);
+		}
+	}
+	cell->rec = rec;
+	cell->seq.store(pos + 1, std::memory_order_release);
+}
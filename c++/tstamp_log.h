@@ -0,0 +1,87 @@
+#ifndef __TSTAMP_LOG_H__
+#define __TSTAMP_LOG_H__
+
+#include <cstddef>
+#include <cstdint>
+
+/* Asynchronous diagnostics for the acquisition threads. A log call stores a
+ * fixed size binary record (message ID and four integers) in a lock-free
+ * queue and returns: no formatting, no I/O and no lock on the caller side,
+ * so the diagnostics can stay on without disturbing the edge capture. A
+ * background thread started by tstamp_log_start() formats the records,
+ * rate limits each message and writes them out. A full queue drops the
+ * record and counts it, it never blocks the caller.
+ *
+ * Before tstamp_log_start() (or after tstamp_log_stop()) errors are
+ * written to stderr directly, as before, and the rest is discarded.
+ */
+
+// Records in the queue (power of two)
+#ifndef TSTAMP_LOG_RECORDS
+	#define TSTAMP_LOG_RECORDS 		1024
+#endif
+
+// Rate limit: lines per message ID in each TSTAMP_LOG_PERIOD_MS window, the
+// rest is counted and reported once the window is over
+#define TSTAMP_LOG_BURST 		10
+#define TSTAMP_LOG_PERIOD_MS 	10000
+
+// The writer thread drains the queue every TSTAMP_LOG_FLUSH_MS
+#define TSTAMP_LOG_FLUSH_MS 	100
+
+// Levels, from the most severe
+enum LogLevel {
+	TLOG_ERROR = 0,
+	TLOG_WARN,
+	TLOG_INFO,
+	TLOG_DEBUG,
+};
+
+// Message IDs, the format of each one is in tstamp_log.cpp
+enum LogId {
+	TL_UART_READ = 0, 	// a: errno
+	TL_UART_SELECT, 	// a: errno
+	TL_GPSD_LOST, 		// a: errno, 0 if closed by gpsd
+	TL_PPS_FETCH, 		// a: errno
+	TL_PPS_EDGE, 		// a: edge OS time s, b: ns, c: +- bound ns
+	TL_PPS_MISS,
+	TL_GGA_PAIRED, 		// a: delay after the PPS edge (ns)
+	TL_GGA_LATE, 		// a: delay after the PPS edge (ns)
+	TL_TIME_MISMATCH, 	// a: OS hh, b: OS mm, c: GPS hh, d: GPS mm
+	TL_TIME_OK, 		// a: threshold (min), b: difference (min)
+	TL_STATE_OPEN, 		// a: errno
+	TL_STATE_WRITE, 	// a: errno
+	TL_JOURNAL_OPEN, 	// a: errno
+	TL_JOURNAL_TRUNCATE, 	// a: errno
+	TL_JOURNAL_MAP, 	// a: errno
+	TL_JOURNAL_ROTATE, 	// a: errno
+	TL_LEAP_MISMATCH, 	// a: receiver TAI - UTC (s), b: table TAI - UTC (s)
+	TL_COUNT,
+};
+
+typedef struct {
+	uint64_t ts_ns; 	// CLOCK_REALTIME of the call
+	uint16_t id; 		// LogId
+	uint16_t reserved;
+	uint32_t tid;
+	int64_t a;
+	int64_t b;
+	int64_t c;
+	int64_t d;
+} log_record_t;
+
+// Counters since tstamp_log_start()
+typedef struct {
+	uint64_t written; 		// Lines written
+	uint64_t dropped; 		// Records lost to a full queue
+	uint64_t suppressed; 	// Records held back by the rate limit
+} log_stats_t;
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+int tstamp_log_start(const char *path = NULL, int level = TLOG_INFO);
+void tstamp_log_stop();
+void tstamp_log_level(int level);
+void tstamp_log_stats(log_stats_t *stats);
+void tstamp_log(uint16_t id, int64_t a = 0, int64_t b = 0, int64_t c = 0, int64_t d = 0);
+
+#endif /* __TSTAMP_LOG_H__ */
@@ -0,0 +1,274 @@
+#include <cstring>
+#include <unistd.h>
+#include <sched.h>
+#include <errno.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+
+#include "tstamp_notify.h"
+
+static inline uint64_t timespec_ns(const struct timespec *ts) {
+	return (uint64_t)ts->tv_sec * 1000000000ULL + (uint64_t)ts->tv_nsec;
+}
+
+static inline int futex_wait(std::atomic<uint32_t> *addr, uint32_t val, const struct timespec *timeout) {
+	return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAIT_PRIVATE, val, timeout, NULL, 0);
+}
+
+static inline int futex_wake_all(std::atomic<uint32_t> *addr) {
+	return syscall(SYS_futex, reinterpret_cast<uint32_t *>(addr), FUTEX_WAKE_PRIVATE, INT32_MAX, NULL, NULL, 0);
+}
+
+// Notifier whose subscribers the calling thread is dispatching to
+static thread_local const TimeNotifier *t_dispatching = NULL;
+
+TimeNotifier::TimeNotifier() : m_seq(0), m_published(0), m_futex(0), m_dispatching(0), m_waiters(0) {
+	for (int i = 0; i < TNOTIFY_MAX_SUBSCRIBERS; i++) {
+		m_subs[i].state = 0;
+		m_subs[i].mask = 0;
+		m_subs[i].cb = NULL;
+		m_subs[i].arg = NULL;
+		m_subs[i].fd = -1;
+	}
+	for (int i = 0; i < TNOTIFY_RING_SIZE; i++) {
+		m_ring[i].seq = 0;
+		memset(&m_ring[i].ev, 0, sizeof(m_ring[i].ev));
+	}
+}
+
+TimeNotifier::~TimeNotifier() {
+	for (int i = 0; i < TNOTIFY_MAX_SUBSCRIBERS; i++) {
+		if (m_subs[i].state.load() != 0) {
+			release(i);
+		}
+	}
+}
+
+int TimeNotifier::addSubscriber(uint32_t mask, TimeEventCallback cb, void *arg, int fd) {
+	for (int i = 0; i < TNOTIFY_MAX_SUBSCRIBERS; i++) {
+		int expected = 0;
+		if (m_subs[i].state.compare_exchange_strong(expected, 1)) {
+			m_subs[i].mask = mask;
+			m_subs[i].cb = cb;
+			m_subs[i].arg = arg;
+			m_subs[i].fd = fd;
+			m_subs[i].state.store(2, std::memory_order_release);
+			return i;
+		}
+	}
+	return -1;
+}
+
+int TimeNotifier::subscribe(uint32_t mask, TimeEventCallback cb, void *arg) {
+	if (cb == NULL) {
+		return -1;
+	}
+	return addSubscriber(mask, cb, arg, -1);
+}
+
+int TimeNotifier::subscribeFd(uint32_t mask, int *fd) {
+	int efd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+	if (efd < 0) {
+		return -1;
+	}
+	int id = addSubscriber(mask, NULL, NULL, efd);
+	if (id < 0) {
+		close(efd);
+		return -1;
+	}
+	*fd = efd;
+	return id;
+}
+
+void TimeNotifier::unsubscribe(int id) {
+	if (id < 0 || id >= TNOTIFY_MAX_SUBSCRIBERS) {
+		return;
+	}
+
+	// From a callback: waiting for the dispatch to end would wait for
+	// ourselves, publish() completes the removal after its loop
+	int expected = 2;
+	if (t_dispatching == this) {
+		m_subs[id].state.compare_exchange_strong(expected, 3);
+		return;
+	}
+
+	if (m_subs[id].state.compare_exchange_strong(expected, 1)) {
+		release(id);
+	}
+}
+
+// Free an entry taken out of the dispatch (state 1 or 3)
+void TimeNotifier::release(int id) {
+
+	m_subs[id].state.store(1);
+
+	// Wait for the publishers which may still be using this entry
+	while (m_dispatching.load() != 0) {
+		sched_yield();
+	}
+	freeEntry(id);
+}
+
+void TimeNotifier::freeEntry(int id) {
+	if (m_subs[id].fd >= 0) {
+		close(m_subs[id].fd);
+		m_subs[id].fd = -1;
+	}
+	m_subs[id].cb = NULL;
+	m_subs[id].state.store(0);
+}
+
+void TimeNotifier::publish(TimeEvent *ev) {
+
+	clock_gettime(CLOCK_MONOTONIC, &ev->notify_ts);
+
+	uint32_t seq = m_seq.fetch_add(1) + 1;
+	if (seq == 0) { // 0 marks a slot being written
+		seq = m_seq.fetch_add(1) + 1;
+	}
+	ev->seq = seq;
+
+	// Seqlock write of the ring slot
+	Slot &slot = m_ring[seq % TNOTIFY_RING_SIZE];
+	slot.seq.store(0, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	slot.ev = *ev;
+	slot.seq.store(seq, std::memory_order_release);
+
+	// Highest committed sequence, lower ones may still be in flight
+	uint32_t pub = m_published.load(std::memory_order_relaxed);
+	while ((int32_t)(seq - pub) > 0 && !m_published.compare_exchange_weak(pub, seq, std::memory_order_release)) {}
+
+	m_futex.fetch_add(1);
+	if (m_waiters.load() > 0) {
+		futex_wake_all(&m_futex);
+	}
+
+	const TimeNotifier *outer = t_dispatching;
+	t_dispatching = this;
+	m_dispatching.fetch_add(1);
+	for (int i = 0; i < TNOTIFY_MAX_SUBSCRIBERS; i++) {
+		Subscriber &sub = m_subs[i];
+		if (sub.state.load() != 2 || (sub.mask & ev->kind) == 0) {
+			continue;
+		}
+		if (sub.cb != NULL) {
+			sub.cb(ev, sub.arg);
+		} else {
+			uint64_t one = 1;
+			if (write(sub.fd, &one, sizeof(one)) < 0) {
+				// Counter saturated, the subscriber is not reading
+			}
+		}
+	}
+	m_dispatching.fetch_sub(1);
+	t_dispatching = outer;
+
+	// Removals requested by the callbacks. The entries are freed only when no
+	// publisher is dispatching, otherwise a later publish() retries: the
+	// acquisition threads never wait for an application thread.
+	if (m_dispatching.load() != 0) {
+		return;
+	}
+	for (int i = 0; i < TNOTIFY_MAX_SUBSCRIBERS; i++) {
+		int expected = 3;
+		if (m_subs[i].state.load() == 3 && m_subs[i].state.compare_exchange_strong(expected, 1)) {
+			if (m_dispatching.load() == 0) {
+				freeEntry(i);
+			} else {
+				m_subs[i].state.store(3);
+			}
+		}
+	}
+}
+
+// First event in mask after after_seq, in sequence order. Stops at a slot
+// whose event is assigned but not committed yet: the publisher wakes the
+// waiters once it is.
+bool TimeNotifier::readSlot(uint32_t mask, uint32_t after_seq, TimeEvent *ev) {
+	uint32_t last = m_seq.load(std::memory_order_acquire);
+	uint32_t s = after_seq;
+	if ((int32_t)(last - after_seq) > TNOTIFY_RING_SIZE) { // Older events overwritten
+		s = last - TNOTIFY_RING_SIZE;
+	}
+	while ((int32_t)(last - s) > 0) {
+		s++;
+		if (s == 0) { // Sequence 0 is skipped on wrap around
+			continue;
+		}
+		Slot &slot = m_ring[s % TNOTIFY_RING_SIZE];
+		uint32_t s1 = slot.seq.load(std::memory_order_acquire);
+		if (s1 != s) {
+			if (s1 == 0 || (int32_t)(s1 - s) < 0) {
+				return false; // Still being written
+			}
+			continue; // Overwritten by a later lap
+		}
+		TimeEvent tmp = slot.ev;
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot.seq.load(std::memory_order_relaxed) != s1) {
+			continue; // Overwritten while copying
+		}
+		if (tmp.kind & mask) {
+			*ev = tmp;
+			return true;
+		}
+	}
+	return false;
+}
+
+int TimeNotifier::waitEvent(uint32_t mask, uint32_t after_seq, TimeEvent *ev, int timeout_ms) {
+
+	struct timespec now, deadline;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	deadline.tv_sec = now.tv_sec + timeout_ms / 1000;
+	deadline.tv_nsec = now.tv_nsec + (timeout_ms % 1000) * 1000000L;
+	if (deadline.tv_nsec >= 1000000000L) {
+		deadline.tv_sec += 1;
+		deadline.tv_nsec -= 1000000000L;
+	}
+
+	bool slept = false;
+	m_waiters.fetch_add(1);
+
+	for (;;) {
+		uint32_t f = m_futex.load();
+
+		if (readSlot(mask, after_seq, ev)) {
+			break;
+		}
+
+		struct timespec rel, *prel = NULL;
+		if (timeout_ms >= 0) {
+			clock_gettime(CLOCK_MONOTONIC, &now);
+			int64_t left = (int64_t)timespec_ns(&deadline) - (int64_t)timespec_ns(&now);
+			if (left <= 0) {
+				m_waiters.fetch_sub(1);
+				return -1;
+			}
+			rel.tv_sec = left / 1000000000LL;
+			rel.tv_nsec = left % 1000000000LL;
+			prel = &rel;
+		}
+
+		futex_wait(&m_futex, f, prel);
+		slept = true;
+	}
+
+	m_waiters.fetch_sub(1);
+
+	if (slept) {
+		clock_gettime(CLOCK_MONOTONIC, &now);
+		m_wake_hist.record(timespec_ns(&now) - timespec_ns(&ev->notify_ts));
+	}
+
+	return 0;
+}
+
+void TimeNotifier::wakeLatency(uint64_t *count, uint64_t *mean_ns, uint64_t *max_ns) const {
+	*count = m_wake_hist.count();
+	*mean_ns = m_wake_hist.mean();
+	*max_ns = m_wake_hist.max();
+}
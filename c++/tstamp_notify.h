@@ -0,0 +1,113 @@
+#ifndef __TSTAMP_NOTIFY_H__
+#define __TSTAMP_NOTIFY_H__
+
+#include <cstdint>
+#include <atomic>
+#include <time.h>
+
+#include "latency_hist.h"
+
+// Maximum number of callback/eventfd subscribers
+#define TNOTIFY_MAX_SUBSCRIBERS 16
+
+// Depth of the ring of the last published events
+#define TNOTIFY_RING_SIZE 		16
+
+// Event kinds, also used as subscription masks
+enum TimeEventKind {
+	TEV_EPOCH 	= 0x01, // New validated PPS epoch (edge paired with a time label)
+	TEV_FLAGS 	= 0x02, // Status flags transition
+	TEV_ALL 	= 0x03,
+};
+
+typedef struct {
+	uint32_t seq; 				// Event sequence number, starts from 1
+	uint32_t kind; 				// TimeEventKind
+	uint8_t flags; 				// Status flags after the event
+	uint8_t old_flags; 			// Status flags before the event (TEV_FLAGS)
+	struct timespec edge; 		// PPS edge, OS time (TEV_EPOCH)
+	uint32_t hh; 				// Time label of the edge (TEV_EPOCH)
+	uint32_t mm;
+	uint32_t ss;
+	uint32_t us;
+	struct timespec notify_ts; 	// CLOCK_MONOTONIC time of the dispatch
+} TimeEvent;
+
+typedef void (*TimeEventCallback)(const TimeEvent *ev, void *arg);
+
+/* Publishes time events to the subscribers.
+ * publish() is called by the acquisition threads: callbacks run inline in the
+ * publishing thread and must be short, eventfd subscribers are signalled and
+ * waitEvent() callers are woken up through a futex. Application threads
+ * publish too (flag changes): a publisher never waits for another one, each
+ * ring slot is committed on its own and waitEvent() delivers the events in
+ * sequence order, waiting for a slot still being written rather than
+ * skipping it.
+ */
+class TimeNotifier {
+
+public:
+
+	TimeNotifier();
+	~TimeNotifier();
+
+	// Register a callback for the events in mask. Returns the subscription id or -1.
+	int subscribe(uint32_t mask, TimeEventCallback cb, void *arg);
+
+	// Register an eventfd signalled on the events in mask. Returns the
+	// subscription id or -1, the eventfd is returned in *fd.
+	int subscribeFd(uint32_t mask, int *fd);
+
+	// Remove a subscription. When it returns the callback is no longer running.
+	// Called from a callback (e.g. a subscriber detaching itself) the removal
+	// is deferred to the end of the dispatch, no later event is delivered.
+	void unsubscribe(int id);
+
+	// Wait for the first event in mask with seq > after_seq.
+	// Returns 0 on success, -1 on timeout (timeout_ms < 0 waits forever).
+	int waitEvent(uint32_t mask, uint32_t after_seq, TimeEvent *ev, int timeout_ms);
+
+	// Sequence number of the last published event. Lower ones may still be
+	// being written by a concurrent publisher.
+	uint32_t lastSeq() const { return m_published.load(std::memory_order_acquire); }
+
+	// Called by the acquisition threads.
+	void publish(TimeEvent *ev);
+
+	// Notify to wake latency measured by waitEvent().
+	void wakeLatency(uint64_t *count, uint64_t *mean_ns, uint64_t *max_ns) const;
+	const LatencyHistogram &wakeHistogram() const { return m_wake_hist; }
+
+private:
+
+	struct Subscriber {
+		std::atomic<int> state; // 0 free, 1 being set up or removed, 2 active, 3 removal deferred
+		uint32_t mask;
+		TimeEventCallback cb;
+		void *arg;
+		int fd;
+	};
+
+	struct Slot {
+		std::atomic<uint32_t> seq; // 0 while being written
+		TimeEvent ev;
+	};
+
+	int addSubscriber(uint32_t mask, TimeEventCallback cb, void *arg, int fd);
+	bool readSlot(uint32_t mask, uint32_t after_seq, TimeEvent *ev);
+	void release(int id);
+	void freeEntry(int id);
+
+	Subscriber m_subs[TNOTIFY_MAX_SUBSCRIBERS];
+	Slot m_ring[TNOTIFY_RING_SIZE];
+
+	std::atomic<uint32_t> m_seq; 			// Last sequence number assigned
+	std::atomic<uint32_t> m_published; 	// Highest sequence number committed
+	std::atomic<uint32_t> m_futex; 			// Bumped after each publish
+	std::atomic<uint32_t> m_dispatching; 	// Publishers walking m_subs
+	std::atomic<uint32_t> m_waiters; 		// Threads in waitEvent()
+
+	LatencyHistogram m_wake_hist;
+};
+
+#endif /* __TSTAMP_NOTIFY_H__ */
@@ -0,0 +1,463 @@
+#ifndef __TSTAMP_POLICY_H__
+#define __TSTAMP_POLICY_H__
+
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <poll.h>
+#include <fcntl.h>
+
+#include "hk_fpga.h"
+#include "hw_counter.h"
+#include "pps_dev.h"
+#include "uart.h"
+#include "nmea.h"
+#include "ubx.h"
+#include "gpsd.h"
+#include "seqlock.h"
+
+/* Compile time policies of TimeStampCore (tstamp_core.h). Each policy is a
+ * small class with inline members, so the chosen path is compiled in without
+ * virtual calls or runtime switches. TimeStamp uses the same PPS sources,
+ * clocks and label sources for its runtime configured paths.
+ *
+ * ClockSource, time base of the PPS edges:
+ *   uint64_t now();                                     ticks
+ *   int64_t toNs(int64_t ticks) const;
+ *   void edge(uint64_t ticks, struct timespec *ts);     time of an edge, once per edge
+ *   static const bool os_clock;                         ticks are CLOCK_REALTIME ns
+ *
+ * PpsSource, edge capture:
+ *   int open(const TimeStampCoreConfig &cfg);
+ *   void close();
+ *   template <class Clock> int wait(Clock &clock, const std::atomic<bool> &stop, PpsEdge *edge);
+ *
+ * LabelSource, time labels of the edges:
+ *   int open(const TimeStampCoreConfig &cfg);
+ *   void close();
+ *   int read(int wake_fd, nmea_gga_t *label);  1 label, 0 nothing yet or woken, -1 source silent
+ *
+ * SyncPolicy, a template <typename T> with store(const T &) and load(T *) const:
+ * SeqLock (lock-free, one writer) or SyncMutex.
+ *
+ * FlagPolicy: static const bool auto_clear, see TimeStampAcq in tstamp_acq.h.
+ */
+
+// FPGA poll: sleep between two reads of the PPS input and reads before
+// giving up. PPS_POLL_US 0 busy polls, bounded by PPS_SPIN_TIMEOUT_NS.
+#ifndef PPS_POLL_US
+#define PPS_POLL_US 			5
+#endif
+#define PPS_POLL_COUNT 			150000
+#define PPS_SPIN_TIMEOUT_NS 	1500000000ULL
+
+// Kernel PPS source: give up after PPS_DEV_WAIT_MS, check for shutdown every PPS_DEV_STEP_MS
+#define PPS_DEV_WAIT_MS 	1500
+#define PPS_DEV_STEP_MS 	100
+
+// Bound assumed for the interrupt timestamps of the kernel PPS source
+#define PPS_DEV_UNC_NS 		1000
+
+// UIO interrupt source: bound assumed for the wake up of the thread after the
+// interrupt, the edge is stamped when read() returns
+#define PPS_UIO_UNC_NS 		20000
+
+// Devices and endpoints, each policy uses its own fields
+struct TimeStampCoreConfig {
+	bool fpga_sim; 				// Registers simulated by hk_fpga_sim, /dev/mem is not mapped
+	const char *pps_device; 	// PpsKernel: /dev/ppsN
+	int pps_edge; 				// PpsKernel: PPS_DEV_ASSERT or PPS_DEV_CLEAR
+	const char *uio_device; 	// PpsUio: /dev/uioN of the PPS interrupt
+	const char *uart_device; 	// LabelNmea, LabelUbx
+	const char *gpsd_host; 		// LabelGpsd
+	uint16_t gpsd_port;
+
+	TimeStampCoreConfig() : fpga_sim(false), pps_device("/dev/pps0"), pps_edge(PPS_DEV_ASSERT),
+		uio_device("/dev/uio0"), uart_device(UART_DEVICE), gpsd_host(GPSD_HOST), gpsd_port(GPSD_PORT) {}
+};
+
+// One captured PPS edge
+typedef struct {
+	struct timespec ts; 	// Edge, CLOCK_REALTIME (virtual time with ClockVirtual)
+	uint64_t ticks; 		// Edge, clock ticks
+	uint32_t unc_ns; 		// +- bound of ts
+	uint64_t bracket_ns; 	// Interval that bracketed the edge, 0 if not polled
+	uint64_t waited_ns; 	// From the start of wait() to the edge
+	uint32_t polls; 		// Input reads (poll), sequence number (kernel), interrupt count (UIO)
+} PpsEdge;
+
+static inline void ns_to_timespec(uint64_t ns, struct timespec *ts) {
+	ts->tv_sec = (time_t)(ns / 1000000000ULL);
+	ts->tv_nsec = (long)(ns % 1000000000ULL);
+}
+
+static inline uint32_t half_bracket(uint64_t bracket) {
+	return (uint32_t)(bracket < 0x1FFFFFFFEULL ? (bracket + 1) / 2 : 0xFFFFFFFF);
+}
+
+/*--- Clock sources ---*/
+
+// OS clock, ticks are CLOCK_REALTIME ns
+class ClockRealtime {
+public:
+	static const bool os_clock = true;
+	uint64_t now() {
+		struct timespec ts;
+		clock_gettime(CLOCK_REALTIME, &ts);
+		return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	}
+	int64_t toNs(int64_t ticks) const { return ticks; }
+	void edge(uint64_t ticks, struct timespec *ts) { ns_to_timespec(ticks, ts); }
+};
+
+// CPU counter (hw_counter.h), calibrated on the PPS edges. The OS clock is
+// read once per edge to pair the counter with CLOCK_REALTIME.
+class ClockHwCounter {
+public:
+	static const bool os_clock = false;
+	void reset(double hz) { m_timebase.reset(hz); }
+	uint64_t now() { return hw_counter_read(); }
+	int64_t toNs(int64_t ticks) const { return m_timebase.toNs(ticks); }
+	void edge(uint64_t ticks, struct timespec *ts) {
+		struct timespec rt;
+		uint64_t c0 = hw_counter_read();
+		clock_gettime(CLOCK_REALTIME, &rt);
+		uint64_t c1 = hw_counter_read();
+		m_timebase.edge(ticks);
+		m_timebase.pair(c0 + (c1 - c0) / 2, &rt);
+		m_timebase.toRealtime(ticks, ts);
+	}
+	const HwTimebase &timebase() const { return m_timebase; }
+private:
+	HwTimebase m_timebase;
+};
+
+// Virtual clock for simulations: ns set by the test, advanced by step_ns on
+// each read so that the poll loops see time passing.
+class ClockVirtual {
+public:
+	static const bool os_clock = false;
+	explicit ClockVirtual(uint64_t step_ns = 1000) : m_ns(0), m_step_ns(step_ns) {}
+	void set(uint64_t ns) { m_ns.store(ns, std::memory_order_relaxed); }
+	void advance(uint64_t ns) { m_ns.fetch_add(ns, std::memory_order_relaxed); }
+	uint64_t now() { return m_ns.fetch_add(m_step_ns, std::memory_order_relaxed); }
+	int64_t toNs(int64_t ticks) const { return ticks; }
+	void edge(uint64_t ticks, struct timespec *ts) { ns_to_timespec(ticks, ts); }
+private:
+	std::atomic<uint64_t> m_ns;
+	uint64_t m_step_ns;
+};
+
+/*--- PPS sources ---*/
+
+// FPGA poll of HK_FPGA_GPIO_BIT7. The edge is bracketed by the time taken
+// before the last read that saw the old state and the time taken after the
+// first read that saw the new one: the midpoint is the edge, half the
+// bracket its uncertainty.
+template <unsigned PollUs = PPS_POLL_US>
+class PpsFpgaPoll {
+public:
+	PpsFpgaPoll() : m_mapped(false) {}
+
+	int open(const TimeStampCoreConfig &cfg) {
+		if (cfg.fpga_sim) {
+			if (g_hk_fpga_reg_mem == NULL) {
+				fprintf(stderr, "PpsFpgaPoll::open: Error: FPGA simulator not started\n");
+				return -1;
+			}
+			return 0;
+		}
+		if (hk_fpga_init() < 0) {
+			fprintf(stderr, "PpsFpgaPoll::open: Error: hk_fpga_init() failed\n");
+			return -1;
+		}
+		m_mapped = true;
+		return 0;
+	}
+
+	void close() {
+		if (m_mapped) {
+			hk_fpga_uninit();
+			m_mapped = false;
+		}
+	}
+
+	template <class Clock>
+	int wait(Clock &clock, const std::atomic<bool> &stop, PpsEdge *edge) {
+		uint32_t count = 0;
+		uint32_t state, old_state = 0x0000;
+		uint64_t start = clock.now(), before, last_before = start, after;
+		for (uint32_t i = 0; (PollUs == 0 || i < PPS_POLL_COUNT) && !stop.load(std::memory_order_relaxed); i++) {
+			before = clock.now();
+			state = g_hk_fpga_reg_mem->in_p & HK_FPGA_GPIO_BIT7;
+			if (state != old_state) {
+				old_state = state;
+				if (i > 0) { //If PPS does not change from 1, then PPS is not active
+					after = clock.now();
+					edge->ticks = last_before + (after - last_before) / 2;
+					clock.edge(edge->ticks, &edge->ts);
+					edge->bracket_ns = (uint64_t)clock.toNs((int64_t)(after - last_before));
+					edge->unc_ns = half_bracket(edge->bracket_ns);
+					edge->waited_ns = (uint64_t)clock.toNs((int64_t)(edge->ticks - start));
+					edge->polls = i;
+					return 0;
+				}
+			} else {
+				count++;
+				if (PollUs > 0) {
+					usleep(PollUs);
+				} else if ((uint64_t)clock.toNs((int64_t)(before - start)) > PPS_SPIN_TIMEOUT_NS) {
+					break;
+				}
+			}
+			last_before = before;
+		}
+		edge->polls = count;
+		return -1;
+	}
+
+private:
+	bool m_mapped; // FPGA mapped by open(), not by the simulator
+};
+
+// Kernel PPS source (pps_dev.h): the edge is timestamped by the interrupt
+// handler with CLOCK_REALTIME, the thread only picks it up. Waits in steps
+// to honour a shutdown request.
+class PpsKernel {
+public:
+	PpsKernel() : m_seq(0) {}
+
+	int open(const TimeStampCoreConfig &cfg) {
+		if (pps_dev_init(cfg.pps_device, cfg.pps_edge) < 0) {
+			fprintf(stderr, "PpsKernel::open: Error: pps_dev_init() failed\n");
+			return -1;
+		}
+		// Edges captured before open() are not used
+		struct timespec last;
+		m_seq = 0;
+		pps_dev_fetch(0, &last, &m_seq);
+		return 0;
+	}
+
+	void close() { pps_dev_uninit(); }
+
+	template <class Clock>
+	int wait(Clock &clock, const std::atomic<bool> &stop, PpsEdge *edge) {
+		static_assert(Clock::os_clock, "kernel PPS timestamps are CLOCK_REALTIME");
+		uint64_t start = clock.now();
+		for (int waited = 0; waited < PPS_DEV_WAIT_MS && !stop.load(std::memory_order_relaxed); waited += PPS_DEV_STEP_MS) {
+			// First call without timeout: the edge may be already there
+			int res = pps_dev_fetch(waited == 0 ? 0 : PPS_DEV_STEP_MS, &edge->ts, &m_seq);
+			if (res < 0) {
+				break;
+			}
+			if (res > 0) {
+				edge->ticks = (uint64_t)edge->ts.tv_sec * 1000000000ULL + edge->ts.tv_nsec;
+				edge->unc_ns = PPS_DEV_UNC_NS;
+				edge->bracket_ns = 0;
+				edge->waited_ns = edge->ticks > start ? edge->ticks - start : 0;
+				edge->polls = m_seq;
+				return 0;
+			}
+		}
+		edge->polls = m_seq;
+		return -1;
+	}
+
+private:
+	uint32_t m_seq; // Last kernel PPS sequence number
+};
+
+// PPS interrupt of the FPGA through a UIO device: read() blocks until the
+// interrupt, writing 1 enables it again. The edge is stamped on wake up, so
+// it is late by the scheduling latency, bounded by PPS_UIO_UNC_NS.
+class PpsUio {
+public:
+	PpsUio() : m_fd(-1) {}
+
+	int open(const TimeStampCoreConfig &cfg) {
+		m_fd = ::open(cfg.uio_device, O_RDWR | O_CLOEXEC);
+		if (m_fd < 0) {
+			fprintf(stderr, "PpsUio::open: Error: cannot open %s\n", cfg.uio_device);
+			return -1;
+		}
+		return 0;
+	}
+
+	void close() {
+		if (m_fd >= 0) {
+			::close(m_fd);
+			m_fd = -1;
+		}
+	}
+
+	template <class Clock>
+	int wait(Clock &clock, const std::atomic<bool> &stop, PpsEdge *edge) {
+		uint32_t enable = 1;
+		if (write(m_fd, &enable, sizeof(enable)) != sizeof(enable)) {
+			return -1;
+		}
+		uint64_t start = clock.now();
+		struct pollfd pfd;
+		pfd.fd = m_fd;
+		pfd.events = POLLIN;
+		for (int waited = 0; waited < PPS_DEV_WAIT_MS && !stop.load(std::memory_order_relaxed); waited += PPS_DEV_STEP_MS) {
+			pfd.revents = 0;
+			if (poll(&pfd, 1, PPS_DEV_STEP_MS) <= 0) {
+				continue;
+			}
+			uint32_t irq_count;
+			if (read(m_fd, &irq_count, sizeof(irq_count)) != sizeof(irq_count)) {
+				return -1;
+			}
+			edge->ticks = clock.now();
+			clock.edge(edge->ticks, &edge->ts);
+			edge->unc_ns = PPS_UIO_UNC_NS;
+			edge->bracket_ns = 0;
+			edge->waited_ns = (uint64_t)clock.toNs((int64_t)(edge->ticks - start));
+			edge->polls = irq_count;
+			return 0;
+		}
+		edge->polls = 0;
+		return -1;
+	}
+
+private:
+	int m_fd;
+};
+
+/*--- Label sources ---*/
+
+// GPS second of day minus the second of day of the PPS edge, in [-12h, 12h).
+// TimeStamp labels the edges in UTC with it, see toUtc().
+static inline int label_offset(int hh, int mm, int ss, const struct timespec *edge) {
+	int off = (hh * 3600 + mm * 60 + ss) - (int)(edge->tv_sec % 86400);
+	if (off >= 43200) {
+		off -= 86400;
+	} else if (off < -43200) {
+		off += 86400;
+	}
+	return off;
+}
+
+// GGA sentences from the UART
+class LabelNmea {
+public:
+	int open(const TimeStampCoreConfig &cfg) { return uart_init(cfg.uart_device); }
+	void close() { uart_uninit(); }
+	int read(int wake_fd, nmea_gga_t *label) {
+		int res = uart_read(wake_fd);
+		if (res <= 0) {
+			return res < 0 ? -1 : 0;
+		}
+		return nmea_gga_parse(g_uart_buff, g_uart_nbytes, label) == 0 ? 1 : 0;
+	}
+};
+
+// UBX NAV-PVT or NAV-TIMEUTC frames from the UART, frames may span reads
+class LabelUbx {
+public:
+	LabelUbx() : m_pos(0) { ubx_parser_reset(&m_parser); }
+	int open(const TimeStampCoreConfig &cfg) {
+		ubx_parser_reset(&m_parser);
+		m_pos = g_uart_nbytes = 0;
+		return uart_init(cfg.uart_device);
+	}
+	void close() { uart_uninit(); }
+	int read(int wake_fd, nmea_gga_t *label) {
+		// Rest of the last read first, one label per call
+		while (m_pos < g_uart_nbytes) {
+			if (ubx_parser_feed(&m_parser, g_uart_buff[m_pos++], label) > 0) {
+				return 1;
+			}
+		}
+		int res = uart_read(wake_fd);
+		m_pos = 0;
+		if (res <= 0) {
+			g_uart_nbytes = 0;
+			return res < 0 ? -1 : 0;
+		}
+		while (m_pos < g_uart_nbytes) {
+			if (ubx_parser_feed(&m_parser, g_uart_buff[m_pos++], label) > 0) {
+				return 1;
+			}
+		}
+		return 0;
+	}
+private:
+	ubx_parser_t m_parser;
+	int m_pos; // Next byte of g_uart_buff to parse
+};
+
+// gpsd TPV reports, the SKY satellites and HDOP apply to the following TPVs
+class LabelGpsd {
+public:
+	LabelGpsd() : m_sats(NMEA_SATS_UNKNOWN), m_hdop(NMEA_HDOP_UNKNOWN) {}
+	int open(const TimeStampCoreConfig &cfg) { return gpsd_init(cfg.gpsd_host, cfg.gpsd_port); }
+	void close() { gpsd_uninit(); }
+	int read(int wake_fd, nmea_gga_t *label) {
+		gpsd_msg_t msg;
+		int res = gpsd_read(wake_fd, &msg);
+		if (res <= 0) {
+			return res;
+		}
+		if (msg.cls == GPSD_SKY) {
+			m_sats = msg.sats;
+			m_hdop = msg.hdop_x10;
+		} else if (msg.cls == GPSD_TPV && msg.mode >= 2 && msg.has_time) {
+			*label = msg.label;
+			label->sats = m_sats;
+			label->hdop_x10 = m_hdop;
+			return 1;
+		}
+		return 0;
+	}
+private:
+	uint8_t m_sats;
+	uint16_t m_hdop;
+};
+
+/*--- Synchronization ---*/
+
+// Same interface as SeqLock, for values written by more than one thread or
+// readers that must not spin
+template <typename T>
+class SyncMutex {
+public:
+	SyncMutex() {
+		pthread_mutex_init(&m_lock, NULL);
+		memset(&m_val, 0, sizeof(m_val));
+	}
+	~SyncMutex() { pthread_mutex_destroy(&m_lock); }
+	void store(const T &val) {
+		pthread_mutex_lock(&m_lock);
+		m_val = val;
+		pthread_mutex_unlock(&m_lock);
+	}
+	void load(T *val) const {
+		pthread_mutex_lock(&m_lock);
+		*val = m_val;
+		pthread_mutex_unlock(&m_lock);
+	}
+private:
+	mutable pthread_mutex_t m_lock;
+	T m_val;
+};
+
+/*--- Flags ---*/
+
+// Flags cleared as soon as the condition is gone
+struct FlagsAutoClear {
+	static const bool auto_clear = true;
+};
+
+// Flags latched until clearFlags()
+struct FlagsLatched {
+	static const bool auto_clear = false;
+};
+
+#endif /* __TSTAMP_POLICY_H__ */
@@ -0,0 +1,83 @@
+#include <cstdio>
+#include <cstring>
+#include <cstddef>
+#include <fcntl.h>
+#include <unistd.h>
+#include <errno.h>
+
+#include "tstamp_state.h"
+#include "tstamp_log.h"
+
+static uint32_t state_checksum(const tstamp_state_t *state) {
+	const uint8_t *p = (const uint8_t *)state;
+	uint32_t sum = 0x811c9dc5; // FNV-1a
+	for (size_t i = 0; i < offsetof(tstamp_state_t, checksum); i++) {
+		sum = (sum ^ p[i]) * 0x01000193;
+	}
+	return sum;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Load the persisted clock state
+ *
+ * @retval  0 Success, state is filled
+ * @retval -1 Missing, truncated or corrupted file
+ *--------------------------------------------------------------------------------------*/
+int tstamp_state_load(const char *path, tstamp_state_t *state) {
+
+	int fd = open(path, O_RDONLY | O_CLOEXEC);
+	if (fd < 0) {
+		return -1;
+	}
+
+	ssize_t n = read(fd, state, sizeof(*state));
+	close(fd);
+
+	if (n != (ssize_t)sizeof(*state)
+		|| state->magic != TSTAMP_STATE_MAGIC
+		|| state->version != TSTAMP_STATE_VERSION
+		|| state->size != sizeof(*state)
+		|| state->checksum != state_checksum(state)) {
+		return -1;
+	}
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Save the clock state
+ *
+ * The state is written to a temporary file renamed over the previous one,
+ * so a crash never leaves a truncated state behind.
+ *
+ * @retval  0 Success
+ * @retval -1 Failure, error is logged with tstamp_log()
+ *--------------------------------------------------------------------------------------*/
+int tstamp_state_save(const char *path, const tstamp_state_t *state) {
+
+	tstamp_state_t out = *state;
+	out.magic = TSTAMP_STATE_MAGIC;
+	out.version = TSTAMP_STATE_VERSION;
+	out.size = sizeof(out);
+	out.checksum = state_checksum(&out);
+
+	char tmp_path[256];
+	snprintf(tmp_path, sizeof(tmp_path), "%s.tmp", path);
+
+	int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		tstamp_log(TL_STATE_OPEN, errno);
+		return -1;
+	}
+
+	ssize_t n = write(fd, &out, sizeof(out));
+	close(fd);
+
+	if (n != (ssize_t)sizeof(out) || rename(tmp_path, path) < 0) {
+		tstamp_log(TL_STATE_WRITE, errno);
+		unlink(tmp_path);
+		return -1;
+	}
+
+	return 0;
+}
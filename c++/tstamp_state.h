@@ -0,0 +1,37 @@
+#ifndef __TSTAMP_STATE_H__
+#define __TSTAMP_STATE_H__
+
+#include <cstdint>
+
+// Default location of the persisted clock state.
+#ifndef TSTAMP_STATE_FILE
+	#define TSTAMP_STATE_FILE "/var/tmp/tstamp.state"
+#endif
+
+#define TSTAMP_STATE_MAGIC 	0x54534d50 // "TSMP"
+#define TSTAMP_STATE_VERSION 	1
+
+/* Clock state saved by TimeStamp on shutdown and periodically, used to
+ * warm-start the servo and the time label on the next init().
+ */
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t size;
+	int64_t saved_sec; 		// OS time of the save
+	int64_t edge_sec; 		// Last PPS edge, OS time
+	int32_t edge_nsec;
+	int32_t label_offset; 	// GPS second of day - OS second of day at the edge
+	uint32_t label_us; 		// Sub-second part of the GGA label
+	uint32_t gga_delay_ns; 	// Delay of the GGA sentence after the PPS
+	double freq_ppb; 		// OS clock frequency error
+	uint8_t talker; 		// GGA talker ID ('P', 'L' or 'N')
+	uint8_t reserved[3];
+	uint32_t checksum;
+} tstamp_state_t;
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+int tstamp_state_load(const char *path, tstamp_state_t *state);
+int tstamp_state_save(const char *path, const tstamp_state_t *state);
+
+#endif /* __TSTAMP_STATE_H__ */
@@ -0,0 +1,160 @@
+#ifdef TRACEON
+
+#include <cstdio>
+#include <cstring>
+#include <atomic>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+
+#include "tstamp_trace.h"
+
+#define TRACE_FILE_SIZE (sizeof(trace_ring_hdr_t) + TSTAMP_TRACE_RECORDS * sizeof(trace_record_t))
+
+static thread_local trace_ring_hdr_t *t_ring = NULL;
+
+// Ring files of the process, removed by tstamp_trace_cleanup() once their
+// thread has unmapped them
+typedef struct {
+	char path[128];
+	bool mapped;
+	pid_t tid;
+} trace_file_t;
+
+// Unmaps the ring when a thread ends without tstamp_trace_thread_stop()
+struct TraceRingGuard {
+	~TraceRingGuard() { tstamp_trace_thread_stop(); }
+};
+static thread_local TraceRingGuard t_ring_guard;
+
+static pthread_mutex_t g_trace_lock = PTHREAD_MUTEX_INITIALIZER;
+static trace_file_t g_trace_files[TSTAMP_TRACE_MAX_RINGS];
+static int g_trace_nfiles = 0;
+
+/*--------------------------------------------------------------------------------------*
+ * Create and map the ring of the calling thread
+ *
+ * Called at the start of the thread, the file I/O stays out of the
+ * tracepoints. The ring is unmapped when the thread ends.
+ *
+ * @retval  0 Success, or ring already mapped
+ * @retval -1 Too many rings, file or mapping error
+ *--------------------------------------------------------------------------------------*/
+int tstamp_trace_thread_start() {
+
+	if (t_ring != NULL) {
+		return 0;
+	}
+
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+
+	pthread_mutex_lock(&g_trace_lock);
+	if (g_trace_nfiles >= TSTAMP_TRACE_MAX_RINGS) {
+		pthread_mutex_unlock(&g_trace_lock);
+		return -1;
+	}
+	trace_file_t *file = &g_trace_files[g_trace_nfiles];
+	snprintf(file->path, sizeof(file->path), "%s/tstamp-trace.%d.%d", TSTAMP_TRACE_DIR, (int)getpid(), (int)tid);
+
+	int fd = open(file->path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if (fd < 0) {
+		pthread_mutex_unlock(&g_trace_lock);
+		return -1;
+	}
+	if (ftruncate(fd, TRACE_FILE_SIZE) < 0) {
+		close(fd);
+		unlink(file->path);
+		pthread_mutex_unlock(&g_trace_lock);
+		return -1;
+	}
+	void *p = mmap(NULL, TRACE_FILE_SIZE, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if (p == MAP_FAILED) {
+		unlink(file->path);
+		pthread_mutex_unlock(&g_trace_lock);
+		return -1;
+	}
+	file->mapped = true;
+	file->tid = tid;
+	g_trace_nfiles++;
+	pthread_mutex_unlock(&g_trace_lock);
+
+	trace_ring_hdr_t *hdr = (trace_ring_hdr_t *)p;
+	hdr->version = TSTAMP_TRACE_VERSION;
+	hdr->rec_size = sizeof(trace_record_t);
+	hdr->capacity = TSTAMP_TRACE_RECORDS;
+	hdr->tid = (uint32_t)tid;
+	hdr->head = 0;
+	__atomic_store_n(&hdr->magic, TSTAMP_TRACE_MAGIC, __ATOMIC_RELEASE);
+	t_ring = hdr;
+	(void)&t_ring_guard; // Constructed here, destroyed at thread exit
+
+	return 0;
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Unmap the ring of the calling thread, before the thread returns
+ *
+ * The file stays for trace_dump until tstamp_trace_cleanup().
+ *--------------------------------------------------------------------------------------*/
+void tstamp_trace_thread_stop() {
+
+	if (t_ring == NULL) {
+		return;
+	}
+	munmap(t_ring, TRACE_FILE_SIZE);
+	t_ring = NULL;
+
+	pid_t tid = (pid_t)syscall(SYS_gettid);
+	pthread_mutex_lock(&g_trace_lock);
+	for (int i = 0; i < g_trace_nfiles; i++) {
+		if (g_trace_files[i].tid == tid) {
+			g_trace_files[i].mapped = false;
+		}
+	}
+	pthread_mutex_unlock(&g_trace_lock);
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Remove the ring files of the threads which have stopped
+ *--------------------------------------------------------------------------------------*/
+void tstamp_trace_cleanup() {
+
+	pthread_mutex_lock(&g_trace_lock);
+	int n = 0;
+	for (int i = 0; i < g_trace_nfiles; i++) {
+		if (g_trace_files[i].mapped) {
+			g_trace_files[n++] = g_trace_files[i];
+		} else {
+			unlink(g_trace_files[i].path);
+		}
+	}
+	g_trace_nfiles = n;
+	pthread_mutex_unlock(&g_trace_lock);
+}
+
+void tstamp_trace(uint16_t id, uint64_t a, uint64_t b) {
+
+	trace_ring_hdr_t *hdr = t_ring;
+	if (hdr == NULL) {
+		return;
+	}
+
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	uint64_t head = hdr->head;
+	trace_record_t *rec = (trace_record_t *)(hdr + 1) + (head & (TSTAMP_TRACE_RECORDS - 1));
+	rec->ts_ns = (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+	rec->seq = (uint32_t)head;
+	rec->id = id;
+	rec->reserved = 0;
+	rec->a = a;
+	rec->b = b;
+	__atomic_store_n(&hdr->head, head + 1, __ATOMIC_RELEASE);
+}
+
+#endif /* TRACEON */
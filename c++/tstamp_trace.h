@@ -0,0 +1,87 @@
+#ifndef __TSTAMP_TRACE_H__
+#define __TSTAMP_TRACE_H__
+
+#include <cstdint>
+
+/* Hot path tracepoints, enabled by -DTRACEON (make DEBUG=1).
+ * Each traced thread writes fixed size binary records in its own ring, a
+ * file mapped in memory (TSTAMP_TRACE_DIR/tstamp-trace.<pid>.<tid>), so
+ * tracing costs one clock read and a few stores. The rings are created by
+ * TSTAMP_TRACE_THREAD_START, never on the hot path: the acquisition threads
+ * call it when they start, an application thread calling read() or
+ * clearFlags() calls it once to have its TP_READ and TP_FLAGS recorded.
+ * Tracepoints hit by a thread without a ring are dropped. The rings are
+ * unmapped when their thread ends and removed by TSTAMP_TRACE_CLEANUP
+ * (TimeStamp::stopThreads()).
+ * trace_dump decodes the rings into a single timeline. Without TRACEON the
+ * tracepoints compile to nothing.
+ */
+
+#ifndef TSTAMP_TRACE_DIR
+	#define TSTAMP_TRACE_DIR "/tmp"
+#endif
+
+// Records per thread ring (power of two)
+#ifndef TSTAMP_TRACE_RECORDS
+	#define TSTAMP_TRACE_RECORDS 	32768
+#endif
+
+#define TSTAMP_TRACE_MAGIC 		0x54525343 // "TRSC"
+#define TSTAMP_TRACE_VERSION 	1
+
+// Tracepoint IDs
+enum TraceId {
+	TP_PPS_EDGE = 1, 	// a: edge OS time (ns), b: poll iterations
+	TP_PPS_MISS, 		// a: poll iterations
+	TP_GGA_PARSE, 		// a: delay after the PPS edge (ns), b: label second of day
+	TP_FLAGS, 			// a: old flags, b: new flags
+	TP_READ, 			// a: returned status, b: duration (ns)
+	TP_PPS_REJECT, 		// a: residual against the prediction (ns, signed), b: rejected edges
+};
+
+typedef struct {
+	uint64_t ts_ns; 	// CLOCK_MONOTONIC
+	uint32_t seq; 		// Record number in the ring
+	uint16_t id; 		// TraceId
+	uint16_t reserved;
+	uint64_t a;
+	uint64_t b;
+} trace_record_t;
+
+// Ring file header, followed by the records
+typedef struct {
+	uint32_t magic;
+	uint16_t version;
+	uint16_t rec_size;
+	uint32_t capacity;
+	uint32_t tid;
+	uint64_t head; 		// Records written, updated after each record
+	uint8_t reserved[40];
+} trace_ring_hdr_t;
+
+// Rings of the threads of the process still on disk
+#define TSTAMP_TRACE_MAX_RINGS 	16
+
+#ifdef TRACEON
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+int tstamp_trace_thread_start();
+void tstamp_trace_thread_stop();
+void tstamp_trace_cleanup();
+void tstamp_trace(uint16_t id, uint64_t a, uint64_t b);
+
+#define TSTAMP_TRACE(id, a, b) tstamp_trace((id), (uint64_t)(a), (uint64_t)(b))
+#define TSTAMP_TRACE_THREAD_START() tstamp_trace_thread_start()
+#define TSTAMP_TRACE_THREAD_STOP() tstamp_trace_thread_stop()
+#define TSTAMP_TRACE_CLEANUP() tstamp_trace_cleanup()
+
+#else
+
+#define TSTAMP_TRACE(id, a, b) do {} while (0)
+#define TSTAMP_TRACE_THREAD_START() do {} while (0)
+#define TSTAMP_TRACE_THREAD_STOP() do {} while (0)
+#define TSTAMP_TRACE_CLEANUP() do {} while (0)
+
+#endif /* TRACEON */
+
+#endif /* __TSTAMP_TRACE_H__ */
@@ -5,6 +5,7 @@
 #include <errno.h>
 
 #include "uart.h"
+#include "tstamp_log.h"
 #include <cstring> 
 #include <sys/select.h> // Include for select
 
@@ -13,9 +14,9 @@ int g_uart_nbytes = -1;
 const uint32_t g_uart_buff_sz = 1024;
 uint8_t g_uart_buff[1024];
 
-int uart_init() {
+int uart_init(const char *device) {
 
-    g_uart_fd = open("/dev/ttyPS1", O_RDWR | O_NOCTTY | O_NDELAY);
+    g_uart_fd = open(device, O_RDWR | O_NOCTTY | O_NDELAY);
 
     if(g_uart_fd < 0){
         fprintf(stderr, "Failed to open uart.\n");
@@ -79,7 +80,7 @@ int uart_uninit() {
     return 0;
 }
 
-int uart_read() {
+int uart_read(int wake_fd) {
     if (g_uart_fd < 0) {
         return -1;
     }
@@ -87,20 +88,31 @@ int uart_read() {
     fd_set read_fds;
     FD_ZERO(&read_fds);
     FD_SET(g_uart_fd, &read_fds);
+    int max_fd = g_uart_fd;
+    if (wake_fd >= 0) {
+        FD_SET(wake_fd, &read_fds);
+        if (wake_fd > max_fd) {
+            max_fd = wake_fd;
+        }
+    }
 
     struct timeval timeout;
     timeout.tv_sec = 5;  // Timeout di 1 secondo
     timeout.tv_usec = 0;
 
-    int ret = select(g_uart_fd + 1, &read_fds, NULL, NULL, &timeout);
+    int ret = select(max_fd + 1, &read_fds, NULL, NULL, &timeout);
 
     if (ret > 0) {
+        if (wake_fd >= 0 && FD_ISSET(wake_fd, &read_fds)) {
+            // Woken up by the caller, no data read
+            return 0;
+        }
         if (FD_ISSET(g_uart_fd, &read_fds)) {
             g_uart_nbytes = ::read(g_uart_fd, (void*)g_uart_buff, g_uart_buff_sz);
 
             if (g_uart_nbytes < 0) {
                 // An actual error occurred
-                fprintf(stderr, "UART read error: %s\n", strerror(errno));
+                tstamp_log(TL_UART_READ, errno);
                 return -1;
             }
             return g_uart_nbytes;
@@ -110,7 +122,7 @@ int uart_read() {
         return -1;
     } else {
         // Errore nella chiamata select
-        fprintf(stderr, "Select error: %s\n", strerror(errno));
+        tstamp_log(TL_UART_SELECT, errno);
         return -1;
     }
 
@@ -3,13 +3,17 @@
 
 #include <cstdint>
 
+// Serial port of the GPS receiver
+#define UART_DEVICE "/dev/ttyPS1"
+
 extern int g_uart_fd;
 extern int g_uart_nbytes;
 extern const uint32_t g_uart_buff_sz;
 extern uint8_t g_uart_buff[1024];
 
-int uart_init();
+int uart_init(const char *device = UART_DEVICE);
 int uart_uninit();
-int uart_read();
+// Wait up to 5 s for data. If wake_fd becomes readable, returns 0 without reading.
+int uart_read(int wake_fd = -1);
 
 #endif /* __UART_H__ */
\ No newline at end of file
@@ -0,0 +1,188 @@
+#include <cstring>
+#include <time.h>
+
+#include "ubx.h"
+#include "time_scale.h"
+
+// Parser states, in frame order
+enum {
+	UBX_ST_SYNC1 = 0,
+	UBX_ST_SYNC2,
+	UBX_ST_CLASS,
+	UBX_ST_ID,
+	UBX_ST_LEN1,
+	UBX_ST_LEN2,
+	UBX_ST_PAYLOAD,
+	UBX_ST_CK_A,
+	UBX_ST_CK_B,
+};
+
+static inline int32_t get_i32(const uint8_t *p) {
+	return (int32_t)((uint32_t)p[0] | ((uint32_t)p[1] << 8) | ((uint32_t)p[2] << 16) | ((uint32_t)p[3] << 24));
+}
+
+static inline void checksum(ubx_parser_t *p, uint8_t c) {
+	p->ck_a += c;
+	p->ck_b += p->ck_a;
+}
+
+// Time of day from the hour, minute, second and nano fields. nano is signed:
+// a negative value is before hh:mm:ss.
+static void set_time(nmea_gga_t *label, const uint8_t *hms, int32_t nano) {
+	int32_t sod = hms[0] * 3600 + hms[1] * 60 + hms[2];
+	if (nano < 0) {
+		nano += 1000000000;
+		sod = sod > 0 ? sod - 1 : 86399;
+	}
+	label->talker = 'U';
+	label->hh = sod / 3600;
+	label->mm = (sod / 60) % 60;
+	label->ss = sod % 60;
+	label->us = (uint32_t)nano / 1000;
+	label->fix = NMEA_FIX_UNKNOWN;
+	label->sats = NMEA_SATS_UNKNOWN;
+	label->hdop_x10 = NMEA_HDOP_UNKNOWN;
+}
+
+// Leap second data of NAV-TIMELS, passed on when it changes. The announced
+// change is at the end of a UTC day: the countdown is rounded to midnight.
+static void set_leap(ubx_parser_t *p, const uint8_t *b) {
+
+	if (!(b[23] & 0x01)) { // validCurrLs
+		return;
+	}
+	int32_t tai_utc = TAI_GPS_OFFSET + (int8_t)b[9];
+	int64_t next_utc = 0;
+	int32_t next_tai_utc = tai_utc;
+	int8_t change = (int8_t)b[11];
+	if ((b[23] & 0x02) && b[10] != 0 && change != 0) { // validTimeToLsEvent, a source, a change
+		int64_t at = (int64_t)time(NULL) + get_i32(&b[12]);
+		next_utc = (at + 43200) / 86400 * 86400;
+		next_tai_utc = tai_utc + change;
+	}
+	if (tai_utc == p->ls_tai_utc && next_utc == p->ls_next_utc && next_tai_utc == p->ls_next_tai_utc) {
+		return;
+	}
+	p->ls_tai_utc = tai_utc;
+	p->ls_next_utc = next_utc;
+	p->ls_next_tai_utc = next_tai_utc;
+	time_scale_update(tai_utc, next_utc, next_tai_utc);
+}
+
+// A frame with a good checksum is complete
+static int parser_frame(ubx_parser_t *p, nmea_gga_t *label) {
+
+	const uint8_t *b = p->payload;
+
+	if (p->cls != UBX_CLASS_NAV) {
+		return 0;
+	}
+
+	if (p->id == UBX_NAV_TIMELS && p->len == UBX_NAV_TIMELS_LEN) {
+		set_leap(p, b);
+		return 0;
+	}
+
+	if (p->id == UBX_NAV_TIMEUTC && p->len == UBX_NAV_TIMEUTC_LEN) {
+		if (!(b[19] & 0x04)) { // validUTC
+			return 0;
+		}
+		set_time(label, &b[16], get_i32(&b[8]));
+		return 1;
+	}
+
+	if (p->id == UBX_NAV_PVT && p->len == UBX_NAV_PVT_LEN) {
+		if (!(b[11] & 0x02)) { // validTime
+			return 0;
+		}
+		set_time(label, &b[8], get_i32(&b[16]));
+		uint8_t fix_type = b[20];
+		bool fix_ok = (b[21] & 0x01) != 0;
+		if (!fix_ok || fix_type == 0) {
+			label->fix = NMEA_FIX_NONE;
+		} else if (fix_type == 1) { // Dead reckoning only
+			label->fix = NMEA_FIX_ESTIMATED;
+		} else { // 2D, 3D, GNSS + dead reckoning, time only
+			label->fix = NMEA_FIX_GPS;
+		}
+		label->sats = b[23] < NMEA_SATS_UNKNOWN ? b[23] : NMEA_SATS_UNKNOWN;
+		// pDOP at offset 76 is not an HDOP, the HDOP stays unknown
+		return 1;
+	}
+
+	return 0;
+}
+
+void ubx_parser_reset(ubx_parser_t *p) {
+	memset(p, 0, sizeof(*p));
+}
+
+/*--------------------------------------------------------------------------------------*
+ * Feed one byte of the receiver stream
+ *
+ * NMEA sentences interleaved with the UBX frames are ignored. NAV-TIMELS frames
+ * update the leap second table (time_scale_update()) when their data changes.
+ *
+ * @retval 1 A NAV-PVT or NAV-TIMEUTC frame with a valid UTC time is complete, label is filled
+ * @retval 0 More bytes needed
+ *--------------------------------------------------------------------------------------*/
+int ubx_parser_feed(ubx_parser_t *p, uint8_t c, nmea_gga_t *label) {
+
+	switch (p->state) {
+	case UBX_ST_SYNC1:
+		if (c == UBX_SYNC1) {
+			p->state = UBX_ST_SYNC2;
+		}
+		break;
+	case UBX_ST_SYNC2:
+		p->state = c == UBX_SYNC2 ? UBX_ST_CLASS : c == UBX_SYNC1 ? UBX_ST_SYNC2 : UBX_ST_SYNC1;
+		p->ck_a = 0;
+		p->ck_b = 0;
+		break;
+	case UBX_ST_CLASS:
+		p->cls = c;
+		checksum(p, c);
+		p->state = UBX_ST_ID;
+		break;
+	case UBX_ST_ID:
+		p->id = c;
+		checksum(p, c);
+		p->state = UBX_ST_LEN1;
+		break;
+	case UBX_ST_LEN1:
+		p->len = c;
+		checksum(p, c);
+		p->state = UBX_ST_LEN2;
+		break;
+	case UBX_ST_LEN2:
+		p->len |= (uint16_t)(c << 8);
+		checksum(p, c);
+		p->pos = 0;
+		p->state = p->len > 0 ? UBX_ST_PAYLOAD : UBX_ST_CK_A;
+		break;
+	case UBX_ST_PAYLOAD:
+		// Long frames are checksummed but not kept
+		if (p->pos < UBX_MAX_PAYLOAD) {
+			p->payload[p->pos] = c;
+		}
+		checksum(p, c);
+		if (++p->pos == p->len) {
+			p->state = UBX_ST_CK_A;
+		}
+		break;
+	case UBX_ST_CK_A:
+		p->state = c == p->ck_a ? UBX_ST_CK_B : UBX_ST_SYNC1;
+		break;
+	case UBX_ST_CK_B:
+		p->state = UBX_ST_SYNC1;
+		if (c == p->ck_b && p->len <= UBX_MAX_PAYLOAD) {
+			return parser_frame(p, label);
+		}
+		break;
+	default:
+		p->state = UBX_ST_SYNC1;
+		break;
+	}
+
+	return 0;
+}
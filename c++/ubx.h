@@ -0,0 +1,45 @@
+#ifndef __UBX_H__
+#define __UBX_H__
+
+#include <cstdint>
+
+#include "nmea.h"
+
+// u-blox binary protocol, frame: B5 62 class id len(2, LE) payload ck_a ck_b
+#define UBX_SYNC1 			0xB5
+#define UBX_SYNC2 			0x62
+#define UBX_CLASS_NAV 		0x01
+#define UBX_NAV_PVT 		0x07 	// Position, velocity and time: UTC, fix type, satellites
+#define UBX_NAV_TIMEUTC 	0x21 	// UTC time only
+#define UBX_NAV_TIMELS 		0x26 	// Leap second: current GPS - UTC and next change
+
+#define UBX_NAV_PVT_LEN 	92
+#define UBX_NAV_TIMEUTC_LEN 20
+#define UBX_NAV_TIMELS_LEN 	24
+#define UBX_MAX_PAYLOAD 	UBX_NAV_PVT_LEN // Longer frames are skipped
+
+/* Incremental UBX parser, one byte at a time and without allocation. Frames
+ * other than NAV-PVT, NAV-TIMEUTC and NAV-TIMELS, and frames with a bad
+ * checksum, are skipped. The decoded time is a label as nmea_gga_parse()
+ * would fill it, talker 'U'. NAV-TIMELS gives no label: a change of its leap
+ * second data is passed to time_scale_update().
+ */
+typedef struct {
+	int state; 			// Position in the frame
+	uint8_t cls;
+	uint8_t id;
+	uint16_t len;
+	uint16_t pos;
+	uint8_t ck_a; 		// Running Fletcher checksum
+	uint8_t ck_b;
+	uint8_t payload[UBX_MAX_PAYLOAD];
+	int32_t ls_tai_utc; 	// Last NAV-TIMELS passed on, 0 if none
+	int64_t ls_next_utc;
+	int32_t ls_next_tai_utc;
+} ubx_parser_t;
+
+/* function declarations, detailed descriptions is in apparent implementation file  */
+void ubx_parser_reset(ubx_parser_t *p);
+int ubx_parser_feed(ubx_parser_t *p, uint8_t c, nmea_gga_t *label);
+
+#endif /* __UBX_H__ */